@@ -0,0 +1,206 @@
+#include "AllocationCounter.h"
+#include <spdlog/spdlog.h>
+
+#include <atomic>
+#include <cerrno>
+
+#if defined(TCN_ALLOCATION_ACCOUNTING) && defined(__GLIBC__)
+#define TCN_COUNT_ALLOCATIONS 1
+#include <dlfcn.h>
+#include <pthread.h>
+#endif
+
+namespace tcn {
+
+    namespace {
+        std::atomic<uint64_t> violations{0};
+        // initial-exec, so reading them from inside malloc never allocates
+        __attribute__((tls_model("initial-exec"))) thread_local int ignoreDepth{0};
+        __attribute__((tls_model("initial-exec"))) thread_local AllocationGroup *currentGroup{nullptr};
+
+        [[maybe_unused]] void record_allocation(std::size_t size) {
+            AllocationGroup *group = currentGroup;
+            if (group == nullptr || ignoreDepth > 0) {
+                return;
+            }
+            group->count.fetch_add(1, std::memory_order_relaxed);
+            group->bytes.fetch_add(size, std::memory_order_relaxed);
+            if (size >= kBulkAllocationSize) {
+                group->bulk.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        // for the pthread_create below
+        [[maybe_unused]] AllocationGroup *current_allocation_group() {
+            return currentGroup;
+        }
+
+        [[maybe_unused]] void set_current_allocation_group(AllocationGroup *group) {
+            currentGroup = group;
+        }
+    }
+
+    bool allocation_accounting_enabled() {
+#ifdef TCN_COUNT_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    AllocationCounts AllocationGroup::Counts() const {
+        AllocationCounts c;
+        c.count = count.load(std::memory_order_relaxed);
+        c.bytes = bytes.load(std::memory_order_relaxed);
+        c.bulk = bulk.load(std::memory_order_relaxed);
+        return c;
+    }
+
+    uint64_t allocation_violations() {
+        return violations;
+    }
+
+    AllocationIgnoreScope::AllocationIgnoreScope() {
+        ++ignoreDepth;
+    }
+
+    AllocationIgnoreScope::~AllocationIgnoreScope() {
+        --ignoreDepth;
+    }
+
+    AllocationGroupScope::AllocationGroupScope(AllocationCheck &check) : previous(currentGroup) {
+        currentGroup = &check.group;
+    }
+
+    AllocationGroupScope::~AllocationGroupScope() {
+        currentGroup = previous;
+    }
+
+    void AllocationCheck::Begin() {
+        if (!allocation_accounting_enabled()) {
+            return;
+        }
+        previousGroup = currentGroup;
+        currentGroup = &group;
+        begin = group.Counts();
+    }
+
+    void AllocationCheck::End(int generation) {
+        if (!allocation_accounting_enabled()) {
+            return;
+        }
+        auto end = group.Counts();
+        currentGroup = previousGroup;
+        if (generation != lastGeneration) {
+            lastGeneration = generation;
+            framesSinceWarmup = 0;
+        }
+        if (++framesSinceWarmup <= warmupFrames) {
+            return;
+        }
+        uint64_t bulk = end.bulk - begin.bulk;
+        ++steadyFrames;
+        steadySmallAllocations += (end.count - begin.count) - bulk;
+        if (bulk > 0) {
+            ++steadyViolations;
+            ++violations;
+            spdlog::error("Decoder: {0} bulk allocations ({1} bytes in total) while decoding a steady state frame",
+                          bulk, end.bytes - begin.bytes);
+        }
+    }
+
+    void AllocationCheck::Report() const {
+        if (!allocation_accounting_enabled() || steadyFrames == 0) {
+            return;
+        }
+        spdlog::info("Decoder: allocations - steady state frames: {0} with bulk allocations: {1} "
+                     "small allocations per frame: {2:.1f}",
+                     steadyFrames, steadyViolations, double(steadySmallAllocations) / double(steadyFrames));
+    }
+
+} // tcn
+
+#ifdef TCN_COUNT_ALLOCATIONS
+// glibc keeps its allocator reachable under these names, so the public entry points can be interposed
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+
+namespace {
+    struct CountedThreadStart {
+        void *(*start)(void *);
+        void *arg;
+        tcn::AllocationGroup *group;
+    };
+
+    void *run_counted_thread(void *p) {
+        CountedThreadStart s = *static_cast<CountedThreadStart *>(p);
+        __libc_free(p);
+        tcn::set_current_allocation_group(s.group);
+        return s.start(s.arg);
+    }
+}
+
+// threads inherit the allocation group of the thread creating them
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start)(void *), void *arg) {
+    using create_fn = int (*)(pthread_t *, const pthread_attr_t *, void *(*)(void *), void *);
+    static auto real_create = reinterpret_cast<create_fn>(dlsym(RTLD_NEXT, "pthread_create"));
+    tcn::AllocationGroup *group = tcn::current_allocation_group();
+    if (group == nullptr) {
+        return real_create(thread, attr, start, arg);
+    }
+    auto *s = static_cast<CountedThreadStart *>(__libc_malloc(sizeof(CountedThreadStart)));
+    if (s == nullptr) {
+        return EAGAIN;
+    }
+    *s = CountedThreadStart{start, arg, group};
+    int ret = real_create(thread, attr, run_counted_thread, s);
+    if (ret != 0) {
+        __libc_free(s);
+    }
+    return ret;
+}
+
+void *malloc(size_t size) {
+    tcn::record_allocation(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    tcn::record_allocation(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    tcn::record_allocation(size);
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    tcn::record_allocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    tcn::record_allocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    tcn::record_allocation(size);
+    void *p = __libc_memalign(alignment, size);
+    if (p == nullptr) {
+        return ENOMEM;
+    }
+    *ptr = p;
+    return 0;
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+}
+#endif
@@ -0,0 +1,104 @@
+#ifndef ORBBEC_CAPTURE_TEST_ALLOCATIONCOUNTER_H
+#define ORBBEC_CAPTURE_TEST_ALLOCATIONCOUNTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace tcn {
+
+    struct AllocationCounts {
+        uint64_t count{0};
+        uint64_t bytes{0};
+        // allocations of at least kBulkAllocationSize, i.e. anything sized by image or bitstream
+        uint64_t bulk{0};
+    };
+
+    // smaller allocations are libavcodec bookkeeping (AVBufferRef / AVFrame references per packet)
+    constexpr std::size_t kBulkAllocationSize{4096};
+
+    // true in builds with ALLOCATION_ACCOUNTING (glibc only), where malloc and friends are counted
+    bool allocation_accounting_enabled();
+
+    /**
+     * Counters of the threads attached to one decoder. Threads created by an attached thread are attached
+     * too, that is how libavcodec's frame and slice threads end up in the group of their decoder.
+     * Allocations of threads in no group (SDK callbacks, display, depth workers) are not counted.
+     */
+    struct AllocationGroup {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> bulk{0};
+
+        AllocationCounts Counts() const;
+    };
+
+    // steady state frames that performed bulk allocations, over all streams
+    uint64_t allocation_violations();
+
+    /**
+     * Allocations of the calling thread are not counted while an instance is alive,
+     * e.g. the output image handed to the application.
+     */
+    class AllocationIgnoreScope {
+    public:
+        AllocationIgnoreScope();
+        ~AllocationIgnoreScope();
+
+        AllocationIgnoreScope(AllocationIgnoreScope const &) = delete;
+        AllocationIgnoreScope &operator=(AllocationIgnoreScope const &) = delete;
+    };
+
+    class AllocationCheck;
+
+    /**
+     * Attaches the calling thread to the group of a check while an instance is alive, e.g. around
+     * opening the codec so its worker threads are counted with the decoder.
+     */
+    class AllocationGroupScope {
+    public:
+        explicit AllocationGroupScope(AllocationCheck &check);
+        ~AllocationGroupScope();
+
+        AllocationGroupScope(AllocationGroupScope const &) = delete;
+        AllocationGroupScope &operator=(AllocationGroupScope const &) = delete;
+
+    private:
+        AllocationGroup *previous;
+    };
+
+    /**
+     * Per-stream check that decoding a frame allocates nothing in bulk once warmed up.
+     * Only the decoding thread and the codec threads of the stream are counted, so several streams
+     * and the rest of the application do not show up in each other's results.
+     * Must outlive the codec threads attached to it.
+     */
+    class AllocationCheck {
+    public:
+        explicit AllocationCheck(uint64_t warmup_frames = 30) : warmupFrames(warmup_frames) {}
+
+        // attaches the calling thread until End()
+        void Begin();
+
+        // generation changes (e.g. the decoder's format change count) restart the warm-up
+        void End(int generation);
+
+        void Report() const;
+
+    private:
+        uint64_t warmupFrames;
+        uint64_t framesSinceWarmup{0};
+        uint64_t steadyFrames{0};
+        uint64_t steadySmallAllocations{0};
+        uint64_t steadyViolations{0};
+        int lastGeneration{0};
+        AllocationCounts begin;
+        AllocationGroup group;
+        AllocationGroup *previousGroup{nullptr};
+
+        friend class AllocationGroupScope;
+    };
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_ALLOCATIONCOUNTER_H
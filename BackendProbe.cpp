@@ -0,0 +1,328 @@
+#include "BackendProbe.h"
+#include "DecoderService.h"
+#include "RecordingIndex.h"
+#include "RunConfig.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include <libavutil/avutil.h>
+}
+
+namespace tcn::vpf {
+
+    namespace {
+        constexpr const char *kCacheHeader = "# key backend available timed fps init_ms";
+        // fallback build identity where the executable cannot be located
+        constexpr const char *kBuildStamp = __DATE__ " " __TIME__;
+
+        std::string host_name() {
+#if defined(__linux__) || defined(__APPLE__)
+            char name[256]{};
+            if (gethostname(name, sizeof(name) - 1) == 0 && name[0] != '\0') {
+                return name;
+            }
+#else
+            if (const char *name = std::getenv("COMPUTERNAME")) {
+                return name;
+            }
+#endif
+            return "unknown";
+        }
+
+        // modification time of the running executable, changes with every relink
+        std::string build_id() {
+#if defined(__linux__)
+            std::error_code ec;
+            const auto exe = std::filesystem::read_symlink("/proc/self/exe", ec);
+            if (!ec) {
+                const auto mtime = std::filesystem::last_write_time(exe, ec);
+                if (!ec) {
+                    return std::to_string(mtime.time_since_epoch().count());
+                }
+            }
+#endif
+            return kBuildStamp;
+        }
+
+        AVHWDeviceType backend_from_name(const std::string &name) {
+            return name == "software" ? AV_HWDEVICE_TYPE_NONE : av_hwdevice_find_type_by_name(name.c_str());
+        }
+
+        // the fastest timed backend, otherwise the first available one
+        AVHWDeviceType select_backend(const std::vector<BackendResult> &results) {
+            const BackendResult *best{nullptr};
+            for (const auto &r : results) {
+                if (r.available && (best == nullptr || r.fps > best->fps)) {
+                    best = &r;
+                }
+            }
+            return best != nullptr ? best->deviceType : AV_HWDEVICE_TYPE_NONE;
+        }
+
+        bool load_profile(const std::string &path, const std::string &key, BackendProfile &out) {
+            std::ifstream in(path);
+            std::string line;
+            while (std::getline(in, line)) {
+                if (line.empty() || line[0] == '#') {
+                    continue;
+                }
+                std::istringstream fields(line);
+                std::string line_key;
+                std::string name;
+                int available{0};
+                int timed{0};
+                BackendResult r;
+                if (!(fields >> line_key >> name >> available >> timed >> r.fps >> r.initMs) || line_key != key) {
+                    continue;
+                }
+                out.timed = timed != 0;
+                r.deviceType = backend_from_name(name);
+                if (name != "software" && r.deviceType == AV_HWDEVICE_TYPE_NONE) {
+                    continue;
+                }
+                r.available = available != 0;
+                out.results.push_back(r);
+            }
+            return !out.results.empty();
+        }
+
+        // replaces the lines of the key with lines, the profiles of other hosts / builds / formats are kept
+        bool rewrite_profile(const std::string &path, const std::string &key, const std::vector<std::string> &lines) {
+            std::vector<std::string> kept;
+            {
+                std::ifstream in(path);
+                std::string line;
+                while (std::getline(in, line)) {
+                    if (!line.empty() && line[0] != '#' && line.compare(0, key.size() + 1, key + " ") != 0) {
+                        kept.push_back(line);
+                    }
+                }
+            }
+            std::error_code ec;
+            const auto dir = std::filesystem::path(path).parent_path();
+            if (!dir.empty()) {
+                std::filesystem::create_directories(dir, ec);
+            }
+            std::ofstream out(path, std::ios::trunc);
+            if (!out) {
+                spdlog::warn("Backend: cannot write {0}", path);
+                return false;
+            }
+            out << kCacheHeader << "\n";
+            for (const auto &line : kept) {
+                out << line << "\n";
+            }
+            for (const auto &line : lines) {
+                out << line << "\n";
+            }
+            return static_cast<bool>(out);
+        }
+
+        bool save_profile(const std::string &path, const BackendProfile &profile) {
+            std::vector<std::string> lines;
+            for (const auto &r : profile.results) {
+                lines.push_back(fmt::format("{0} {1} {2} {3} {4:.1f} {5:.1f}", profile.key, backend_name(r.deviceType),
+                                            r.available ? 1 : 0, profile.timed ? 1 : 0, r.fps, r.initMs));
+            }
+            return rewrite_profile(path, profile.key, lines);
+        }
+
+        // the first access units of the sample, copied with padding like replay frames
+        std::vector<std::shared_ptr<std::vector<uint8_t>>> load_sample(const BackendProbeConfig &cfg,
+                                                                        uint32_t &width, uint32_t &height) {
+            std::vector<std::shared_ptr<std::vector<uint8_t>>> units;
+            std::ifstream in(cfg.samplePath, std::ios::binary);
+            if (!in) {
+                spdlog::warn("Backend: cannot open sample {0}, probing availability only", cfg.samplePath);
+                return units;
+            }
+            width = cfg.sampleWidth;
+            height = cfg.sampleHeight;
+            split_access_units(in, cfg.format, [&](uint64_t, const uint8_t *data, std::size_t size) {
+                auto au = std::make_shared<std::vector<uint8_t>>(size + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+                std::copy(data, data + size, au->begin());
+                au->resize(size);
+                units.push_back(std::move(au));
+                return units.size() < cfg.benchmarkFrames;
+            }, width, height);
+            return units;
+        }
+
+        BackendResult probe_backend(AVHWDeviceType type, const BackendProbeConfig &cfg,
+                                    const std::vector<std::shared_ptr<std::vector<uint8_t>>> &sample,
+                                    uint32_t width, uint32_t height) {
+            BackendResult r;
+            r.deviceType = type;
+            uint64_t images{0};
+            H26xDecoder decoder([&images](cv::Mat, const FrameMeta &) { ++images; });
+            decoder.threadCount = cfg.softwareThreads;
+            const auto t_init = std::chrono::steady_clock::now();
+            // DecoderInit falls back to software on its own for formats without a hw decoder, that is no hw result
+            if (!decoder.DecoderInit(type, cfg.format, OB_FORMAT_BGR) ||
+                (type != AV_HWDEVICE_TYPE_NONE && decoder.hw_device_ctx == nullptr)) {
+                return r;
+            }
+            r.initMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_init).count();
+            if (sample.empty()) {
+                r.available = true;
+                return r;
+            }
+
+            const auto t_start = std::chrono::steady_clock::now();
+            const auto budget = std::chrono::duration<double>(cfg.benchmarkSeconds);
+            for (std::size_t i = 0; i < sample.size(); ++i) {
+                EncodedFrame frame;
+                frame.buffer = sample[i];
+                frame.data = sample[i]->data();
+                frame.size = sample[i]->size();
+                frame.padding = sample[i]->capacity() - sample[i]->size();
+                frame.format = cfg.format;
+                frame.width = width;
+                frame.height = height;
+                frame.index = i;
+                frame.completeAccessUnit = true;
+                decode_frame(decoder, frame, true);
+                if (std::chrono::steady_clock::now() - t_start >= budget) {
+                    break;
+                }
+            }
+            decoder.Flush(std::chrono::steady_clock::now() + std::chrono::seconds(1));
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+            r.available = images > 0;
+            r.fps = seconds > 0. ? double(images) / seconds : 0.;
+            if (!r.available) {
+                spdlog::warn("Backend: {0} opened but decoded nothing from the sample", backend_name(type));
+            }
+            return r;
+        }
+    }
+
+    std::vector<AVHWDeviceType> default_backend_candidates() {
+        std::vector<AVHWDeviceType> preferred;
+#if defined(__APPLE__)
+        preferred.push_back(AV_HWDEVICE_TYPE_VIDEOTOOLBOX);
+#else
+        preferred.push_back(AV_HWDEVICE_TYPE_CUDA);
+#endif
+        // only what this ffmpeg build was configured with
+        std::vector<AVHWDeviceType> candidates;
+        for (auto type : preferred) {
+            AVHWDeviceType it{AV_HWDEVICE_TYPE_NONE};
+            while ((it = av_hwdevice_iterate_types(it)) != AV_HWDEVICE_TYPE_NONE) {
+                if (it == type) {
+                    candidates.push_back(type);
+                    break;
+                }
+            }
+        }
+        return candidates;
+    }
+
+    std::string default_backend_cache_path() {
+        const char *xdg = std::getenv("XDG_CACHE_HOME");
+        const char *home = std::getenv("HOME");
+        std::filesystem::path dir;
+        if (xdg != nullptr && xdg[0] != '\0') {
+            dir = xdg;
+        } else if (home != nullptr && home[0] != '\0') {
+            dir = std::filesystem::path(home) / ".cache";
+        } else {
+            return "orbbec_capture_test.backends";
+        }
+        return (dir / "orbbec_capture_test" / "backends").string();
+    }
+
+    std::string backend_cache_key(OBFormat format) {
+        std::string key = fmt::format("{0}|ffmpeg-{1}|{2}|{3}", host_name(), av_version_info(), build_id(),
+                                      codec_name(format));
+        // one whitespace separated field in the cache file
+        std::replace_if(key.begin(), key.end(), [](char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; }, '_');
+        return key;
+    }
+
+    const char *backend_name(AVHWDeviceType type) {
+        return type == AV_HWDEVICE_TYPE_NONE ? "software" : av_hwdevice_get_type_name(type);
+    }
+
+    BackendProfile probe_backends(const BackendProbeConfig &cfg) {
+        BackendProfile profile;
+        profile.key = backend_cache_key(cfg.format);
+        if (!cfg.cachePath.empty() && !cfg.refresh && load_profile(cfg.cachePath, profile.key, profile)) {
+            if (!profile.timed && !cfg.samplePath.empty()) {
+                // an availability-only profile (live run) is no answer once there is a sample to time on
+                spdlog::info("Backend: cached profile in {0} is untimed, probing on {1}", cfg.cachePath, cfg.samplePath);
+                profile.results.clear();
+            }
+        }
+        if (!profile.results.empty()) {
+            profile.cached = true;
+            profile.selected = select_backend(profile.results);
+            spdlog::info("Backend: {0} from the cached profile in {1}", backend_name(profile.selected), cfg.cachePath);
+            return profile;
+        }
+
+        const auto t_start = std::chrono::steady_clock::now();
+        uint32_t width{0};
+        uint32_t height{0};
+        std::vector<std::shared_ptr<std::vector<uint8_t>>> sample;
+        if (!cfg.samplePath.empty()) {
+            sample = load_sample(cfg, width, height);
+        }
+        auto candidates = cfg.candidates;
+        candidates.erase(std::remove(candidates.begin(), candidates.end(), AV_HWDEVICE_TYPE_NONE), candidates.end());
+        candidates.push_back(AV_HWDEVICE_TYPE_NONE);
+        for (auto type : candidates) {
+            auto r = probe_backend(type, cfg, sample, width, height);
+            if (!r.available) {
+                spdlog::info("Backend: {0} not available", backend_name(type));
+            } else if (sample.empty()) {
+                spdlog::info("Backend: {0} available, init {1:.1f}ms", backend_name(type), r.initMs);
+            } else {
+                spdlog::info("Backend: {0} decodes {1} at {2:.1f}fps, init {3:.1f}ms",
+                             backend_name(type), cfg.samplePath, r.fps, r.initMs);
+            }
+            profile.results.push_back(r);
+            // without timings the order decides, the first available candidate wins
+            if (r.available && sample.empty()) {
+                break;
+            }
+        }
+        profile.timed = !sample.empty();
+        profile.selected = select_backend(profile.results);
+        spdlog::info("Backend: selected {0} for {1} after probing for {2:.1f}ms", backend_name(profile.selected),
+                     codec_name(cfg.format),
+                     std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count());
+        if (!cfg.cachePath.empty()) {
+            save_profile(cfg.cachePath, profile);
+        }
+        return profile;
+    }
+
+    void invalidate_backend_profile(const std::string &cache_path, OBFormat format, AVHWDeviceType failed) {
+        if (cache_path.empty() || failed == AV_HWDEVICE_TYPE_NONE) {
+            return;
+        }
+        const auto key = backend_cache_key(format);
+        BackendProfile profile;
+        if (!load_profile(cache_path, key, profile)) {
+            return;
+        }
+        spdlog::warn("Backend: {0} failed, dropping the cached profile for {1} from {2}",
+                     backend_name(failed), codec_name(format), cache_path);
+        rewrite_profile(cache_path, key, {});
+    }
+
+} // tcn::vpf
@@ -0,0 +1,86 @@
+#ifndef ORBBEC_CAPTURE_TEST_BACKENDPROBE_H
+#define ORBBEC_CAPTURE_TEST_BACKENDPROBE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavutil/hwcontext.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+#include <libobsensor/h/ObTypes.h>
+
+namespace tcn::vpf {
+
+    struct BackendProbeConfig {
+        // hardware devices in order of preference, software decoding is always the last candidate
+        std::vector<AVHWDeviceType> candidates;
+        OBFormat format{OB_FORMAT_H264};
+        // raw recording (see split_access_units) the candidates are timed on, empty = availability only
+        std::string samplePath;
+        // frame size of raw yuyv samples
+        uint32_t sampleWidth{0};
+        uint32_t sampleHeight{0};
+        // per candidate, whichever limit is reached first
+        std::size_t benchmarkFrames{50};
+        double benchmarkSeconds{2.};
+        // codec threads of the software candidate
+        int softwareThreads{0};
+        // profiles of earlier probes, keyed by backend_cache_key(). empty = always probe, nothing saved
+        std::string cachePath;
+        // probe again even if the cache has a profile for this host and build
+        bool refresh{false};
+    };
+
+    struct BackendResult {
+        AVHWDeviceType deviceType{AV_HWDEVICE_TYPE_NONE};
+        bool available{false};
+        // decoded frames per second on the sample, 0 when only the availability was probed
+        double fps{0.};
+        // device and codec setup
+        double initMs{0.};
+    };
+
+    struct BackendProfile {
+        std::string key;
+        // probe order, software last
+        std::vector<BackendResult> results;
+        AVHWDeviceType selected{AV_HWDEVICE_TYPE_NONE};
+        bool cached{false};
+        // the candidates were timed on a sample, otherwise only their availability is known
+        bool timed{false};
+    };
+
+    // hardware decoders H26xDecoder drives on this platform and ffmpeg build, in order of preference
+    std::vector<AVHWDeviceType> default_backend_candidates();
+
+    // per user cache directory, falls back to the working directory
+    std::string default_backend_cache_path();
+
+    // host name, ffmpeg version and build of this binary, plus the stream format
+    std::string backend_cache_key(OBFormat format);
+
+    // "software" for AV_HWDEVICE_TYPE_NONE
+    const char *backend_name(AVHWDeviceType type);
+
+    /**
+     * Picks the decode backend for a stream format: tries the candidates in order, times each available one
+     * on the sample and selects the fastest (the first available one without a sample). The profile is cached
+     * by host and build, so later starts take the selection from the cache without touching any device.
+     * An untimed profile is probed again as soon as a sample is given.
+     */
+    BackendProfile probe_backends(const BackendProbeConfig &cfg);
+
+    // the device of a cached profile failed at run time, the next start probes again
+    void invalidate_backend_profile(const std::string &cache_path, OBFormat format, AVHWDeviceType failed);
+
+} // tcn::vpf
+
+#endif //ORBBEC_CAPTURE_TEST_BACKENDPROBE_H
@@ -0,0 +1,534 @@
+#include "CapturePipeline.h"
+#include "BackendProbe.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+namespace tcn {
+
+    CapturePipeline::CapturePipeline(PipelineConfig cfg, std::unique_ptr<FrameSource> src, image_cb cb)
+            : config(std::move(cfg)), source(std::move(src)), imageCallback(std::move(cb)),
+              frameQueue(config.queueSize, config.queueBytes > 0 ? config.queueBytes : std::numeric_limits<std::size_t>::max(),
+                         [](const EncodedFrame &frame) { return frame.Bytes(); }, config.memoryBudget),
+              dropPolicy(config.dropMode, config.dropPressure) {
+        frameSelect.add(frameQueue);
+        if (config.name.empty()) {
+            config.name = source->Name();
+        }
+        // backpressured throughput runs measure full quality decoding
+        config.adaptiveQuality = config.adaptiveQuality && config.dropOnFull;
+    }
+
+    CapturePipeline::~CapturePipeline() {
+        Stop();
+    }
+
+    bool CapturePipeline::Start() {
+        startTs = std::chrono::steady_clock::now();
+        lastFrameTs = startTs;
+        frameDurations.reserve(kReservedSamples);
+        decodeDurations.reserve(kReservedSamples);
+        sequence = std::make_unique<SequenceTracker>(config.name);
+        // a stopped pipeline can be started again, its queue accepts frames again
+        frameQueue.reopen();
+        stopped = false;
+        shouldStop = false;
+        auto since_start_ms = [this]() {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTs).count();
+        };
+
+        if (!source->Open()) {
+            spdlog::error("{0}: failed to open source", config.name);
+            return false;
+        }
+        if (!config.recordPath.empty()) {
+            recorder = std::make_unique<StreamRecorder>();
+            if (!recorder->Open(config.recordPath)) {
+                recorder.reset();
+                return false;
+            }
+        }
+        streamInfo = source->Info();
+        openMs = since_start_ms();
+        bool eager = config.eagerInit && streamInfo.width > 0 && streamInfo.height > 0;
+        quality = std::make_unique<vpf::QualityController>(config.name, config.quality,
+                                                           1000. / std::max<uint32_t>(source->Fps(), 1));
+
+        if (config.decoderService) {
+            if (eager) {
+                vpf::StreamRequest request;
+                request.name = config.name;
+                request.format = streamInfo.format;
+                request.outputFormat = config.outputFormat;
+                request.width = streamInfo.width;
+                request.height = streamInfo.height;
+                request.fps = source->Fps();
+                request.queueSize = config.queueSize;
+                request.queueBytes = config.queueBytes;
+                request.memoryBudget = config.memoryBudget;
+                request.adaptiveQuality = config.adaptiveQuality;
+                request.quality = config.quality;
+                request.parserBypass = config.parserBypass;
+                request.tensorOutput = config.tensorOutput;
+                request.tensor = config.tensor;
+                auto handle = config.decoderService->Acquire(request, [this](cv::Mat image, const vpf::FrameMeta &meta) { OnImage(std::move(image), meta); });
+                handle->Prepare(streamInfo.parameterSets);
+                std::scoped_lock<std::mutex> lk{handleMutex};
+                decoderHandle = handle;
+            }
+        } else {
+            // the decoder thread signals once its decoder is open, so the source never waits on warm-up
+            std::promise<void> ready;
+            auto ready_future = ready.get_future();
+            decoderTask = std::async(std::launch::async, [this, ready = std::move(ready)]() mutable {
+                DecoderLoop(std::move(ready));
+            });
+            ready_future.wait();
+        }
+        decoderReadyMs = since_start_ms();
+
+        if (config.depthFilter) {
+            depthStage = std::make_unique<DepthFilterStage>(config.name, config.depthFilterConfig, config.depthThread,
+                                                            [this](cv::Mat depth) {
+                                                                if (imageCallback) {
+                                                                    imageCallback(DepthName(), std::move(depth));
+                                                                }
+                                                            });
+            depthStage->Start();
+        }
+
+        source->SetFinishedCallback([this]() { NotifyProgress(); });
+        if (!source->Start([this](EncodedFrame frame) { OnFrame(std::move(frame)); })) {
+            spdlog::error("{0}: failed to start source", config.name);
+            Stop();
+            return false;
+        }
+        return true;
+    }
+
+    void CapturePipeline::RequestStop() {
+        if (shouldStop) {
+            return;
+        }
+        stopRequestTs = std::chrono::steady_clock::now();
+        drainDeadline = stopRequestTs + std::chrono::milliseconds(config.drainTimeoutMs);
+        // upstream first: a source blocked in push (backpressure mode) returns at once, later frames are dropped,
+        // the decoder keeps going through what is queued until the deadline
+        shouldStop = true;
+        frameQueue.close();
+    }
+
+    void CapturePipeline::Stop() {
+        RequestStop();
+        if (stopped) {
+            return;
+        }
+        stopped = true;
+        std::shared_ptr<vpf::DecoderHandle> handle;
+        {
+            std::scoped_lock<std::mutex> lk{handleMutex};
+            handle.swap(decoderHandle);
+        }
+        if (handle) {
+            // rejects new frames, decodes the queued ones until the deadline and flushes the codec
+            handle->Close(drainDeadline);
+        }
+        if (source) {
+            source->Stop();
+        }
+        if (depthStage) {
+            depthStage->Stop();
+        }
+        if (recorder) {
+            recorder->Close();
+        }
+        if (decoderTask.valid()) {
+            decoderTask.wait();
+        }
+        if (decoder) {
+            formatChanges = decoder->formatChanges;
+            recoveryStats = decoder->GetRecoveryStats();
+            decoder->DecoderTeardown();
+            decoder.reset();
+        }
+        if (handle) {
+            decodeDurations = handle->DecodeDurations();
+            recoveryStats = handle->GetRecoveryStats();
+            pooledPeakBytes = handle->PeakBytes();
+            stopDiscards += handle->DiscardedFrames();
+            droppedFrames += handle->DiscardedFrames();
+            sequence->OnQueueDrop(handle->DiscardedFrames());
+            sequence->SetDecoderSkips(handle->SkippedFrames());
+            stopFlushed += handle->FlushedFrames();
+            pooledQuality = std::make_unique<vpf::QualityController>(handle->Quality());
+        }
+        stopMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stopRequestTs).count();
+        spdlog::info("{0}: stopped in {1:.1f}ms, {2} queued frames discarded, {3} flushed from the codec",
+                     config.name, stopMs, stopDiscards.load(), stopFlushed.load());
+    }
+
+    bool CapturePipeline::Finished() const {
+        if (config.frameLimit > 0 && receivedFrames >= config.frameLimit) {
+            return true;
+        }
+        uint64_t processed = processedFrames;
+        if (config.decoderService) {
+            std::scoped_lock<std::mutex> lk{handleMutex};
+            processed = decoderHandle ? decoderHandle->ProcessedFrames() : 0;
+        }
+        return source->Finished() && processed + droppedFrames == receivedFrames;
+    }
+
+    void CapturePipeline::OnFrameHandled() {
+        // before the source finished its callback covers every frame handled so far
+        if (source->Finished()) {
+            NotifyProgress();
+        }
+    }
+
+    void CapturePipeline::NotifyProgress() {
+        if (config.progressCallback) {
+            config.progressCallback();
+        }
+    }
+
+    std::size_t CapturePipeline::QueuePeakBytes() const {
+        return config.decoderService ? pooledPeakBytes : frameQueue.peak_bytes();
+    }
+
+    double CapturePipeline::ElapsedSeconds() const {
+        return static_cast<double>(lastImageUs) / 1e6;
+    }
+
+    void CapturePipeline::OnFrame(EncodedFrame frame) {
+        if (!captureThreadConfigured) {
+            captureThreadConfigured = true;
+            apply_thread_settings(config.captureThread);
+        }
+        auto t_now = std::chrono::steady_clock::now();
+        auto t_diff_us = std::chrono::duration_cast<std::chrono::microseconds>(t_now - lastFrameTs).count();
+        lastFrameTs = t_now;
+        if (receivedFrames > 0) {
+            // skip first frame as it includes the startup time..
+            frameDurations.push_back(double(t_diff_us) / 1000.);
+        } else {
+            firstFrameMs = std::chrono::duration<double, std::milli>(t_now - startTs).count();
+        }
+        if (++receivedFrames == config.frameLimit) {
+            NotifyProgress();
+        }
+        frame.receivedTs = t_now;
+        if (!frame.preroll) {
+            sequence->SetSourceDiscards(source->DiscardedFrames());
+            sequence->OnArrival(frame.index, frame.discontinuity, t_now);
+        }
+        if (recorder) {
+            recorder->Write(frame, t_now);
+        }
+
+        // live overload handling: decide on whole GOPs / non-reference frames instead of whatever times out.
+        // seek preroll is never dropped, the seek target depends on every preroll frame
+        const bool may_drop = config.dropOnFull && !frame.preroll;
+        vpf::AccessUnitInfo au;
+        bool inspect = may_drop && vpf::is_h26x_format(frame.format);
+        if (inspect) {
+            au = vpf::inspect_access_unit(frame.format, frame.data, frame.size);
+        }
+
+        if (config.decoderService) {
+            std::shared_ptr<vpf::DecoderHandle> handle;
+            {
+                std::scoped_lock<std::mutex> lk{handleMutex};
+                if (!decoderHandle && !shouldStop) {
+                    vpf::StreamRequest request;
+                    request.name = config.name;
+                    request.format = frame.format;
+                    request.outputFormat = config.outputFormat;
+                    request.width = frame.width;
+                    request.height = frame.height;
+                    request.fps = source->Fps();
+                    request.queueSize = config.queueSize;
+                    request.queueBytes = config.queueBytes;
+                    request.memoryBudget = config.memoryBudget;
+                    request.adaptiveQuality = config.adaptiveQuality;
+                    request.quality = config.quality;
+                    request.parserBypass = config.parserBypass;
+                    request.tensorOutput = config.tensorOutput;
+                    request.tensor = config.tensor;
+                    request.processedCallback = [this]() { OnFrameHandled(); };
+                    decoderHandle = config.decoderService->Acquire(request, [this](cv::Mat image, const vpf::FrameMeta &meta) { OnImage(std::move(image), meta); });
+                }
+                handle = decoderHandle;
+            }
+            if (handle) {
+                sequence->SetDecoderSkips(handle->SkippedFrames());
+            }
+            if (inspect && handle) {
+                auto decision = dropPolicy.Admit(au, handle->Fill());
+                if (!decision.forward) {
+                    ++droppedFrames;
+                    sequence->OnPolicyDrop();
+                    return;
+                }
+                frame.resync = decision.resync;
+            }
+            // the handle queue is bounded, a full queue or a stream waiting for capacity drops the frame
+            const bool preroll = frame.preroll;
+            if (!handle || !handle->Submit(std::move(frame), !may_drop)) {
+                ++droppedFrames;
+                if (!preroll) {
+                    sequence->OnQueueDrop();
+                }
+                if (inspect) {
+                    dropPolicy.OnDropped(au);
+                }
+            }
+            return;
+        }
+
+        if (inspect) {
+            auto decision = dropPolicy.Admit(au, frameQueue.fill());
+            if (!decision.forward) {
+                ++droppedFrames;
+                sequence->OnPolicyDrop();
+                return;
+            }
+            frame.resync = decision.resync;
+        }
+
+        auto idx = frame.index;
+        const bool preroll = frame.preroll;
+        channel_op_status ret;
+        if (may_drop) {
+            auto timeout = std::chrono::milliseconds(std::max<int>(1, (1000 / std::max<uint32_t>(source->Fps(), 1)) - 5));
+            ret = frameQueue.push_wait_for(std::move(frame), timeout);
+        } else {
+            ret = frameQueue.push(std::move(frame));
+        }
+        if (ret != channel_op_status::success) {
+            ++droppedFrames;
+            if (!preroll) {
+                sequence->OnQueueDrop();
+            }
+            if (inspect) {
+                dropPolicy.OnDropped(au);
+            }
+            if (ret != channel_op_status::closed) {
+                spdlog::error("{0}: error while pushing frame {1} into queue", config.name, idx);
+            }
+        }
+    }
+
+    void CapturePipeline::OnImage(cv::Mat image, const vpf::FrameMeta &meta) {
+        ++decodedFrames;
+        sequence->OnDelivered();
+        const auto t_now = std::chrono::steady_clock::now();
+        auto image_us = std::chrono::duration_cast<std::chrono::microseconds>(t_now - startTs).count();
+        if (meta.valid) {
+            // the meta travelled with this very picture through the codec, reordering included
+            latencies.Add(std::chrono::duration<double, std::milli>(t_now - meta.receivedTs).count());
+        }
+        if (depthStage && meta.depthFrame) {
+            // the depth of exactly this color image. never holds up the color path, a busy depth stage drops it
+            depthStage->Submit(meta.depthFrame);
+        }
+        if (decodedFrames > 1) {
+            outputIntervals.Add(double(image_us - lastImageUs) / 1000.);
+        } else {
+            firstImageMs = double(image_us) / 1000.;
+        }
+        lastImageUs = image_us;
+        if (imageCallback) {
+            imageCallback(config.name, std::move(image));
+        }
+    }
+
+    bool CapturePipeline::CreateDecoder(OBFormat stream_format, const StreamInfo *info) {
+        auto init = [&](AVHWDeviceType device_type) {
+            // a failed init leaves a half open decoder behind, every attempt starts from a fresh one
+            decoder = std::make_unique<vpf::H26xDecoder>([this](cv::Mat image, const vpf::FrameMeta &meta) { OnImage(std::move(image), meta); });
+            decoder->threadCount = config.decoderThreads;
+            decoder->tensorOutput = config.tensorOutput;
+            decoder->tensor = config.tensor;
+            return info != nullptr
+                   ? decoder->DecoderInit(device_type, stream_format, config.outputFormat,
+                                          static_cast<int>(info->width), static_cast<int>(info->height), info->parameterSets)
+                   : decoder->DecoderInit(device_type, stream_format, config.outputFormat);
+        };
+        bool ok = init(config.deviceType);
+        if (!ok && config.deviceType != AV_HWDEVICE_TYPE_NONE) {
+            spdlog::warn("{0}: {1} decoder failed to open, falling back to software decoding",
+                         config.name, vpf::backend_name(config.deviceType));
+            vpf::invalidate_backend_profile(config.backendCache, stream_format, config.deviceType);
+            // later decoders of this pipeline (format changes) go straight to software
+            config.deviceType = AV_HWDEVICE_TYPE_NONE;
+            ok = init(AV_HWDEVICE_TYPE_NONE);
+        }
+        if (!ok) {
+            spdlog::error("{0}: error initializing decoder", config.name);
+            decoder.reset();
+        }
+        return ok;
+    }
+
+    void CapturePipeline::DecoderLoop(std::promise<void> ready) {
+        spdlog::info("{0}: start decoder thread", config.name);
+        // before the decoder exists, so codec threads and buffers inherit the placement
+        apply_thread_settings(config.decoderThread);
+        if (config.eagerInit && streamInfo.width > 0 && streamInfo.height > 0) {
+            CreateDecoder(streamInfo.format, &streamInfo);
+            spdlog::info("{0}: created decoder: {1}x{2}", config.name, streamInfo.width, streamInfo.height);
+        }
+        ready.set_value();
+
+        // woken by a frame or the queue closing (Stop), there is no polling interval
+        while (frameSelect.wait() != channel_select::stopped) {
+            EncodedFrame frame;
+            auto ret = frameQueue.try_pop(frame);
+            if (ret == channel_op_status::empty) {
+                continue;
+            } else if (ret == channel_op_status::closed) {
+                break;
+            } else if (ret != channel_op_status::success) {
+                spdlog::warn("{0}: unexpect buffer_channel return status.", config.name);
+                continue;
+            }
+            if (shouldStop && std::chrono::steady_clock::now() >= drainDeadline) {
+                // out of drain time, whatever is still queued is discarded
+                uint64_t discarded = 1 + frameQueue.clear();
+                stopDiscards += discarded;
+                droppedFrames += discarded;
+                sequence->OnQueueDrop(discarded);
+                break;
+            }
+
+            if (vpf::H26xDecoder::Supports(frame.format)) {
+                if (!decoder) {
+                    if (!CreateDecoder(frame.format, nullptr)) {
+                        // lost to decode, the next frame tries again
+                        ++processedFrames;
+                        OnFrameHandled();
+                        continue;
+                    }
+                    spdlog::info("{0}: created decoder: {1}x{2}", config.name, frame.width, frame.height);
+                }
+
+                if (frame.resync) {
+                    // the pictures before the gap get at most a frame interval to come out
+                    decoder->Resync(std::chrono::steady_clock::now() +
+                                    std::chrono::milliseconds(1000 / std::max<uint32_t>(source->Fps(), 1)));
+                }
+
+                auto t_start = std::chrono::steady_clock::now();
+                const uint64_t skipped = decoder->skippedFrames;
+                if (!vpf::decode_frame(*decoder, frame, config.parserBypass)) {
+                    spdlog::info("{0}: something went wrong with decoding..", config.name);
+                }
+                decoderSkips += decoder->skippedFrames - skipped;
+                sequence->SetDecoderSkips(decoderSkips);
+
+                auto t_diff_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - t_start).count();
+                decodeDurations.push_back(double(t_diff_us) / 1000.);
+
+                if (config.adaptiveQuality &&
+                    quality->Update(frameQueue.fill(), double(t_diff_us) / 1000.)) {
+                    apply_quality_level(*decoder, quality->Level());
+                }
+            } else {
+                spdlog::error("{0}: invalid frame: no color image {1}", config.name, frame.index);
+            }
+            ++processedFrames;
+            OnFrameHandled();
+        }
+        if (decoder) {
+            // frames still buffered in the codec (frame threads, reordering)
+            stopFlushed += decoder->Flush(drainDeadline);
+        }
+        spdlog::info("{0}: finish decoder thread", config.name);
+    }
+
+    void CapturePipeline::ReportStats() const {
+        spdlog::info("{0}: received: {1} dropped: {2} decoded: {3} fps: {4} format changes: {5}",
+                     config.name, receivedFrames.load(), droppedFrames.load(), decodedFrames.load(),
+                     ElapsedSeconds() > 0. ? static_cast<double>(decodedFrames) / ElapsedSeconds() : 0.,
+                     formatChanges);
+        spdlog::info("{0}: startup - open: {1:.1f}ms decoder ready: {2:.1f}ms first frame: {3:.1f}ms "
+                     "first image: {4:.1f}ms ({5} init)",
+                     config.name, openMs, decoderReadyMs, firstFrameMs.load(), firstImageMs.load(),
+                     config.eagerInit ? "eager" : "lazy");
+        source->ReportStats();
+        sequence->Report();
+        if (depthStage) {
+            depthStage->Report();
+        }
+        const auto &drops = dropPolicy.GetStats();
+        double decode_ms = std::accumulate(decodeDurations.begin(), decodeDurations.end(), 0.0);
+        spdlog::info("{0}: drops - non-reference: {1} gop tail: {2} resyncs: {3}, decode time per delivered frame: {4:.2f}ms",
+                     config.name, drops.nonReferenceDrops, drops.gopTailDrops, drops.resyncs,
+                     decodedFrames > 0 ? decode_ms / double(decodedFrames) : 0.);
+        spdlog::info("{0}: recovery - errors: {1} recoveries: {2} reopens: {3} discarded packets: {4} "
+                     "corrupted frames: {5} (concealed: {6}) recovery time last: {7:.1f}ms max: {8:.1f}ms total: {9:.1f}ms",
+                     config.name, recoveryStats.errors, recoveryStats.recoveries, recoveryStats.reopens,
+                     recoveryStats.discardedPackets, recoveryStats.corruptedFrames, recoveryStats.concealedFrames,
+                     recoveryStats.lastRecoveryMs, recoveryStats.maxRecoveryMs, recoveryStats.totalRecoveryMs);
+        spdlog::info("{0}: queue memory - peak: {1:.2f}MB limit: {2}", config.name, QueuePeakBytes() / 1e6,
+                     config.queueBytes > 0 ? fmt::format("{0:.2f}MB", config.queueBytes / 1e6) : std::string{"none"});
+        if (config.decoderService) {
+            if (pooledQuality) {
+                pooledQuality->Report();
+            }
+        } else if (quality) {
+            quality->Report();
+        }
+        report_stats(config.name + " frame_durations", frameDurations);
+        report_stats(config.name + " decode_durations", decodeDurations);
+        // from the frame leaving the source to its image leaving the decoder
+        report_stats(config.name + " latency", latencies);
+        double period_ms = 1000. / std::max<uint32_t>(source->Fps(), 1);
+        report_jitter(config.name + " capture", frameDurations, period_ms);
+        report_jitter(config.name + " decode", decodeDurations);
+        report_jitter(config.name + " output", outputIntervals.Samples(), period_ms);
+    }
+
+    PipelineReport CapturePipeline::GetReport() const {
+        PipelineReport r;
+        r.name = config.name;
+        r.stream = streamInfo;
+        r.stream.parameterSets.clear();
+        r.receivedFrames = receivedFrames;
+        r.droppedFrames = droppedFrames;
+        r.decodedFrames = decodedFrames;
+        r.fps = ElapsedSeconds() > 0. ? static_cast<double>(decodedFrames) / ElapsedSeconds() : 0.;
+        r.formatChanges = formatChanges;
+        r.drops = dropPolicy.GetStats();
+        r.recovery = recoveryStats;
+        r.queuePeakBytes = QueuePeakBytes();
+        if (depthStage) {
+            r.depthFiltered = depthStage->Filtered();
+            r.depthDropped = depthStage->Dropped();
+        }
+        r.loss = sequence->Counters();
+        r.lossPeakRollingRate = sequence->PeakRollingRate();
+        r.stopMs = stopMs;
+        r.stopDiscards = stopDiscards;
+        r.stopFlushed = stopFlushed;
+        r.decode = summarize(decodeDurations);
+        r.decodeP50 = percentile(decodeDurations, 0.5);
+        r.decodeP95 = percentile(decodeDurations, 0.95);
+        r.decodeP99 = percentile(decodeDurations, 0.99);
+        r.outputInterval = outputIntervals.Summary();
+        r.outputIntervalP99 = outputIntervals.Percentile(0.99);
+        r.latency = latencies.Summary();
+        r.latencyP99 = latencies.Percentile(0.99);
+        r.openMs = openMs;
+        r.decoderReadyMs = decoderReadyMs;
+        r.firstFrameMs = firstFrameMs;
+        r.firstImageMs = firstImageMs;
+        return r;
+    }
+
+} // tcn
@@ -0,0 +1,231 @@
+#ifndef ORBBEC_CAPTURE_TEST_CAPTUREPIPELINE_H
+#define ORBBEC_CAPTURE_TEST_CAPTUREPIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "budgeted_channel.h"
+#include "channel_select.h"
+#include "DecoderService.h"
+#include "DepthFilter.h"
+#include "FrameDropPolicy.h"
+#include "FrameSource.h"
+#include "H26xDecoder.h"
+#include "QualityController.h"
+#include "SequenceTracker.h"
+#include "Statistics.h"
+#include "ThreadConfig.h"
+
+namespace tcn {
+
+    struct PipelineConfig {
+        std::string name;
+        // a device that fails to open falls back to software decoding
+        AVHWDeviceType deviceType{AV_HWDEVICE_TYPE_NONE};
+        // backend profile the device came from, dropped when the device fails (optional)
+        std::string backendCache;
+        OBFormat outputFormat{OB_FORMAT_BGR};
+        std::size_t queueSize{8};
+        // bytes the queued frames may hold (EncodedFrame::Bytes), 0 = bounded by queueSize only
+        std::size_t queueBytes{0};
+        // host-wide ceiling shared with the other pipelines' queues, optional
+        std::shared_ptr<byte_budget> memoryBudget;
+        // codec threads for software decoding, 0 lets ffmpeg decide
+        int decoderThreads{0};
+        // drop frames when the queue stays full for a frame interval (live sources),
+        // otherwise apply backpressure to the source (replay throughput runs)
+        bool dropOnFull{true};
+        // applied on the first source callback (the SDK / replay thread) and in the decoder thread
+        ThreadSettings captureThread;
+        ThreadSettings decoderThread;
+        // when set, frames are decoded by the shared service instead of a per-pipeline decoder thread
+        std::shared_ptr<vpf::DecoderService> decoderService;
+        // open the decoder and its buffers from the source's stream profile before streaming starts
+        bool eagerInit{true};
+        // how frames are dropped when the decoder falls behind (only with dropOnFull)
+        DropMode dropMode{DropMode::keyframe};
+        // queue fill ratio above which non-reference frames are skipped
+        double dropPressure{0.5};
+        // step the decoder through cheaper modes under queue / decode time pressure. only with dropOnFull:
+        // under backpressure the queue is full by design, which is no reason to degrade
+        bool adaptiveQuality{true};
+        vpf::QualityLadderConfig quality;
+        // send complete access units straight to the codec, the parser is only used for fragmented input
+        bool parserBypass{true};
+        // on stop, queued frames and frames buffered in the codec are still decoded for this long,
+        // then discarded (0 = discard at once)
+        int drainTimeoutMs{200};
+        // images are delivered as normalized planar float tensors (3 x H x W) for inference consumers
+        bool tensorOutput{false};
+        vpf::TensorConfig tensor;
+        // filter depth frames on their own threads, delivered to the image callback as DepthName()
+        bool depthFilter{false};
+        DepthFilterConfig depthFilterConfig;
+        ThreadSettings depthThread;
+        // write every received frame and its arrival time here (plus timing_path()), for timed replays
+        std::string recordPath;
+        // Finished() once this many frames were received, 0 = when the source ends
+        uint64_t frameLimit{0};
+        // called from the source / decoder threads whenever Finished() may have turned true, optional
+        std::function<void()> progressCallback;
+    };
+
+    /**
+     * Results of one pipeline run, for the structured report written at exit.
+     */
+    struct PipelineReport {
+        std::string name;
+        StreamInfo stream;
+        uint64_t receivedFrames{0};
+        uint64_t droppedFrames{0};
+        uint64_t decodedFrames{0};
+        double fps{0.};
+        int formatChanges{0};
+        KeyframeDropPolicy::Stats drops;
+        vpf::RecoveryStats recovery;
+        std::size_t queuePeakBytes{0};
+        // from the stop request until everything was released, frames discarded / flushed on the way
+        double stopMs{0.};
+        uint64_t stopDiscards{0};
+        uint64_t stopFlushed{0};
+        uint64_t depthFiltered{0};
+        uint64_t depthDropped{0};
+        // missing frames by where they were lost, worst rolling loss rate of the run
+        LossCounters loss;
+        double lossPeakRollingRate{0.};
+        // milliseconds
+        SampleSummary decode;
+        double decodeP50{0.};
+        double decodeP95{0.};
+        double decodeP99{0.};
+        SampleSummary outputInterval;
+        double outputIntervalP99{0.};
+        SampleSummary latency;
+        double latencyP99{0.};
+        double openMs{0.};
+        double decoderReadyMs{0.};
+        double firstFrameMs{0.};
+        double firstImageMs{0.};
+    };
+
+    /**
+     * One independent capture chain: source -> frame queue -> decoder thread -> image callback.
+     * Nothing is shared between pipelines, so any number of them can run side by side.
+     */
+    class CapturePipeline {
+    public:
+        typedef std::function<void(const std::string &name, cv::Mat image)> image_cb;
+
+        CapturePipeline(PipelineConfig cfg, std::unique_ptr<FrameSource> src, image_cb cb);
+        ~CapturePipeline();
+
+        CapturePipeline(CapturePipeline const &) = delete;
+        CapturePipeline &operator=(CapturePipeline const &) = delete;
+
+        bool Start();
+        // no new frames are accepted, returns at once, so several pipelines can drain in parallel
+        void RequestStop();
+        // requests the stop if needed, waits for the drain and releases source and decoder
+        void Stop();
+
+        // true when the frame limit was reached, or the source is exhausted and every queued frame went
+        // through the decoder
+        bool Finished() const;
+
+        const std::string &Name() const { return config.name; }
+        bool FiltersDepth() const { return config.depthFilter; }
+        std::string DepthName() const { return config.name + " depth"; }
+        uint64_t ReceivedFrames() const { return receivedFrames; }
+        uint64_t DroppedFrames() const { return droppedFrames; }
+        uint64_t DecodedFrames() const { return decodedFrames; }
+        double ElapsedSeconds() const;
+        // most bytes held by queued frames at any time, pooled streams only after Stop()
+        std::size_t QueuePeakBytes() const;
+
+        void ReportStats() const;
+
+        // only complete after Stop()
+        PipelineReport GetReport() const;
+
+    private:
+        void OnFrame(EncodedFrame frame);
+        void OnImage(cv::Mat image, const vpf::FrameMeta &meta);
+        // after a frame was accounted for, only matters once the source has finished
+        void OnFrameHandled();
+        void NotifyProgress();
+        void DecoderLoop(std::promise<void> ready);
+        bool CreateDecoder(OBFormat stream_format, const StreamInfo *info);
+
+        PipelineConfig config;
+        std::unique_ptr<FrameSource> source;
+        image_cb imageCallback;
+
+        budgeted_channel<EncodedFrame> frameQueue;
+        // what the decoder thread waits on, declared after the queue so it detaches first
+        channel_select frameSelect;
+        std::unique_ptr<vpf::H26xDecoder> decoder;
+        std::unique_ptr<DepthFilterStage> depthStage;
+        std::unique_ptr<StreamRecorder> recorder;
+        // acquired lazily on the first frame (its geometry sizes the capacity request)
+        std::shared_ptr<vpf::DecoderHandle> decoderHandle;
+        mutable std::mutex handleMutex;
+        std::future<void> decoderTask;
+        std::atomic<bool> shouldStop{false};
+        bool stopped{false};
+        // written before shouldStop is set, read once it is seen
+        std::chrono::steady_clock::time_point stopRequestTs;
+        std::chrono::steady_clock::time_point drainDeadline;
+
+        std::atomic<uint64_t> receivedFrames{0};
+        std::atomic<uint64_t> droppedFrames{0};
+        std::atomic<uint64_t> decodedFrames{0};
+        // frames taken off the queue and fully handled by the decoder thread
+        std::atomic<uint64_t> processedFrames{0};
+        std::atomic<uint64_t> stopDiscards{0};
+        std::atomic<uint64_t> stopFlushed{0};
+        // non-reference frames the codec skipped, written by the decoder thread only
+        uint64_t decoderSkips{0};
+        double stopMs{0.};
+        // microseconds since startTs at which the last image was delivered
+        std::atomic<int64_t> lastImageUs{0};
+
+        // written by the source callback thread only
+        std::vector<double> frameDurations;
+        std::chrono::steady_clock::time_point lastFrameTs;
+        bool captureThreadConfigured{false};
+        KeyframeDropPolicy dropPolicy;
+        // written by the decoder thread only
+        std::vector<double> decodeDurations;
+        // recorded inside the decoder's frame callback, so bounded: long runs must not allocate there
+        SampleReservoir outputIntervals;
+        // receive to image, per frame from the metadata returned with the image
+        SampleReservoir latencies;
+        int formatChanges{0};
+        vpf::RecoveryStats recoveryStats;
+        // device frame index gaps and where the missing frames were lost
+        std::unique_ptr<SequenceTracker> sequence;
+        // peak of the pooled handle's queue, taken when the handle is released
+        std::size_t pooledPeakBytes{0};
+        std::unique_ptr<vpf::QualityController> quality;
+        // copy of the pooled handle's ladder state, taken when the handle is released
+        std::unique_ptr<vpf::QualityController> pooledQuality;
+
+        std::chrono::steady_clock::time_point startTs;
+        StreamInfo streamInfo;
+        // startup phases in milliseconds since Start()
+        double openMs{0.};
+        double decoderReadyMs{0.};
+        std::atomic<double> firstFrameMs{0.};
+        std::atomic<double> firstImageMs{0.};
+    };
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_CAPTUREPIPELINE_H
@@ -0,0 +1,517 @@
+#include "DecoderService.h"
+#include "BackendProbe.h"
+#include "Statistics.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace tcn::vpf {
+
+    namespace {
+        // admission capacity per worker before anything was measured, about one 1080p30 software decode
+        constexpr double kSeedMpxPerSecPerWorker{60.};
+        // measured frames after which the estimate replaces the seed and admission runs again
+        constexpr uint64_t kCalibrationSamples{50};
+    }
+
+    bool decode_frame(H26xDecoder &decoder, const EncodedFrame &frame, bool parser_bypass) {
+        decoder.allocationCheck.Begin();
+        decoder.discardOutput = frame.preroll;
+        FrameMeta meta;
+        meta.index = frame.index;
+        meta.deviceTimestampUs = frame.deviceTimestampUs;
+        meta.systemTimestampUs = frame.systemTimestampUs;
+        meta.receivedTs = frame.receivedTs;
+        meta.depthFrame = frame.depthFrame;
+        bool ok;
+        if (H26xDecoder::IsRawFormat(frame.format)) {
+            ok = decoder.DecodeRawFrame(frame.data, static_cast<int>(frame.size), static_cast<int>(frame.width),
+                                        static_cast<int>(frame.height), &meta);
+        } else if (parser_bypass && frame.completeAccessUnit) {
+            ok = decoder.DecodeAccessUnit(frame.data, static_cast<int>(frame.size), frame.Owner(),
+                                          frame.padding >= AV_INPUT_BUFFER_PADDING_SIZE, &meta);
+        } else {
+            ok = decoder.DecodeOnePacket(static_cast<int>(frame.size), const_cast<uint8_t *>(frame.data), &meta);
+        }
+        decoder.allocationCheck.End(decoder.formatChanges);
+        return ok;
+    }
+
+    DecoderHandle::DecoderHandle(std::shared_ptr<DecoderService> svc, StreamRequest req, H26xDecoder::frame_handler_cb cb)
+            : service(std::move(svc)), request(std::move(req)), frameCallback(std::move(cb)),
+              quality(request.name, request.quality, 1000. / std::max<uint32_t>(request.fps, 1)) {
+        decodeDurations.reserve(kReservedSamples);
+    }
+
+    DecoderHandle::~DecoderHandle() {
+        Close();
+    }
+
+    DecoderHandle::State DecoderHandle::GetState() const {
+        std::scoped_lock<std::mutex> lk{mutex_};
+        return state;
+    }
+
+    std::size_t DecoderHandle::Pending() const {
+        std::scoped_lock<std::mutex> lk{mutex_};
+        return packets.size();
+    }
+
+    bool DecoderHandle::HasSpaceLocked(std::size_t bytes) const {
+        // a frame larger than the byte limit still gets into an empty queue
+        return packets.empty() || (packets.size() < request.queueSize &&
+                                   (request.queueBytes == 0 || pendingBytes + bytes <= request.queueBytes));
+    }
+
+    double DecoderHandle::FillLocked() const {
+        double fill = double(packets.size()) / double(request.queueSize);
+        if (request.queueBytes > 0) {
+            fill = std::max(fill, double(pendingBytes) / double(request.queueBytes));
+        }
+        return std::min(1., fill);
+    }
+
+    double DecoderHandle::Fill() const {
+        std::scoped_lock<std::mutex> lk{mutex_};
+        return FillLocked();
+    }
+
+    std::size_t DecoderHandle::PeakBytes() const {
+        std::scoped_lock<std::mutex> lk{mutex_};
+        return peakBytes;
+    }
+
+    bool DecoderHandle::Submit(EncodedFrame frame, bool wait) {
+        const std::size_t bytes = frame.Bytes();
+        // the shared budget is reserved before the handle lock is taken, and returned if the frame is rejected
+        if (request.memoryBudget) {
+            bool acquired = wait ? request.memoryBudget->acquire(bytes, [this]() { return closing.load(); }) ==
+                                   channel_op_status::success
+                                 : request.memoryBudget->try_acquire(bytes);
+            if (!acquired) {
+                ++rejectedFrames;
+                return false;
+            }
+        }
+        bool schedule{false};
+        {
+            std::unique_lock<std::mutex> lk{mutex_};
+            if (wait) {
+                space_.wait(lk, [&]() { return closing || HasSpaceLocked(bytes); });
+            }
+            if (closing || state == State::waiting || !HasSpaceLocked(bytes)) {
+                ++rejectedFrames;
+                lk.unlock();
+                if (request.memoryBudget) {
+                    request.memoryBudget->release(bytes);
+                }
+                return false;
+            }
+            packets.push_back(std::move(frame));
+            pendingBytes += bytes;
+            peakBytes = std::max(peakBytes, pendingBytes);
+            if (!scheduled) {
+                scheduled = true;
+                schedule = true;
+            }
+        }
+        // the service lock is never taken while holding the handle lock
+        if (schedule) {
+            service->Schedule(shared_from_this());
+        }
+        return true;
+    }
+
+    bool DecoderHandle::InitDecoder(OBFormat stream_format, const std::vector<uint8_t> &parameter_sets) {
+        auto init = [&](AVHWDeviceType device_type) {
+            // a failed init leaves a half open decoder behind, every attempt starts from a fresh one
+            decoder = std::make_unique<H26xDecoder>(frameCallback);
+            // the pool provides the parallelism, so codec contexts stay single threaded
+            decoder->threadCount = 1;
+            decoder->sharedDeviceCtx = service->hw_device_ctx;
+            decoder->tensorOutput = request.tensorOutput;
+            decoder->tensor = request.tensor;
+            return decoder->DecoderInit(device_type, stream_format, request.outputFormat,
+                                        static_cast<int>(request.width), static_cast<int>(request.height), parameter_sets);
+        };
+        const auto device_type = service->config.deviceType;
+        bool ok = init(device_type);
+        if (!ok && device_type != AV_HWDEVICE_TYPE_NONE) {
+            spdlog::warn("{0}: {1} decoder failed to open, falling back to software decoding",
+                         request.name, backend_name(device_type));
+            invalidate_backend_profile(service->config.backendCache, stream_format, device_type);
+            ok = init(AV_HWDEVICE_TYPE_NONE);
+        }
+        if (!ok) {
+            spdlog::error("{0}: error initializing pooled decoder", request.name);
+            decoder.reset();
+        }
+        return ok;
+    }
+
+    bool DecoderHandle::Prepare(const std::vector<uint8_t> &parameter_sets) {
+        std::scoped_lock<std::mutex> lk{mutex_};
+        if (decoder || scheduled) {
+            return decoder != nullptr;
+        }
+        return InitDecoder(request.format, parameter_sets);
+    }
+
+    void DecoderHandle::Close(std::chrono::steady_clock::time_point drain_deadline) {
+        {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            if (closing) {
+                return;
+            }
+            // no new frames from here on, the workers keep decoding the queued ones until the deadline
+            closing = true;
+            space_.notify_all();
+        }
+        // wakes a producer waiting for the shared budget
+        if (request.memoryBudget) {
+            request.memoryBudget->notify_all();
+        }
+        std::size_t released_bytes;
+        {
+            std::unique_lock<std::mutex> lk{mutex_};
+            idle_.wait_until(lk, drain_deadline, [&]() { return packets.empty() && !scheduled; });
+            state = State::closed;
+            discardedFrames += packets.size();
+            packets.clear();
+            released_bytes = pendingBytes;
+            pendingBytes = 0;
+            idle_.wait(lk, [&]() { return !scheduled; });
+        }
+        if (request.memoryBudget) {
+            request.memoryBudget->release(released_bytes);
+        }
+        if (decoder) {
+            flushedFrames += decoder->Flush(drain_deadline);
+            recoveryStats = decoder->GetRecoveryStats();
+            decoder->DecoderTeardown();
+            decoder.reset();
+        }
+        service->Release(this);
+    }
+
+    void DecoderHandle::DecodeNext() {
+        EncodedFrame frame;
+        bool degraded{false};
+        double queue_fill{0.};
+        {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            if (packets.empty() || state == State::closed) {
+                scheduled = false;
+                idle_.notify_all();
+                return;
+            }
+            queue_fill = FillLocked();
+            frame = std::move(packets.front());
+            packets.pop_front();
+            pendingBytes -= frame.Bytes();
+            space_.notify_one();
+            degraded = state == State::degraded;
+        }
+        if (request.memoryBudget) {
+            request.memoryBudget->release(frame.Bytes());
+        }
+
+        // without a decoder (not even in software) the frame is lost, the next one tries again
+        if (decoder || InitDecoder(frame.format, {})) {
+            if (frame.resync) {
+                // the pictures before the gap get at most a frame interval to come out
+                decoder->Resync(std::chrono::steady_clock::now() +
+                                std::chrono::milliseconds(1000 / std::max<uint32_t>(request.fps, 1)));
+            }
+            // admission degradation is a floor for the adaptive ladder
+            auto level = std::max(quality.Level(), degraded ? QualityLevel::skipNonRef : QualityLevel::full);
+            if (level != appliedLevel) {
+                apply_quality_level(*decoder, level);
+                appliedLevel = level;
+            }
+
+            auto t_start = std::chrono::steady_clock::now();
+            const uint64_t skipped = decoder->skippedFrames;
+            if (!decode_frame(*decoder, frame, request.parserBypass)) {
+                spdlog::info("{0}: something went wrong with decoding..", request.name);
+            }
+            skippedFrames += decoder->skippedFrames - skipped;
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+            decodeDurations.push_back(seconds * 1000.);
+            if (request.adaptiveQuality) {
+                quality.Update(queue_fill, seconds * 1000.);
+            }
+            service->RecordDecodeTime(seconds, double(frame.width) * double(frame.height) / 1e6);
+        }
+        ++processedFrames;
+        if (request.processedCallback) {
+            request.processedCallback();
+        }
+
+        bool reschedule{false};
+        {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            if (!packets.empty() && state != State::closed) {
+                reschedule = true;
+            } else {
+                scheduled = false;
+                idle_.notify_all();
+            }
+        }
+        if (reschedule) {
+            // back of the run queue, so one busy stream cannot starve the others
+            service->Schedule(shared_from_this());
+        }
+    }
+
+
+    DecoderService::DecoderService(DecoderServiceConfig cfg) : config(cfg) {
+        if (config.workerCount <= 0) {
+            config.workerCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        }
+    }
+
+    DecoderService::~DecoderService() {
+        Stop();
+        if (hw_device_ctx != nullptr) {
+            av_buffer_unref(&hw_device_ctx);
+        }
+    }
+
+    bool DecoderService::Start() {
+        if (config.deviceType != AV_HWDEVICE_TYPE_NONE && hw_device_ctx == nullptr) {
+            if (av_hwdevice_ctx_create(&hw_device_ctx, config.deviceType, NULL, NULL, 0) < 0) {
+                spdlog::warn("DecoderService: failed to create shared {0} device, decoding in software.",
+                             av_hwdevice_get_type_name(config.deviceType));
+                // no workers yet, nothing else reads the device type concurrently
+                invalidate_backend_profile(config.backendCache, config.backendFormat, config.deviceType);
+                config.deviceType = AV_HWDEVICE_TYPE_NONE;
+            }
+        }
+        {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            stopping = false;
+        }
+        for (int i = 0; i < config.workerCount; ++i) {
+            workers.emplace_back([this]() { WorkerLoop(); });
+        }
+        spdlog::info("DecoderService: started {0} workers", config.workerCount);
+        return true;
+    }
+
+    void DecoderService::Stop() {
+        {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            stopping = true;
+            work_available_.notify_all();
+        }
+        for (auto &w : workers) {
+            if (w.joinable()) {
+                w.join();
+            }
+        }
+        workers.clear();
+
+        // handles still queued are marked idle so their Close() does not wait for a worker
+        std::deque<std::shared_ptr<DecoderHandle>> pending;
+        {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            pending.swap(runQueue);
+        }
+        for (auto &h : pending) {
+            std::scoped_lock<std::mutex> lk{h->mutex_};
+            h->scheduled = false;
+            h->idle_.notify_all();
+        }
+    }
+
+    std::shared_ptr<DecoderHandle> DecoderService::Acquire(StreamRequest request, H26xDecoder::frame_handler_cb cb) {
+        std::shared_ptr<DecoderHandle> handle(new DecoderHandle(shared_from_this(), request, std::move(cb)));
+
+        std::vector<std::shared_ptr<DecoderHandle>> live;
+        std::scoped_lock<std::mutex> lk{mutex_};
+        live = LiveStreamsLocked();
+        double demand{0.};
+        for (auto &s : live) {
+            auto st = s->GetState();
+            demand += Demand(s->request) * Weight(st);
+        }
+        double capacity = CapacityLocked();
+        if (demand + Demand(request) <= capacity) {
+            handle->state = DecoderHandle::State::active;
+        } else if (config.overloadPolicy == OverloadPolicy::degrade) {
+            handle->state = DecoderHandle::State::degraded;
+            spdlog::warn("DecoderService: {0} admitted degraded ({1:.1f} + {2:.1f} > {3:.1f} Mpx/s)",
+                         request.name, demand, Demand(request), capacity);
+        } else {
+            handle->state = DecoderHandle::State::waiting;
+            spdlog::warn("DecoderService: {0} waiting for capacity ({1:.1f} + {2:.1f} > {3:.1f} Mpx/s)",
+                         request.name, demand, Demand(request), capacity);
+        }
+        streams.push_back(handle);
+        return handle;
+    }
+
+    void DecoderService::Schedule(std::shared_ptr<DecoderHandle> handle) {
+        std::scoped_lock<std::mutex> lk{mutex_};
+        if (stopping) {
+            std::scoped_lock<std::mutex> hlk{handle->mutex_};
+            handle->scheduled = false;
+            handle->idle_.notify_all();
+            return;
+        }
+        runQueue.push_back(std::move(handle));
+        work_available_.notify_one();
+    }
+
+    void DecoderService::Release(DecoderHandle *handle) {
+        // declared before the lock so a reference that turns out to be the last one is dropped after unlocking
+        std::vector<std::shared_ptr<DecoderHandle>> live;
+        std::scoped_lock<std::mutex> lk{mutex_};
+        live = LiveStreamsLocked();
+        streams.clear();
+        for (auto &s : live) {
+            if (s.get() != handle) {
+                streams.push_back(s);
+            }
+        }
+
+        // waiting / degraded streams move up in arrival order while they fit, the released handle is closed
+        RebalanceLocked(live);
+    }
+
+    std::vector<std::shared_ptr<DecoderHandle>> DecoderService::LiveStreamsLocked() const {
+        std::vector<std::shared_ptr<DecoderHandle>> live;
+        live.reserve(streams.size());
+        for (auto &weak : streams) {
+            if (auto s = weak.lock()) {
+                live.push_back(std::move(s));
+            }
+        }
+        return live;
+    }
+
+    void DecoderService::RebalanceLocked(const std::vector<std::shared_ptr<DecoderHandle>> &live) {
+        const double capacity = CapacityLocked();
+        double demand{0.};
+        for (auto &s : live) {
+            std::scoped_lock<std::mutex> hlk{s->mutex_};
+            if (s->state == DecoderHandle::State::closed) {
+                continue;
+            }
+            auto next = DecoderHandle::State::waiting;
+            if (demand + Demand(s->request) <= capacity) {
+                next = DecoderHandle::State::active;
+            } else if (config.overloadPolicy == OverloadPolicy::degrade) {
+                next = DecoderHandle::State::degraded;
+            }
+            demand += Demand(s->request) * Weight(next);
+            if (next == s->state) {
+                continue;
+            }
+            if (next == DecoderHandle::State::active) {
+                spdlog::info("DecoderService: {0} promoted to full decode", s->request.name);
+            } else {
+                spdlog::warn("DecoderService: {0} {1} ({2:.1f} Mpx/s of {3:.1f} in use)", s->request.name,
+                             next == DecoderHandle::State::degraded ? "degraded" : "waiting for capacity",
+                             demand, capacity);
+            }
+            s->state = next;
+        }
+    }
+
+    void DecoderService::RecordDecodeTime(double seconds, double mpx) {
+        if (mpx <= 0.) {
+            return;
+        }
+        std::vector<std::shared_ptr<DecoderHandle>> live;
+        std::scoped_lock<std::mutex> lk{mutex_};
+        double sample = seconds / mpx;
+        secondsPerMpx = secondsPerMpx > 0. ? 0.95 * secondsPerMpx + 0.05 * sample : sample;
+        if (++decodeSamples == kCalibrationSamples && config.capacityMpxPerSec <= 0.) {
+            // the streams were admitted against the seed, check them against what the workers really do
+            spdlog::info("DecoderService: measured capacity {0:.1f} Mpx/s, re-running admission", CapacityLocked());
+            live = LiveStreamsLocked();
+            RebalanceLocked(live);
+        }
+    }
+
+    double DecoderService::CapacityLocked() const {
+        if (config.capacityMpxPerSec > 0.) {
+            return config.capacityMpxPerSec;
+        }
+        if (decodeSamples >= kCalibrationSamples && secondsPerMpx > 0.) {
+            return config.workerCount / secondsPerMpx;
+        }
+        return config.workerCount * kSeedMpxPerSecPerWorker;
+    }
+
+    double DecoderService::Weight(DecoderHandle::State state) {
+        switch (state) {
+            case DecoderHandle::State::active:
+                return 1.;
+            case DecoderHandle::State::degraded:
+                return 0.5;
+            default:
+                return 0.;
+        }
+    }
+
+    double DecoderService::Demand(const StreamRequest &request) {
+        return double(request.width) * double(request.height) * double(request.fps) / 1e6;
+    }
+
+    DecoderCapacity DecoderService::GetCapacity() const {
+        DecoderCapacity c;
+        std::vector<std::shared_ptr<DecoderHandle>> live;
+        std::scoped_lock<std::mutex> lk{mutex_};
+        c.workers = config.workerCount;
+        c.capacityMpxPerSec = CapacityLocked();
+        live = LiveStreamsLocked();
+        for (auto &s : live) {
+            switch (s->GetState()) {
+                case DecoderHandle::State::active:
+                    ++c.activeStreams;
+                    c.demandMpxPerSec += Demand(s->request);
+                    break;
+                case DecoderHandle::State::degraded:
+                    ++c.degradedStreams;
+                    c.demandMpxPerSec += Weight(DecoderHandle::State::degraded) * Demand(s->request);
+                    break;
+                case DecoderHandle::State::waiting:
+                    ++c.waitingStreams;
+                    break;
+                default:
+                    break;
+            }
+        }
+        return c;
+    }
+
+    void DecoderService::ReportCapacity() const {
+        auto c = GetCapacity();
+        spdlog::info("DecoderService: workers: {0} capacity: {1:.1f} Mpx/s demand: {2:.1f} Mpx/s "
+                     "streams active: {3} degraded: {4} waiting: {5}",
+                     c.workers, c.capacityMpxPerSec, c.demandMpxPerSec,
+                     c.activeStreams, c.degradedStreams, c.waitingStreams);
+    }
+
+    void DecoderService::WorkerLoop() {
+        while (true) {
+            std::shared_ptr<DecoderHandle> handle;
+            {
+                std::unique_lock<std::mutex> lk{mutex_};
+                work_available_.wait(lk, [&]() { return stopping || !runQueue.empty(); });
+                if (stopping) {
+                    return;
+                }
+                handle = std::move(runQueue.front());
+                runQueue.pop_front();
+            }
+            handle->DecodeNext();
+        }
+    }
+
+} // tcn::vpf
@@ -0,0 +1,219 @@
+#ifndef ORBBEC_CAPTURE_TEST_DECODERSERVICE_H
+#define ORBBEC_CAPTURE_TEST_DECODERSERVICE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "budgeted_channel.h"
+#include "FrameSource.h"
+#include "H26xDecoder.h"
+#include "QualityController.h"
+
+namespace tcn::vpf {
+
+    enum class OverloadPolicy {
+        // streams beyond capacity wait (frames are discarded) until another stream is released
+        queue,
+        // streams beyond capacity are admitted with non-reference frames skipped
+        degrade
+    };
+
+    struct DecoderServiceConfig {
+        // a device that fails to open falls back to software decoding
+        AVHWDeviceType deviceType{AV_HWDEVICE_TYPE_NONE};
+        // backend profile the device came from and the format it was probed for, dropped when the device fails
+        std::string backendCache;
+        OBFormat backendFormat{OB_FORMAT_H264};
+        // 0 = one worker per hardware thread
+        int workerCount{0};
+        // decode capacity in megapixels per second, 0 = estimate from measured decode times
+        // (a conservative per worker figure until enough frames were measured)
+        double capacityMpxPerSec{0.};
+        OverloadPolicy overloadPolicy{OverloadPolicy::queue};
+    };
+
+    struct StreamRequest {
+        std::string name;
+        OBFormat format{OB_FORMAT_H264};
+        OBFormat outputFormat{OB_FORMAT_BGR};
+        uint32_t width{0};
+        uint32_t height{0};
+        uint32_t fps{25};
+        std::size_t queueSize{8};
+        // bytes the queued frames may hold (EncodedFrame::Bytes), 0 = bounded by queueSize only
+        std::size_t queueBytes{0};
+        std::shared_ptr<byte_budget> memoryBudget;
+        // step through the quality ladder driven by this stream's queue and decode time
+        bool adaptiveQuality{true};
+        QualityLadderConfig quality;
+        bool parserBypass{true};
+        bool tensorOutput{false};
+        TensorConfig tensor;
+        // called on the worker after each frame was handled, optional
+        std::function<void()> processedCallback;
+    };
+
+    struct DecoderCapacity {
+        int workers{0};
+        double capacityMpxPerSec{0.};
+        double demandMpxPerSec{0.};
+        std::size_t activeStreams{0};
+        std::size_t degradedStreams{0};
+        std::size_t waitingStreams{0};
+    };
+
+    class DecoderService;
+
+    // decodes one encoded frame, complete access units skip the parser when parser_bypass is set
+    bool decode_frame(H26xDecoder &decoder, const EncodedFrame &frame, bool parser_bypass);
+
+    /**
+     * Lightweight per-stream decoder: a bounded packet queue plus a single-threaded H26xDecoder
+     * that is only ever driven by one service worker at a time.
+     */
+    class DecoderHandle : public std::enable_shared_from_this<DecoderHandle> {
+    public:
+        enum class State {
+            waiting,
+            active,
+            degraded,
+            closed
+        };
+
+        ~DecoderHandle();
+
+        // returns false if the frame was not accepted (queue full, waiting for admission or closed),
+        // with wait set a full queue blocks the caller instead (backpressure)
+        bool Submit(EncodedFrame frame, bool wait = false);
+
+        // initializes the decoder on the calling thread from the requested geometry (eager warm-up),
+        // otherwise the first worker to pick up the stream does it
+        bool Prepare(const std::vector<uint8_t> &parameter_sets);
+
+        // stops accepting frames, lets the workers decode the queued ones until drain_deadline and flushes
+        // the codec until then, discards the rest and releases the stream (the default drains nothing)
+        void Close(std::chrono::steady_clock::time_point drain_deadline = {});
+
+        State GetState() const;
+        std::size_t Pending() const;
+        // queue occupancy in [0, 1], by frames or bytes, whichever is closer to its limit
+        double Fill() const;
+        std::size_t PeakBytes() const;
+        uint64_t ProcessedFrames() const { return processedFrames; }
+        uint64_t RejectedFrames() const { return rejectedFrames; }
+        // queued frames discarded by Close(), frames flushed from the codec by Close()
+        uint64_t DiscardedFrames() const { return discardedFrames; }
+        uint64_t FlushedFrames() const { return flushedFrames; }
+        // non-reference frames the codec skipped at a reduced quality level
+        uint64_t SkippedFrames() const { return skippedFrames; }
+        // only stable after Close()
+        const std::vector<double> &DecodeDurations() const { return decodeDurations; }
+        const RecoveryStats &GetRecoveryStats() const { return recoveryStats; }
+        const QualityController &Quality() const { return quality; }
+
+    private:
+        friend class DecoderService;
+
+        DecoderHandle(std::shared_ptr<DecoderService> svc, StreamRequest req, H26xDecoder::frame_handler_cb cb);
+
+        // runs on a service worker
+        void DecodeNext();
+
+        bool InitDecoder(OBFormat stream_format, const std::vector<uint8_t> &parameter_sets);
+
+        // expects mutex_ to be held
+        bool HasSpaceLocked(std::size_t bytes) const;
+        double FillLocked() const;
+
+        std::shared_ptr<DecoderService> service;
+        StreamRequest request;
+        H26xDecoder::frame_handler_cb frameCallback;
+        std::unique_ptr<H26xDecoder> decoder;
+        QualityController quality;
+        QualityLevel appliedLevel{QualityLevel::full};
+
+        mutable std::mutex mutex_;
+        std::condition_variable idle_;
+        std::condition_variable space_;
+        std::deque<EncodedFrame> packets;
+        std::size_t pendingBytes{0};
+        std::size_t peakBytes{0};
+        // set by Close() before the drain, read by waiters on the shared memory budget
+        std::atomic<bool> closing{false};
+        State state{State::waiting};
+        bool scheduled{false};
+
+        std::atomic<uint64_t> processedFrames{0};
+        std::atomic<uint64_t> rejectedFrames{0};
+        std::atomic<uint64_t> discardedFrames{0};
+        std::atomic<uint64_t> flushedFrames{0};
+        std::atomic<uint64_t> skippedFrames{0};
+        std::vector<double> decodeDurations;
+        RecoveryStats recoveryStats;
+    };
+
+    /**
+     * Owns the shared hardware device context and a bounded pool of codec workers
+     * that decode all streams, instead of one decoder thread (plus codec threads) per stream.
+     */
+    class DecoderService : public std::enable_shared_from_this<DecoderService> {
+    public:
+        explicit DecoderService(DecoderServiceConfig cfg);
+        ~DecoderService();
+
+        DecoderService(DecoderService const &) = delete;
+        DecoderService &operator=(DecoderService const &) = delete;
+
+        bool Start();
+        void Stop();
+
+        std::shared_ptr<DecoderHandle> Acquire(StreamRequest request, H26xDecoder::frame_handler_cb cb);
+
+        DecoderCapacity GetCapacity() const;
+        void ReportCapacity() const;
+
+    private:
+        friend class DecoderHandle;
+
+        void Schedule(std::shared_ptr<DecoderHandle> handle);
+        void Release(DecoderHandle *handle);
+        void RecordDecodeTime(double seconds, double mpx);
+        void WorkerLoop();
+
+        // expects mutex_ to be held
+        double CapacityLocked() const;
+        // expects mutex_ to be held. the returned references must outlive the lock, dropping the last one
+        // closes the handle, which re-enters Release
+        std::vector<std::shared_ptr<DecoderHandle>> LiveStreamsLocked() const;
+        // expects mutex_ to be held. re-admits the live streams in arrival order against the current capacity
+        void RebalanceLocked(const std::vector<std::shared_ptr<DecoderHandle>> &live);
+        static double Demand(const StreamRequest &request);
+        // demand a stream in this state puts on the workers, degraded streams skip about half their frames
+        static double Weight(DecoderHandle::State state);
+
+        DecoderServiceConfig config;
+        AVBufferRef *hw_device_ctx{nullptr};
+
+        mutable std::mutex mutex_;
+        std::condition_variable work_available_;
+        std::deque<std::shared_ptr<DecoderHandle>> runQueue;
+        std::vector<std::weak_ptr<DecoderHandle>> streams;
+        std::vector<std::thread> workers;
+        bool stopping{false};
+        // exponentially averaged worker seconds per decoded megapixel
+        double secondsPerMpx{0.};
+        uint64_t decodeSamples{0};
+    };
+
+} // tcn::vpf
+
+#endif //ORBBEC_CAPTURE_TEST_DECODERSERVICE_H
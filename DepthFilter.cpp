@@ -0,0 +1,457 @@
+#include "DepthFilter.h"
+#include "Statistics.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+
+namespace tcn {
+
+    namespace {
+        int resolve_workers(const DepthFilterConfig &cfg) {
+            if (cfg.workers > 0) {
+                return cfg.workers;
+            }
+            return std::max(1, static_cast<int>(std::thread::hardware_concurrency()) / 2);
+        }
+
+        // square blocks the transpose works on, 32 x 32 floats stay in L1 on both sides
+        constexpr int kTransposeBlock = 32;
+
+        // one vertical spatial step: r is blended towards the already filtered neighbor row n,
+        // kept out of line with plain restrict pointers, iterations along x are independent
+        void blend_rows(float *__restrict r, const float *__restrict n, int count, float keep, float delta) {
+            for (int x = 0; x < count; ++x) {
+                const float c = r[x];
+                const float a = n[x];
+                const float m = (c > 0.f && a > 0.f && std::fabs(c - a) < delta) ? keep : 0.f;
+                r[x] = c + m * (a - c);
+            }
+        }
+
+        void blend_history(float *__restrict cur, float *__restrict prev, uint8_t *__restrict age, std::size_t count,
+                           float keep, float delta, int persistence) {
+            for (std::size_t i = 0; i < count; ++i) {
+                const float c = cur[i];
+                const float p = prev[i];
+                const float m = (p > 0.f && std::fabs(c - p) < delta) ? keep : 0.f;
+                const float blended = c + m * (p - c);
+                // a pixel dropping out for a frame or two keeps its last value
+                const bool hold = c <= 0.f && p > 0.f && age[i] < persistence;
+                const float v = c > 0.f ? blended : (hold ? p : 0.f);
+                cur[i] = v;
+                prev[i] = v;
+                age[i] = c > 0.f ? 0 : static_cast<uint8_t>(age[i] + (hold ? 1 : 0));
+            }
+        }
+    }
+
+    const char *depth_filter_name(DepthFilterKind kind) {
+        switch (kind) {
+            case DepthFilterKind::threshold:
+                return "threshold";
+            case DepthFilterKind::spatial:
+                return "spatial";
+            case DepthFilterKind::temporal:
+                return "temporal";
+            case DepthFilterKind::holeFill:
+                return "hole_fill";
+        }
+        return "unknown";
+    }
+
+    TilePool::TilePool(int threads, ThreadSettings s) : settings(std::move(s)) {
+        for (int i = 1; i < threads; ++i) {
+            workers.emplace_back([this, i]() {
+                ThreadSettings own = settings;
+                if (!own.name.empty()) {
+                    own.name += std::to_string(i);
+                }
+                apply_thread_settings(own);
+                WorkerLoop();
+            });
+        }
+    }
+
+    TilePool::~TilePool() {
+        {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            stopping = true;
+            start_.notify_all();
+        }
+        for (auto &w : workers) {
+            if (w.joinable()) {
+                w.join();
+            }
+        }
+    }
+
+    void TilePool::Run(int tiles, const std::function<void(int)> &fn) {
+        if (workers.empty() || tiles <= 1) {
+            for (int t = 0; t < tiles; ++t) {
+                fn(t);
+            }
+            return;
+        }
+        {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            job = &fn;
+            tileCount = tiles;
+            nextTile = 0;
+            pendingTiles = tiles;
+            ++generation;
+            start_.notify_all();
+        }
+        Work();
+        std::unique_lock<std::mutex> lk{mutex_};
+        // no worker may still be inside this job when the next one resets the tile counter
+        done_.wait(lk, [&]() { return pendingTiles == 0 && activeWorkers == 0; });
+        job = nullptr;
+    }
+
+    void TilePool::Work() {
+        int done{0};
+        for (int t = nextTile.fetch_add(1); t < tileCount; t = nextTile.fetch_add(1)) {
+            (*job)(t);
+            ++done;
+        }
+        if (done > 0) {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            pendingTiles -= done;
+            if (pendingTiles == 0) {
+                done_.notify_all();
+            }
+        }
+    }
+
+    void TilePool::WorkerLoop() {
+        uint64_t seen{0};
+        std::unique_lock<std::mutex> lk{mutex_};
+        while (true) {
+            start_.wait(lk, [&]() { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            if (job == nullptr) {
+                continue;
+            }
+            ++activeWorkers;
+            lk.unlock();
+            Work();
+            lk.lock();
+            --activeWorkers;
+            if (pendingTiles == 0 && activeWorkers == 0) {
+                done_.notify_all();
+            }
+        }
+    }
+
+    DepthFilterChain::DepthFilterChain(std::string n, DepthFilterConfig cfg, ThreadSettings worker_settings)
+            : name(std::move(n)), config(std::move(cfg)), pool(resolve_workers(config), std::move(worker_settings)) {
+        for (auto &d : filterDurations) {
+            d.reserve(kReservedSamples);
+        }
+        totalDurations.reserve(kReservedSamples);
+        outputs.reserve(config.poolSize);
+    }
+
+    void DepthFilterChain::Prepare(int w, int h) {
+        width = w;
+        height = h;
+        const std::size_t pixels = static_cast<std::size_t>(w) * h;
+        work.assign(pixels, 0.f);
+        history.assign(pixels, 0.f);
+        historyAge.assign(pixels, 0);
+        historyValid = false;
+        outputs.clear();
+        transposed.assign(pixels, 0.f);
+        // a few tiles per thread, so uneven tiles balance out
+        const int tiles = pool.Threads() * 4;
+        rowsPerTile = std::max(8, (h + tiles - 1) / tiles);
+    }
+
+    void DepthFilterChain::Reset() {
+        historyValid = false;
+    }
+
+    cv::Mat DepthFilterChain::Acquire() {
+        for (const auto &m : outputs) {
+            if (m.u != nullptr && m.u->refcount == 1) {
+                return m;
+            }
+        }
+        cv::Mat m(height, width, CV_16UC1);
+        if (outputs.size() < config.poolSize) {
+            outputs.push_back(m);
+        } else {
+            ++poolMisses;
+        }
+        return m;
+    }
+
+    bool DepthFilterChain::Process(const uint16_t *depth, int w, int h, std::size_t stride_bytes, cv::Mat &out) {
+        if (depth == nullptr || w <= 0 || h <= 0 || stride_bytes < static_cast<std::size_t>(w) * sizeof(uint16_t)) {
+            return false;
+        }
+        if (w != width || h != height) {
+            Prepare(w, h);
+        }
+        auto t_start = std::chrono::steady_clock::now();
+        const std::size_t stride = stride_bytes / sizeof(uint16_t);
+
+        // every chain starts from the raw samples. a leading threshold masks while copying, anywhere else
+        // it is a pass of its own at its position
+        auto next = config.chain.begin();
+        if (next != config.chain.end() && *next == DepthFilterKind::threshold) {
+            Load(depth, stride, config.minDepth, config.maxDepth);
+            filterDurations[static_cast<int>(DepthFilterKind::threshold)].push_back(
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count());
+            ++next;
+        } else {
+            Load(depth, stride, 0.f, 65535.f);
+        }
+        for (; next != config.chain.end(); ++next) {
+            const auto kind = *next;
+            auto t_filter = std::chrono::steady_clock::now();
+            switch (kind) {
+                case DepthFilterKind::threshold:
+                    Threshold();
+                    break;
+                case DepthFilterKind::spatial:
+                    Spatial();
+                    break;
+                case DepthFilterKind::temporal:
+                    Temporal();
+                    break;
+                case DepthFilterKind::holeFill:
+                    HoleFill();
+                    break;
+            }
+            filterDurations[static_cast<int>(kind)].push_back(
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_filter).count());
+        }
+
+        out = Acquire();
+        const int row_tiles = (height + rowsPerTile - 1) / rowsPerTile;
+        pool.Run(row_tiles, [&](int tile) {
+            const int y_end = std::min(height, (tile + 1) * rowsPerTile);
+            for (int y = tile * rowsPerTile; y < y_end; ++y) {
+                const float *src = work.data() + static_cast<std::size_t>(y) * width;
+                uint16_t *dst = out.ptr<uint16_t>(y);
+                for (int x = 0; x < width; ++x) {
+                    dst[x] = static_cast<uint16_t>(src[x] + 0.5f);
+                }
+            }
+        });
+        totalDurations.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count());
+        return true;
+    }
+
+    void DepthFilterChain::Load(const uint16_t *depth, std::size_t stride, float lo, float hi) {
+        const int row_tiles = (height + rowsPerTile - 1) / rowsPerTile;
+        // everything a kernel reads goes in by value, a float captured by reference may alias the output
+        // as far as the compiler knows and would keep the loop scalar
+        pool.Run(row_tiles, [this, depth, stride, lo, hi](int tile) {
+            const int w = width;
+            const int y_end = std::min(height, (tile + 1) * rowsPerTile);
+            for (int y = tile * rowsPerTile; y < y_end; ++y) {
+                const uint16_t *__restrict src = depth + static_cast<std::size_t>(y) * stride;
+                float *__restrict dst = work.data() + static_cast<std::size_t>(y) * w;
+                for (int x = 0; x < w; ++x) {
+                    float v = src[x];
+                    dst[x] = (v >= lo && v <= hi) ? v : 0.f;
+                }
+            }
+        });
+    }
+
+    void DepthFilterChain::Threshold() {
+        const float lo = config.minDepth;
+        const float hi = config.maxDepth;
+        const int row_tiles = (height + rowsPerTile - 1) / rowsPerTile;
+        pool.Run(row_tiles, [this, lo, hi](int tile) {
+            const int w = width;
+            const int y_end = std::min(height, (tile + 1) * rowsPerTile);
+            for (int y = tile * rowsPerTile; y < y_end; ++y) {
+                float *__restrict r = work.data() + static_cast<std::size_t>(y) * w;
+                for (int x = 0; x < w; ++x) {
+                    const float v = r[x];
+                    r[x] = (v >= lo && v <= hi) ? v : 0.f;
+                }
+            }
+        });
+    }
+
+    void DepthFilterChain::Transpose(const float *src, float *dst, int rows, int cols) {
+        const int block_rows = (rows + kTransposeBlock - 1) / kTransposeBlock;
+        pool.Run(block_rows, [&](int tile) {
+            const int y0 = tile * kTransposeBlock;
+            const int y1 = std::min(rows, y0 + kTransposeBlock);
+            for (int x0 = 0; x0 < cols; x0 += kTransposeBlock) {
+                const int x1 = std::min(cols, x0 + kTransposeBlock);
+                for (int y = y0; y < y1; ++y) {
+                    const float *s = src + static_cast<std::size_t>(y) * cols;
+                    for (int x = x0; x < x1; ++x) {
+                        dst[static_cast<std::size_t>(x) * rows + y] = s[x];
+                    }
+                }
+            }
+        });
+    }
+
+    void DepthFilterChain::SmoothColumns(float *data, int rows, int cols) {
+        const float keep = 1.f - config.spatialAlpha;
+        const float delta = config.spatialDelta;
+        // the recursion runs along y, every row step is independent across x, so columns are split
+        // into tiles of whole cache lines and each step is one pass over contiguous memory
+        const int tiles = pool.Threads() * 4;
+        const int cols_per_tile = std::max(64, ((cols + tiles - 1) / tiles + 15) & ~15);
+        const int col_tiles = (cols + cols_per_tile - 1) / cols_per_tile;
+        pool.Run(col_tiles, [&](int tile) {
+            const int x0 = tile * cols_per_tile;
+            const int count = std::min(cols, x0 + cols_per_tile) - x0;
+            float *column = data + x0;
+            for (int y = 1; y < rows; ++y) {
+                float *r = column + static_cast<std::size_t>(y) * cols;
+                blend_rows(r, r - cols, count, keep, delta);
+            }
+            for (int y = rows - 2; y >= 0; --y) {
+                float *r = column + static_cast<std::size_t>(y) * cols;
+                blend_rows(r, r + cols, count, keep, delta);
+            }
+        });
+    }
+
+    void DepthFilterChain::Spatial() {
+        for (int i = 0; i < config.spatialIterations; ++i) {
+            // the recursion along x would be a serial dependency per row, on the transposed image it is
+            // the same column pass over contiguous rows
+            Transpose(work.data(), transposed.data(), height, width);
+            SmoothColumns(transposed.data(), width, height);
+            Transpose(transposed.data(), work.data(), width, height);
+            SmoothColumns(work.data(), height, width);
+        }
+    }
+
+    void DepthFilterChain::Temporal() {
+        if (!historyValid) {
+            std::copy(work.begin(), work.end(), history.begin());
+            std::fill(historyAge.begin(), historyAge.end(), 0);
+            historyValid = true;
+            return;
+        }
+        const float keep = 1.f - config.temporalAlpha;
+        const float delta = config.temporalDelta;
+        const int persistence = std::min(255, config.temporalPersistence);
+        const int row_tiles = (height + rowsPerTile - 1) / rowsPerTile;
+        pool.Run(row_tiles, [&](int tile) {
+            const std::size_t begin = static_cast<std::size_t>(tile) * rowsPerTile * width;
+            const std::size_t end = std::min(static_cast<std::size_t>(height),
+                                             static_cast<std::size_t>(tile + 1) * rowsPerTile) * width;
+            blend_history(work.data() + begin, history.data() + begin, historyAge.data() + begin, end - begin,
+                          keep, delta, persistence);
+        });
+    }
+
+    void DepthFilterChain::HoleFill() {
+        const int max_width = config.holeFillMaxWidth;
+        const int row_tiles = (height + rowsPerTile - 1) / rowsPerTile;
+        pool.Run(row_tiles, [&](int tile) {
+            const int y_end = std::min(height, (tile + 1) * rowsPerTile);
+            for (int y = tile * rowsPerTile; y < y_end; ++y) {
+                float *r = work.data() + static_cast<std::size_t>(y) * width;
+                int x = 0;
+                while (x < width) {
+                    if (r[x] > 0.f) {
+                        ++x;
+                        continue;
+                    }
+                    int end = x;
+                    while (end < width && r[end] <= 0.f) {
+                        ++end;
+                    }
+                    // only holes with a valid left border, the right edge of the image is no border
+                    if (x > 0 && end - x <= max_width) {
+                        std::fill(r + x, r + end, r[x - 1]);
+                    }
+                    x = end;
+                }
+            }
+        });
+    }
+
+    void DepthFilterChain::Report() const {
+        for (int k = 0; k < kDepthFilterKinds; ++k) {
+            if (!filterDurations[k].empty()) {
+                report_stats(name + " depth " + depth_filter_name(static_cast<DepthFilterKind>(k)), filterDurations[k]);
+            }
+        }
+        report_stats(name + " depth chain", totalDurations);
+        spdlog::info("{0}: depth filter - {1} threads, {2} frames allocated outside the pool",
+                     name, pool.Threads(), poolMisses);
+    }
+
+    DepthFilterStage::DepthFilterStage(std::string n, DepthFilterConfig cfg, ThreadSettings t, depth_cb cb)
+            : name(std::move(n)), thread(std::move(t)), callback(std::move(cb)),
+              chain(name, std::move(cfg), [&]() {
+                  ThreadSettings workers = thread;
+                  workers.name += "w";
+                  return workers;
+              }()) {
+    }
+
+    DepthFilterStage::~DepthFilterStage() {
+        Stop();
+    }
+
+    void DepthFilterStage::Start() {
+        task = std::async(std::launch::async, [this]() { Loop(); });
+    }
+
+    void DepthFilterStage::Stop() {
+        frames.close();
+        if (task.valid()) {
+            task.wait();
+        }
+    }
+
+    bool DepthFilterStage::Submit(std::shared_ptr<ob::Frame> depth) {
+        if (frames.try_push(std::move(depth)) != channel_op_status::success) {
+            ++dropped;
+            return false;
+        }
+        return true;
+    }
+
+    void DepthFilterStage::Loop() {
+        apply_thread_settings(thread);
+        std::shared_ptr<ob::Frame> frame;
+        while (frames.pop(frame) == channel_op_status::success) {
+            auto video = std::dynamic_pointer_cast<ob::VideoFrame>(frame);
+            if (!video || video->format() != OB_FORMAT_Y16 ||
+                frame->dataSize() < video->width() * video->height() * sizeof(uint16_t)) {
+                spdlog::warn("{0}: depth frame {1} is not Y16, skipped", name, frame->index());
+                ++dropped;
+                continue;
+            }
+            cv::Mat out;
+            if (chain.Process(static_cast<const uint16_t *>(frame->data()), static_cast<int>(video->width()),
+                              static_cast<int>(video->height()), video->width() * sizeof(uint16_t), out)) {
+                ++filtered;
+                // the SDK frame goes back before the consumer runs
+                frame.reset();
+                video.reset();
+                callback(std::move(out));
+            }
+        }
+    }
+
+    void DepthFilterStage::Report() const {
+        spdlog::info("{0}: depth frames filtered: {1} dropped: {2}", name, filtered.load(), dropped.load());
+        chain.Report();
+    }
+
+} // tcn
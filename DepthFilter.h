@@ -0,0 +1,186 @@
+#ifndef ORBBEC_CAPTURE_TEST_DEPTHFILTER_H
+#define ORBBEC_CAPTURE_TEST_DEPTHFILTER_H
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libobsensor/ObSensor.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include "buffered_channel.h"
+#include "ThreadConfig.h"
+
+namespace tcn {
+
+    enum class DepthFilterKind {
+        // zero everything outside [minDepth, maxDepth]
+        threshold = 0,
+        // edge preserving recursive smoothing along rows and columns
+        spatial,
+        // blend with the previous output where the depth did not jump
+        temporal,
+        // fill invalid pixels from the nearest valid pixel to the left
+        holeFill,
+    };
+    constexpr int kDepthFilterKinds = 4;
+
+    const char *depth_filter_name(DepthFilterKind kind);
+
+    struct DepthFilterConfig {
+        // applied in this order, a leading threshold masks while the frame is loaded
+        std::vector<DepthFilterKind> chain{DepthFilterKind::threshold, DepthFilterKind::spatial,
+                                           DepthFilterKind::temporal, DepthFilterKind::holeFill};
+        // depth units (mm on the Femto Mega), 0 is invalid
+        uint16_t minDepth{100};
+        uint16_t maxDepth{10000};
+        // weight of the current sample, neighbors / history further apart than delta are edges and left alone
+        float spatialAlpha{0.5f};
+        float spatialDelta{50.f};
+        int spatialIterations{2};
+        float temporalAlpha{0.4f};
+        float temporalDelta{30.f};
+        // frames an invalid pixel keeps its last valid temporal value, 0 = off
+        int temporalPersistence{3};
+        // holes wider than this stay invalid
+        int holeFillMaxWidth{16};
+        // tiles are spread over this many threads (the caller included), 0 = half the hardware threads.
+        // with several streams the caller passes each its share, like the codec threads
+        int workers{0};
+        // filtered frames recycled once the consumer released them
+        std::size_t poolSize{4};
+    };
+
+    /**
+     * Fixed set of threads that run one tiled job at a time, the submitting thread works on tiles too.
+     */
+    class TilePool {
+    public:
+        TilePool(int threads, ThreadSettings settings);
+        ~TilePool();
+
+        TilePool(TilePool const &) = delete;
+        TilePool &operator=(TilePool const &) = delete;
+
+        // calls fn(tile) for every tile in [0, tiles) and returns when all are done
+        void Run(int tiles, const std::function<void(int)> &fn);
+
+        int Threads() const { return static_cast<int>(workers.size()) + 1; }
+
+    private:
+        void WorkerLoop();
+        void Work();
+
+        ThreadSettings settings;
+        std::vector<std::thread> workers;
+        std::mutex mutex_;
+        std::condition_variable start_;
+        std::condition_variable done_;
+        const std::function<void(int)> *job{nullptr};
+        int tileCount{0};
+        std::atomic<int> nextTile{0};
+        int pendingTiles{0};
+        int activeWorkers{0};
+        uint64_t generation{0};
+        bool stopping{false};
+    };
+
+    /**
+     * Runs the configured filters over Y16 depth frames. Working and temporal state live in buffers allocated
+     * for the frame geometry, so steady state filtering allocates nothing. Not thread safe, one caller.
+     */
+    class DepthFilterChain {
+    public:
+        DepthFilterChain(std::string name, DepthFilterConfig cfg, ThreadSettings worker_settings = {});
+
+        // out is a CV_16UC1 Mat from the pool
+        bool Process(const uint16_t *depth, int width, int height, std::size_t stride_bytes, cv::Mat &out);
+
+        // forgets the temporal history, e.g. after frames were dropped
+        void Reset();
+
+        void Report() const;
+
+    private:
+        void Prepare(int width, int height);
+        // raw samples into work, everything outside [lo, hi] becomes invalid
+        void Load(const uint16_t *depth, std::size_t stride, float lo, float hi);
+        void Threshold();
+        void Spatial();
+        void Transpose(const float *src, float *dst, int rows, int cols);
+        // edge preserving recursive smoothing down and up every column of a rows x cols image
+        void SmoothColumns(float *data, int rows, int cols);
+        void Temporal();
+        void HoleFill();
+        cv::Mat Acquire();
+
+        std::string name;
+        DepthFilterConfig config;
+        TilePool pool;
+        int width{0};
+        int height{0};
+        // rows per tile for row parallel passes
+        int rowsPerTile{0};
+        std::vector<float> work;
+        // work transposed, for the horizontal spatial pass
+        std::vector<float> transposed;
+        std::vector<float> history;
+        std::vector<uint8_t> historyAge;
+        bool historyValid{false};
+        std::vector<cv::Mat> outputs;
+        uint64_t poolMisses{0};
+        // milliseconds per filter and for the whole chain
+        std::array<std::vector<double>, kDepthFilterKinds> filterDurations;
+        std::vector<double> totalDurations;
+    };
+
+    /**
+     * Filters the depth frames of a pipeline on its own thread, next to (not in front of) color decoding.
+     * Frames arriving while the stage is busy are dropped rather than queued up.
+     */
+    class DepthFilterStage {
+    public:
+        typedef std::function<void(cv::Mat depth)> depth_cb;
+
+        DepthFilterStage(std::string name, DepthFilterConfig cfg, ThreadSettings thread, depth_cb cb);
+        ~DepthFilterStage();
+
+        DepthFilterStage(DepthFilterStage const &) = delete;
+        DepthFilterStage &operator=(DepthFilterStage const &) = delete;
+
+        void Start();
+        void Stop();
+
+        // never blocks, returns false if the frame was dropped
+        bool Submit(std::shared_ptr<ob::Frame> depth);
+
+        uint64_t Filtered() const { return filtered; }
+        uint64_t Dropped() const { return dropped; }
+
+        void Report() const;
+
+    private:
+        void Loop();
+
+        std::string name;
+        ThreadSettings thread;
+        depth_cb callback;
+        DepthFilterChain chain;
+        buffered_channel<std::shared_ptr<ob::Frame>> frames{4};
+        std::future<void> task;
+        std::atomic<uint64_t> filtered{0};
+        std::atomic<uint64_t> dropped{0};
+    };
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_DEPTHFILTER_H
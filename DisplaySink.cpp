@@ -0,0 +1,65 @@
+#include "DisplaySink.h"
+#include <spdlog/spdlog.h>
+
+#include <utility>
+
+namespace tcn {
+
+    DisplaySink::DisplaySink(double scale) : scale(scale), createdTs(std::chrono::steady_clock::now()) {}
+
+    void DisplaySink::AddWindow(const std::string &name) {
+        windows.emplace(name, std::make_unique<Window>());
+    }
+
+    void DisplaySink::Submit(const std::string &name, cv::Mat image) {
+        auto it = windows.find(name);
+        if (it == windows.end()) {
+            spdlog::warn("display: no window registered for {0}", name);
+            return;
+        }
+        auto &w = *it->second;
+        // cv::Mat is reference counted, this hands over the decoded buffer without copying
+        w.latest.back() = std::move(image);
+        ++w.submitted;
+        if (w.latest.publish()) {
+            ++w.skipped;
+        }
+    }
+
+    int DisplaySink::RenderOnce() {
+        int shown{0};
+        for (auto &[name, w] : windows) {
+            if (!w->latest.update()) {
+                continue;
+            }
+            cv::Mat &image = w->latest.front();
+            if (image.empty()) {
+                continue;
+            }
+            if (scale > 0. && scale < 1.) {
+                cv::resize(image, scaled, cv::Size(), scale, scale, cv::INTER_AREA);
+                cv::imshow(name, scaled);
+            } else {
+                cv::imshow(name, image);
+            }
+            // release the frame now instead of holding it until the next swap
+            image.release();
+            ++w->displayed;
+            ++shown;
+            if (!w->shownOnce) {
+                w->shownOnce = true;
+                spdlog::info("{0}: first frame displayed after {1:.1f}ms", name,
+                             std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - createdTs).count());
+            }
+        }
+        return shown;
+    }
+
+    void DisplaySink::ReportStats() const {
+        for (const auto &[name, w] : windows) {
+            spdlog::info("{0}: display - submitted: {1} displayed: {2} skipped by display: {3}",
+                         name, w->submitted.load(), w->displayed, w->skipped.load());
+        }
+    }
+
+} // tcn
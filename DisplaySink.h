@@ -0,0 +1,55 @@
+#ifndef ORBBEC_CAPTURE_TEST_DISPLAYSINK_H
+#define ORBBEC_CAPTURE_TEST_DISPLAYSINK_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#include "triple_buffer.h"
+
+namespace tcn {
+
+    /**
+     * Shows the most recent image of every window at the display's own pace.
+     * Decoders hand images over through a triple buffer and never wait for the window system;
+     * images replaced before they were shown are counted as skipped, not as drops.
+     */
+    class DisplaySink {
+    public:
+        // scale < 1 downsizes images on the display thread
+        explicit DisplaySink(double scale = 1.0);
+
+        // windows must be added before any producer submits to them
+        void AddWindow(const std::string &name);
+
+        // producer side, one producer per window, never blocks
+        void Submit(const std::string &name, cv::Mat image);
+
+        // display thread: shows every window that has a new image, returns the number shown
+        int RenderOnce();
+
+        void ReportStats() const;
+
+    private:
+        struct Window {
+            triple_buffer<cv::Mat> latest;
+            std::atomic<uint64_t> submitted{0};
+            std::atomic<uint64_t> skipped{0};
+            uint64_t displayed{0};
+            bool shownOnce{false};
+        };
+
+        double scale;
+        std::map<std::string, std::unique_ptr<Window>> windows;
+        std::chrono::steady_clock::time_point createdTs;
+        cv::Mat scaled;
+    };
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_DISPLAYSINK_H
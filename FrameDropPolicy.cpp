@@ -0,0 +1,43 @@
+#include "FrameDropPolicy.h"
+#include <spdlog/spdlog.h>
+
+namespace tcn {
+
+    KeyframeDropPolicy::Decision KeyframeDropPolicy::Admit(const vpf::AccessUnitInfo &au, double queue_fill) {
+        Decision d;
+        if (mode == DropMode::any) {
+            return d;
+        }
+        if (waitingForKeyframe) {
+            if (!au.keyframe) {
+                ++stats.gopTailDrops;
+                d.forward = false;
+                return d;
+            }
+            waitingForKeyframe = false;
+            ++stats.resyncs;
+            d.resync = true;
+            spdlog::debug("drop policy: resuming at keyframe");
+            return d;
+        }
+        if (!au.reference && queue_fill >= pressureThreshold) {
+            // nothing references this frame, skipping it costs one frame and no corruption
+            ++stats.nonReferenceDrops;
+            d.forward = false;
+        }
+        return d;
+    }
+
+    void KeyframeDropPolicy::OnDropped(const vpf::AccessUnitInfo &au) {
+        if (mode == DropMode::any) {
+            return;
+        }
+        if (au.reference) {
+            // everything up to the next IDR would decode against a missing reference
+            waitingForKeyframe = true;
+        } else {
+            ++stats.nonReferenceDrops;
+        }
+    }
+
+} // tcn
@@ -0,0 +1,56 @@
+#ifndef ORBBEC_CAPTURE_TEST_FRAMEDROPPOLICY_H
+#define ORBBEC_CAPTURE_TEST_FRAMEDROPPOLICY_H
+
+#include <cstdint>
+
+#include "H26xBitstream.h"
+
+namespace tcn {
+
+    enum class DropMode {
+        // drop whatever frame does not fit into the queue (corrupts the GOP until the next IDR)
+        any,
+        // drop non-reference frames under pressure, on a forced drop skip the rest of the GOP
+        keyframe
+    };
+
+    /**
+     * Decides per encoded frame whether it is forwarded to the decoder, so that overload
+     * produces fewer but intact frames. Not thread safe, lives on the capture thread.
+     */
+    class KeyframeDropPolicy {
+    public:
+        struct Decision {
+            bool forward{true};
+            // the frame restarts decoding after a gap, the decoder should drop stale references first
+            bool resync{false};
+        };
+
+        struct Stats {
+            uint64_t nonReferenceDrops{0};
+            uint64_t gopTailDrops{0};
+            uint64_t resyncs{0};
+        };
+
+        explicit KeyframeDropPolicy(DropMode mode = DropMode::keyframe, double pressure_threshold = 0.5)
+                : mode(mode), pressureThreshold(pressure_threshold) {}
+
+        // queue_fill is the queue occupancy in [0, 1] before the frame is pushed
+        Decision Admit(const vpf::AccessUnitInfo &au, double queue_fill);
+
+        // a forwarded frame could not be queued after all
+        void OnDropped(const vpf::AccessUnitInfo &au);
+
+        bool WaitingForKeyframe() const { return waitingForKeyframe; }
+        const Stats &GetStats() const { return stats; }
+
+    private:
+        DropMode mode;
+        double pressureThreshold;
+        bool waitingForKeyframe{false};
+        Stats stats;
+    };
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_FRAMEDROPPOLICY_H
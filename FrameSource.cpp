@@ -0,0 +1,536 @@
+#include "FrameSource.h"
+#include "H26xBitstream.h"
+#include "H26xDecoder.h"
+#include "Statistics.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <utility>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+namespace tcn {
+
+    namespace {
+        EncodedFrame make_encoded_frame(std::shared_ptr<ob::FrameSet> fs, const std::shared_ptr<ob::ColorFrame> &cf) {
+            EncodedFrame frame;
+            frame.data = static_cast<const uint8_t *>(cf->data());
+            frame.size = cf->dataSize();
+            frame.format = cf->format();
+            frame.width = cf->width();
+            frame.height = cf->height();
+            frame.index = cf->index();
+            frame.deviceTimestampUs = cf->timeStampUs();
+            frame.systemTimestampUs = cf->systemTimeStamp() * 1000;
+            // the device delivers one access unit per color frame
+            frame.completeAccessUnit = true;
+            frame.frameSet = std::move(fs);
+            return frame;
+        }
+    }
+
+    OrbbecFrameSource::OrbbecFrameSource(std::shared_ptr<ob::Context> ctx, OrbbecSourceConfig cfg)
+            : context(std::move(ctx)), config(std::move(cfg)) {}
+
+    OrbbecFrameSource::~OrbbecFrameSource() {
+        Stop();
+    }
+
+    bool OrbbecFrameSource::Open() {
+        if (pipe) {
+            return true;
+        }
+        // Create a network device through ip (the default port number is: 8090, devices that currently support network mode do not support modifying the port
+        // number)
+        auto device = context->createNetDevice(config.ip.c_str(), config.port);
+
+        // pass in device to create pipeline
+        pipe = std::make_shared<ob::Pipeline>(device);
+
+        // Create Config for configuring Pipeline work
+        obConfig = std::make_shared<ob::Config>();
+
+        // Get the color camera configuration list
+        auto colorProfileList = pipe->getStreamProfileList(OB_SENSOR_COLOR);
+        auto colorProfile = colorProfileList->getVideoStreamProfile(static_cast<int>(config.width),
+                                                                    static_cast<int>(config.height),
+                                                                    config.format,
+                                                                    static_cast<int>(config.fps));
+        obConfig->enableStream(colorProfile);
+
+        // the selected profile is authoritative for the decoder warm-up
+        info.format = colorProfile->format();
+        info.width = colorProfile->width();
+        info.height = colorProfile->height();
+        info.fps = colorProfile->fps();
+
+        if (config.useDepth) {
+            // Get the depth camera configuration list
+            auto depthProfileList = pipe->getStreamProfileList(OB_SENSOR_DEPTH);
+            // use default configuration
+            auto depthProfile = depthProfileList->getVideoStreamProfile(640, 576, OB_FORMAT_Y16, 25);
+            obConfig->enableStream(depthProfile);
+            if (!config.hostSync) {
+                pipe->enableFrameSync();
+            }
+        }
+        return true;
+    }
+
+    bool OrbbecFrameSource::Start(frame_cb cb) {
+        if (!Open()) {
+            return false;
+        }
+
+        bool use_depth = config.useDepth;
+        size_t padding = config.paddedFrames ? AV_INPUT_BUFFER_PADDING_SIZE : 0;
+        std::string name = config.ip;
+        if (use_depth && config.hostSync) {
+            synchronizer = std::make_unique<FrameSynchronizer>(name, config.sync, [cb, padding](FrameSynchronizer::Pair pair) {
+                if (!pair.color.frame) {
+                    return;
+                }
+                auto frame = make_encoded_frame(std::move(pair.color.frameSet),
+                                                std::static_pointer_cast<ob::ColorFrame>(pair.color.frame));
+                frame.depthFrame = std::move(pair.depth.frame);
+                frame.padding = padding;
+                cb(std::move(frame));
+            });
+            FrameSynchronizer *sync = synchronizer.get();
+            // without the SDK frame sync color and depth arrive in separate, possibly partial framesets
+            pipe->start(obConfig, [sync, name](std::shared_ptr<ob::FrameSet> fs) {
+                if (!fs) {
+                    spdlog::error("{0}: received invalid frameset", name);
+                    return;
+                }
+                auto cf = fs->colorFrame();
+                auto df = fs->depthFrame();
+                if (df) {
+                    sync->PushDepth(fs, df);
+                }
+                if (cf) {
+                    sync->PushColor(std::move(fs), cf);
+                }
+            });
+            spdlog::info("{0}: started color stream {1}x{2}@{3} with host frame sync (tolerance {4}us)",
+                         name, info.width, info.height, info.fps, config.sync.toleranceUs);
+            return true;
+        }
+
+        pipe->start(obConfig, [this, cb = std::move(cb), use_depth, padding, name](std::shared_ptr<ob::FrameSet> fs) {
+            if (!fs) {
+                spdlog::error("{0}: received invalid frameset", name);
+                return;
+            }
+            // never forward incomplete frames
+            if ((use_depth && fs->depthFrame() == nullptr) || fs->colorFrame() == nullptr) {
+                spdlog::warn("{0}: received incomplete frame - skipping", name);
+                if (fs->colorFrame() != nullptr) {
+                    ++incompleteFrames;
+                }
+                return;
+            }
+            auto cf = fs->colorFrame();
+            auto frame = make_encoded_frame(fs, cf);
+            frame.depthFrame = fs->depthFrame();
+            frame.padding = padding;
+            cb(std::move(frame));
+        });
+        spdlog::info("{0}: started color stream {1}x{2}@{3}", name, info.width, info.height, info.fps);
+        return true;
+    }
+
+    void OrbbecFrameSource::Stop() {
+        if (pipe) {
+            pipe->stop();
+            pipe.reset();
+            obConfig.reset();
+        }
+    }
+
+    uint64_t OrbbecFrameSource::DiscardedFrames() const {
+        return incompleteFrames + (synchronizer ? synchronizer->GetStats().droppedColor : 0);
+    }
+
+    void OrbbecFrameSource::ReportStats() const {
+        if (synchronizer) {
+            synchronizer->Report();
+        }
+    }
+
+
+    ReplayFrameSource::ReplayFrameSource(ReplaySourceConfig cfg) : config(std::move(cfg)) {}
+
+    ReplayFrameSource::~ReplayFrameSource() {
+        Stop();
+    }
+
+    bool ReplayFrameSource::LoadAccessUnits() {
+        RecordingIndex scanned;
+        bool ok = build_recording_index(config.path, config.format, frameIntervalUs, scanned, width, height,
+                                        [&](uint64_t, const uint8_t *data, std::size_t size) {
+            // zeroed slack after the access unit lets the decoder reference it without a copy
+            auto au = std::make_shared<std::vector<uint8_t>>(size + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+            std::copy(data, data + size, au->begin());
+            au->resize(size);
+            accessUnits.push_back(std::move(au));
+            return true;
+        });
+        if (!ok) {
+            spdlog::error("Replay: error while parsing {0}", config.path);
+        }
+        // the scan is there anyway, saved so large replays of the same recording can seek without one
+        if (recordingIndex.Size() != scanned.Size()) {
+            recordingIndex = std::move(scanned);
+            recordingIndex.Save(index_path(config.path));
+        }
+        info.format = config.format;
+        info.width = width;
+        info.height = height;
+        info.fps = config.fps;
+        if (!accessUnits.empty()) {
+            info.parameterSets = vpf::H26xDecoder::ExtractParameterSets(config.format, accessUnits.front()->data(),
+                                                                        accessUnits.front()->size());
+        }
+
+        spdlog::info("Replay: loaded {0} access units ({1}x{2}) from {3}",
+                     accessUnits.size(), width, height, config.path);
+        return !accessUnits.empty();
+    }
+
+    bool ReplayFrameSource::OpenStreamed() {
+        const auto t_start = std::chrono::steady_clock::now();
+        if (recordingIndex.Empty()) {
+            if (!build_recording_index(config.path, config.format, frameIntervalUs, recordingIndex, width, height)) {
+                return false;
+            }
+            recordingIndex.Save(index_path(config.path));
+        }
+        streamFile.open(config.path, std::ios::binary);
+        if (!streamFile) {
+            spdlog::error("Replay: cannot open {0}", config.path);
+            return false;
+        }
+        // the geometry is known once the parser has seen the first access unit
+        if (!split_access_units(streamFile, config.format, [](uint64_t, const uint8_t *, std::size_t) { return false; },
+                                width, height)) {
+            return false;
+        }
+        streamFile.clear();
+        streamed = true;
+        auto first = ReadFrame(0);
+        if (!first) {
+            streamed = false;
+            return false;
+        }
+        info.format = config.format;
+        info.width = width;
+        info.height = height;
+        info.fps = config.fps;
+        info.parameterSets = vpf::H26xDecoder::ExtractParameterSets(config.format, first->data(), first->size());
+        spdlog::info("Replay: streaming {0} frames, {1} keyframes ({2}x{3}) from {4}, opened in {5:.1f}ms",
+                     recordingIndex.Size(), recordingIndex.Keyframes(), width, height, config.path,
+                     std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count());
+        return true;
+    }
+
+    uint64_t ReplayFrameSource::FrameCount() const {
+        return streamed ? recordingIndex.Size() : accessUnits.size();
+    }
+
+    std::shared_ptr<std::vector<uint8_t>> ReplayFrameSource::ReadFrame(uint64_t frame) {
+        if (!streamed) {
+            return accessUnits[frame];
+        }
+        const auto &e = recordingIndex.Entry(frame);
+        auto au = std::make_shared<std::vector<uint8_t>>(e.size + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+        au->resize(e.size);
+        streamFile.seekg(static_cast<std::streamoff>(e.offset));
+        if (!streamFile.read(reinterpret_cast<char *>(au->data()), static_cast<std::streamsize>(e.size))) {
+            streamFile.clear();
+            spdlog::error("Replay: cannot read frame {0} ({1} bytes at {2}) of {3}", frame, e.size, e.offset, config.path);
+            return nullptr;
+        }
+        return au;
+    }
+
+    bool ReplayFrameSource::Open() {
+        if (FrameCount() > 0) {
+            return true;
+        }
+        frameIntervalUs = 1000000 / std::max<uint32_t>(config.fps, 1);
+        width = config.width;
+        height = config.height;
+        std::error_code ec;
+        const auto file_size = std::filesystem::file_size(config.path, ec);
+        if (ec) {
+            spdlog::error("Replay: cannot open {0}", config.path);
+            return false;
+        }
+        // a sidecar that does not cover the file exactly belongs to an older recording
+        if (recordingIndex.Load(index_path(config.path)) && recordingIndex.StreamBytes() != file_size) {
+            spdlog::warn("Replay: {0} does not match {1}, rebuilding it", index_path(config.path), config.path);
+            recordingIndex.Clear();
+        }
+        if (file_size > config.preloadLimitBytes ? !OpenStreamed() : !LoadAccessUnits()) {
+            return false;
+        }
+        if (config.recordedTiming && arrivals.empty()) {
+            if (!load_arrival_records(timing_path(config.path), arrivals)) {
+                return false;
+            }
+            AlignArrivals();
+            if (arrivals.size() > 1) {
+                frameIntervalUs = std::max<int64_t>(1, (arrivals.back().arrivalUs - arrivals.front().arrivalUs) /
+                                                       static_cast<int64_t>(arrivals.size() - 1));
+            }
+            if (arrivals.size() != FrameCount()) {
+                spdlog::warn("Replay: {0} arrival records for {1} access units, the rest is paced at {2:.1f}fps",
+                             arrivals.size(), FrameCount(), 1e6 / static_cast<double>(frameIntervalUs));
+            }
+            spdlog::info("Replay: pacing {0} by its recorded arrival times", config.path);
+        }
+        return true;
+    }
+
+    void ReplayFrameSource::AlignArrivals() {
+        // the recorder writes every received frame in one piece, so a record's byte range in the stream is the
+        // sum of the sizes before it. an access unit arrived with the record holding its last byte
+        std::vector<ArrivalRecord> aligned;
+        aligned.reserve(FrameCount());
+        uint64_t mismatched{0};
+        std::size_t r{0};
+        uint64_t record_offset{0};
+        for (uint64_t f = 0; f < recordingIndex.Size(); ++f) {
+            const auto &e = recordingIndex.Entry(f);
+            const uint64_t end = e.offset + e.size;
+            while (r < arrivals.size() && record_offset + arrivals[r].size < end) {
+                record_offset += arrivals[r].size;
+                ++r;
+            }
+            if (r >= arrivals.size()) {
+                break;
+            }
+            if (record_offset != e.offset || record_offset + arrivals[r].size != end) {
+                ++mismatched;
+            }
+            aligned.push_back(arrivals[r]);
+            if (record_offset + arrivals[r].size == end) {
+                record_offset += arrivals[r].size;
+                ++r;
+            }
+        }
+        if (mismatched > 0) {
+            spdlog::warn("Replay: {0} of {1} access units do not line up with an arrival record of the same size, "
+                         "they are paced by the record their last byte arrived in", mismatched, aligned.size());
+        }
+        arrivals = std::move(aligned);
+    }
+
+    bool ReplayFrameSource::Seek(uint64_t frame) {
+        if (frame >= FrameCount()) {
+            spdlog::error("Replay: cannot seek to frame {0} of {1}, it has {2} frames", frame, config.path, FrameCount());
+            return false;
+        }
+        uint64_t keyframe{0};
+        if (!recordingIndex.KeyframeAtOrBefore(frame, keyframe)) {
+            spdlog::error("Replay: cannot seek to frame {0} of {1}, no keyframe precedes it", frame, config.path);
+            return false;
+        }
+        std::scoped_lock<std::mutex> lk{stopMutex};
+        pendingSeek = static_cast<int64_t>(frame);
+        // cuts a pacing wait short
+        stopSignal.notify_all();
+        return true;
+    }
+
+    bool ReplayFrameSource::SeekToTimestamp(uint64_t device_timestamp_us) {
+        if (recordingIndex.Empty()) {
+            return false;
+        }
+        return Seek(recordingIndex.FrameAtTimestamp(recordingIndex.Entry(0).deviceTimestampUs + device_timestamp_us));
+    }
+
+    int64_t ReplayFrameSource::ScheduledUs(uint64_t index) const {
+        const uint64_t per_loop = FrameCount();
+        const uint64_t loop = index / per_loop;
+        const uint64_t i = index % per_loop;
+        if (arrivals.empty()) {
+            return static_cast<int64_t>(index) * frameIntervalUs;
+        }
+        // a loop starts one mean interval after the previous one ended
+        const int64_t base = arrivals.front().arrivalUs;
+        const int64_t loop_span = (arrivals.size() >= per_loop ? arrivals[per_loop - 1].arrivalUs
+                                                               : arrivals.back().arrivalUs +
+                                                                 static_cast<int64_t>(per_loop - arrivals.size()) * frameIntervalUs)
+                                  - base + frameIntervalUs;
+        const int64_t in_loop = i < arrivals.size()
+                                ? arrivals[i].arrivalUs - base
+                                : arrivals.back().arrivalUs - base + static_cast<int64_t>(i - arrivals.size() + 1) * frameIntervalUs;
+        return static_cast<int64_t>(loop) * loop_span + in_loop;
+    }
+
+    bool ReplayFrameSource::Start(frame_cb cb) {
+        if (!Open()) {
+            return false;
+        }
+        shouldStop = false;
+        finished = false;
+        deliveredFrames = 0;
+        prerollFrames = 0;
+        paceErrors.clear();
+        paceErrors.reserve(kReservedSamples);
+        seekLatencies.clear();
+        impairer.reset();
+        if (config.impairment.Enabled()) {
+            impairer = std::make_unique<ArrivalImpairer>(config.impairment, frameIntervalUs);
+            spdlog::info("Replay: impairing {0} with {1}", config.path, config.impairment.Describe());
+        }
+        if (config.startFrame > 0 && !Seek(config.startFrame)) {
+            return false;
+        }
+
+        replayTask = std::async(std::launch::async, [this, cb = std::move(cb)]() {
+            const auto start_ts = std::chrono::steady_clock::now();
+            const uint64_t per_loop = FrameCount();
+            const bool h26x = vpf::is_h26x_format(config.format);
+            // added to the schedule after a seek, so the target is due at once and the schedule never runs backwards
+            int64_t shift_us{0};
+            int64_t last_scheduled_us{0};
+            // positions before this are preroll of the current seek
+            uint64_t preroll_until{0};
+            bool resync{false};
+            bool seeking{false};
+            std::chrono::steady_clock::time_point seek_ts;
+            for (int loop = 0; (config.loops <= 0 || loop < config.loops) && !shouldStop; ++loop) {
+                const uint64_t loop_base = static_cast<uint64_t>(loop) * per_loop;
+                uint64_t i{0};
+                preroll_until = 0;
+                while (i < per_loop && !shouldStop) {
+                    const int64_t target = pendingSeek.exchange(-1);
+                    if (target >= 0) {
+                        seek_ts = std::chrono::steady_clock::now();
+                        seeking = true;
+                        preroll_until = static_cast<uint64_t>(target);
+                        // Seek() only takes targets with a keyframe at or before them
+                        recordingIndex.KeyframeAtOrBefore(preroll_until, i);
+                        // the decoder forgets the references of the old position
+                        resync = true;
+                        const int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(seek_ts - start_ts).count();
+                        shift_us = std::max(now_us, last_scheduled_us) - ScheduledUs(loop_base + preroll_until);
+                    }
+                    const uint64_t index = loop_base + i;
+                    const bool preroll = i < preroll_until;
+                    auto au = ReadFrame(i);
+                    if (!au) {
+                        shouldStop = true;
+                        break;
+                    }
+                    if (preroll && h26x && !vpf::inspect_access_unit(config.format, au->data(), au->size()).reference) {
+                        // nothing on the way to the target refers to it
+                        ++i;
+                        continue;
+                    }
+                    const int64_t scheduled_us = ScheduledUs(index) + shift_us;
+                    if (!preroll) {
+                        last_scheduled_us = scheduled_us;
+                        ArrivalImpairer::Arrival arrival{scheduled_us, false};
+                        if (impairer) {
+                            arrival = impairer->Next(scheduled_us);
+                        }
+                        if (arrival.lost) {
+                            // the frame index still advances, downstream sees the gap
+                            ++i;
+                            continue;
+                        }
+                        if (config.paced) {
+                            // deadlines are absolute, so waits that overshoot do not add up over the run
+                            const auto due = start_ts + std::chrono::microseconds(arrival.deliverUs);
+                            // Stop() and Seek() cut the pacing wait short
+                            std::unique_lock<std::mutex> lk{stopMutex};
+                            if (stopSignal.wait_until(lk, due, [this]() { return shouldStop || pendingSeek >= 0; })) {
+                                continue;
+                            }
+                            lk.unlock();
+                            paceErrors.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - due).count());
+                        }
+                    }
+                    EncodedFrame frame;
+                    frame.buffer = au;
+                    frame.data = au->data();
+                    frame.size = au->size();
+                    frame.completeAccessUnit = true;
+                    frame.padding = au->capacity() - au->size();
+                    frame.format = config.format;
+                    frame.width = width;
+                    frame.height = height;
+                    frame.index = index;
+                    frame.resync = resync;
+                    frame.preroll = preroll;
+                    frame.discontinuity = seeking && !preroll;
+                    resync = false;
+                    // recorded device clock relative to the first frame, continued across loops
+                    frame.deviceTimestampUs = i < arrivals.size()
+                                              ? static_cast<uint64_t>(ScheduledUs(loop_base)) +
+                                                (arrivals[i].deviceTimestampUs - arrivals.front().deviceTimestampUs)
+                                              : static_cast<uint64_t>(ScheduledUs(index));
+                    frame.systemTimestampUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::system_clock::now().time_since_epoch()).count());
+                    ++i;
+                    if (preroll) {
+                        ++prerollFrames;
+                    } else {
+                        ++deliveredFrames;
+                        if (seeking) {
+                            seeking = false;
+                            seekLatencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - seek_ts).count());
+                        }
+                    }
+                    cb(std::move(frame));
+                }
+            }
+            finished = true;
+            if (finishedCallback) {
+                finishedCallback();
+            }
+        });
+        return true;
+    }
+
+    void ReplayFrameSource::ReportStats() const {
+        spdlog::info("{0}: replay - delivered: {1} pacing: {2}", config.path, deliveredFrames,
+                     !config.paced ? "none" : arrivals.empty() ? "fps" : "recorded");
+        if (!seekLatencies.empty()) {
+            spdlog::info("{0}: seeks - {1} with {2} preroll frames", config.path, seekLatencies.size(), prerollFrames);
+            report_stats(config.path + " replay seek_ms", seekLatencies);
+        }
+        if (impairer) {
+            const auto &st = impairer->GetStats();
+            spdlog::info("{0}: impairments ({1}) - lost: {2} bursts: {3} stalls: {4} delay mean: {5:.2f}ms max: {6:.2f}ms",
+                         config.path, config.impairment.Describe(), st.lost, st.bursts, st.stalls,
+                         deliveredFrames > 0 ? st.totalDelayMs / static_cast<double>(deliveredFrames) : 0., st.maxDelayMs);
+        }
+        if (config.paced) {
+            // how late the replay thread delivered against its own schedule, should stay well below a frame
+            report_stats(config.path + " replay pacing_error", paceErrors);
+        }
+    }
+
+    void ReplayFrameSource::Stop() {
+        {
+            std::scoped_lock<std::mutex> lk{stopMutex};
+            shouldStop = true;
+            stopSignal.notify_all();
+        }
+        if (replayTask.valid()) {
+            replayTask.wait();
+        }
+    }
+
+} // tcn
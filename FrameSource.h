@@ -0,0 +1,252 @@
+#ifndef ORBBEC_CAPTURE_TEST_FRAMESOURCE_H
+#define ORBBEC_CAPTURE_TEST_FRAMESOURCE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "libobsensor/ObSensor.hpp"
+
+#include "FrameSynchronizer.h"
+#include "RecordingIndex.h"
+#include "ReplayTiming.h"
+
+namespace tcn {
+
+    /**
+     * One encoded color frame as it travels from a source into a capture pipeline.
+     * Device sources keep the originating FrameSet alive (the payload points into SDK memory),
+     * replay sources own their payload through buffer.
+     */
+    struct EncodedFrame {
+        std::shared_ptr<ob::FrameSet> frameSet;
+        // depth frame paired with this color frame, if depth is enabled and a partner was found
+        std::shared_ptr<ob::Frame> depthFrame;
+        std::shared_ptr<std::vector<uint8_t>> buffer;
+        const uint8_t *data{nullptr};
+        size_t size{0};
+        OBFormat format{OB_FORMAT_UNKNOWN};
+        uint32_t width{0};
+        uint32_t height{0};
+        uint64_t index{0};
+        uint64_t deviceTimestampUs{0};
+        uint64_t systemTimestampUs{0};
+        // host steady clock when the pipeline took the frame from its source
+        std::chrono::steady_clock::time_point receivedTs;
+        // first frame after frames were dropped on purpose, the decoder drops stale references
+        bool resync{false};
+        // data holds exactly one access unit, so the decoder can skip the parser
+        bool completeAccessUnit{false};
+        // decoded only as a reference on the way to a seek target, no image is delivered for it
+        bool preroll{false};
+        // the index jumps here on purpose (seek target), the frames in between are not lost
+        bool discontinuity{false};
+        // bytes readable after data + size (zero-copy decode needs AV_INPUT_BUFFER_PADDING_SIZE)
+        size_t padding{0};
+
+        // whatever keeps data alive
+        std::shared_ptr<const void> Owner() const {
+            if (frameSet) {
+                return frameSet;
+            }
+            return buffer;
+        }
+
+        // memory held while the frame is queued, the paired depth frame included
+        std::size_t Bytes() const {
+            std::size_t bytes = size + padding;
+            if (depthFrame) {
+                bytes += depthFrame->dataSize();
+            }
+            return bytes;
+        }
+    };
+
+    /**
+     * Stream properties known once a source is opened, before the first frame arrives.
+     */
+    struct StreamInfo {
+        OBFormat format{OB_FORMAT_UNKNOWN};
+        uint32_t width{0};
+        uint32_t height{0};
+        uint32_t fps{0};
+        // Annex-B SPS/PPS (VPS) if the source knows them up front
+        std::vector<uint8_t> parameterSets;
+    };
+
+    class FrameSource {
+    public:
+        typedef std::function<void(EncodedFrame frame)> frame_cb;
+        typedef std::function<void()> finished_cb;
+
+        virtual ~FrameSource() = default;
+
+        // resolves device / file and the stream profile, Start() opens implicitly if needed
+        virtual bool Open() = 0;
+
+        virtual StreamInfo Info() const = 0;
+
+        virtual bool Start(frame_cb cb) = 0;
+
+        virtual void Stop() = 0;
+
+        // true once a finite source has delivered all of its frames
+        virtual bool Finished() const { return false; }
+
+        // called from the source's thread once Finished() turned true, set before Start()
+        void SetFinishedCallback(finished_cb cb) { finishedCallback = std::move(cb); }
+
+        virtual uint32_t Fps() const = 0;
+
+        virtual std::string Name() const = 0;
+
+        // frames that reached the host but were not handed on (incomplete framesets, unmatched frame sync)
+        virtual uint64_t DiscardedFrames() const { return 0; }
+
+        virtual void ReportStats() const {}
+
+    protected:
+        finished_cb finishedCallback;
+    };
+
+    struct OrbbecSourceConfig {
+        std::string ip{"10.0.130.42"};
+        uint16_t port{8090};
+        uint32_t width{2560};
+        uint32_t height{1440};
+        uint32_t fps{25};
+        OBFormat format{OB_FORMAT_H264};
+        bool useDepth{true};
+        // treat SDK frame buffers as padded for the decoder, so they are decoded without a copy.
+        // only for SDK versions known to allocate frame memory with AV_INPUT_BUFFER_PADDING_SIZE slack
+        bool paddedFrames{false};
+        // pair color and depth on the host instead of using the SDK frame sync
+        bool hostSync{true};
+        SyncConfig sync;
+    };
+
+    /**
+     * Color (and optionally depth) frames from a networked Femto Mega.
+     */
+    class OrbbecFrameSource : public FrameSource {
+    public:
+        OrbbecFrameSource(std::shared_ptr<ob::Context> ctx, OrbbecSourceConfig cfg);
+        ~OrbbecFrameSource() override;
+
+        bool Open() override;
+        StreamInfo Info() const override { return info; }
+        bool Start(frame_cb cb) override;
+        void Stop() override;
+        uint32_t Fps() const override { return config.fps; }
+        std::string Name() const override { return config.ip; }
+        uint64_t DiscardedFrames() const override;
+        void ReportStats() const override;
+
+    private:
+        std::shared_ptr<ob::Context> context;
+        OrbbecSourceConfig config;
+        std::shared_ptr<ob::Pipeline> pipe;
+        std::shared_ptr<ob::Config> obConfig;
+        std::unique_ptr<FrameSynchronizer> synchronizer;
+        StreamInfo info;
+        // incomplete framesets skipped in the SDK callback
+        std::atomic<uint64_t> incompleteFrames{0};
+    };
+
+    struct ReplaySourceConfig {
+        std::string path;
+        OBFormat format{OB_FORMAT_H264};
+        uint32_t fps{25};
+        // when false, frames are delivered as fast as the consumer accepts them
+        bool paced{true};
+        int loops{1};
+        // pace by the arrival times recorded next to the stream (timing_path) instead of fps
+        bool recordedTiming{false};
+        // applied on top of the pacing, loss also when unpaced
+        ImpairmentProfile impairment;
+        // files up to this size are split into access units up front, larger ones are read frame by frame
+        std::size_t preloadLimitBytes{512u << 20};
+        // replay starts here, as if Seek(startFrame) was called before Start()
+        uint64_t startFrame{0};
+        // frame size of raw YUYV recordings, they carry no header to take it from
+        uint32_t width{0};
+        uint32_t height{0};
+    };
+
+    /**
+     * Replays a raw Annex-B H.264/H.265 elementary stream, concatenated JPEGs or raw YUYV frames. Small files are split into access units
+     * up front, large ones are read on demand through the keyframe index (index_path, scanned once
+     * and saved if the recording has none). Frames are delivered at the nominal rate or at the recorded
+     * arrival times, optionally impaired by a seeded profile, so stress runs are repeatable.
+     */
+    class ReplayFrameSource : public FrameSource {
+    public:
+        explicit ReplayFrameSource(ReplaySourceConfig cfg);
+        ~ReplayFrameSource() override;
+
+        bool Open() override;
+        StreamInfo Info() const override { return info; }
+        bool Start(frame_cb cb) override;
+        void Stop() override;
+        bool Finished() const override { return finished; }
+        uint32_t Fps() const override { return config.fps; }
+        std::string Name() const override { return config.path; }
+        void ReportStats() const override;
+
+        // continue the replay at this frame of the recording, from any thread once opened. decoding restarts
+        // at the nearest preceding keyframe, the reference frames in between are sent unpaced as preroll
+        bool Seek(uint64_t frame);
+        // seeks to the first frame at or after this device timestamp, relative to the first frame
+        bool SeekToTimestamp(uint64_t device_timestamp_us);
+
+        const RecordingIndex &Index() const { return recordingIndex; }
+
+    private:
+        bool LoadAccessUnits();
+        bool OpenStreamed();
+        uint64_t FrameCount() const;
+        // payload of one frame of the recording with decoder padding, nullptr on a read error
+        std::shared_ptr<std::vector<uint8_t>> ReadFrame(uint64_t frame);
+        // arrival records matched to the access units of the index by byte range, instead of by position
+        void AlignArrivals();
+        // offset of a frame from the replay start, before impairments
+        int64_t ScheduledUs(uint64_t index) const;
+
+        ReplaySourceConfig config;
+        StreamInfo info;
+        std::vector<std::shared_ptr<std::vector<uint8_t>>> accessUnits;
+        RecordingIndex recordingIndex;
+        // frames are read from here through the index instead of being preloaded
+        bool streamed{false};
+        std::ifstream streamFile;
+        uint32_t width{0};
+        uint32_t height{0};
+        std::vector<ArrivalRecord> arrivals;
+        int64_t frameIntervalUs{40000};
+        // written by the replay thread, read after Stop()
+        std::unique_ptr<ArrivalImpairer> impairer;
+        std::vector<double> paceErrors;
+        uint64_t deliveredFrames{0};
+        uint64_t prerollFrames{0};
+        // from picking up a seek until its target frame was handed on, milliseconds
+        std::vector<double> seekLatencies;
+        // frame position requested by Seek(), -1 = none
+        std::atomic<int64_t> pendingSeek{-1};
+        std::atomic<bool> shouldStop{false};
+        std::mutex stopMutex;
+        std::condition_variable stopSignal;
+        std::atomic<bool> finished{false};
+        std::future<void> replayTask;
+    };
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_FRAMESOURCE_H
@@ -0,0 +1,133 @@
+#include "FrameSynchronizer.h"
+#include "Statistics.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace tcn {
+
+    FrameSynchronizer::FrameSynchronizer(std::string name, SyncConfig cfg, pair_cb cb)
+            : name(std::move(name)), config(cfg), pairCallback(std::move(cb)) {
+        config.bufferSize = std::max<std::size_t>(config.bufferSize, 1);
+        // like the pipeline's sample vectors, so matching does not reallocate in a normal run
+        matchLatencies.reserve(kReservedSamples);
+    }
+
+    void FrameSynchronizer::PushColor(std::shared_ptr<ob::FrameSet> frame_set, std::shared_ptr<ob::Frame> frame) {
+        uint64_t ts = frame->timeStampUs();
+        Push(color, Item{std::move(frame_set), std::move(frame), ts, std::chrono::steady_clock::now()});
+    }
+
+    void FrameSynchronizer::PushDepth(std::shared_ptr<ob::FrameSet> frame_set, std::shared_ptr<ob::Frame> frame) {
+        uint64_t ts = frame->timeStampUs();
+        Push(depth, Item{std::move(frame_set), std::move(frame), ts, std::chrono::steady_clock::now()});
+    }
+
+    void FrameSynchronizer::Push(Stream stream, Item item) {
+        std::vector<Pair> out;
+        {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            Stream other = stream == color ? depth : color;
+            ++(stream == color ? stats.colorFrames : stats.depthFrames);
+
+            // a timestamp jumping back means the device restarted its clock, nothing pending can match anymore
+            if (item.timestampUs + config.toleranceUs < newestUs[stream]) {
+                spdlog::warn("{0}: {1} timestamp went back, resetting frame sync", name, stream == color ? "color" : "depth");
+                for (auto s : {color, depth}) {
+                    while (!pending[s].empty()) {
+                        Release(s, std::move(pending[s].front()), out);
+                        pending[s].pop_front();
+                    }
+                    newestUs[s] = 0;
+                }
+            }
+            newestUs[stream] = std::max(newestUs[stream], item.timestampUs);
+
+            // later frames of this stream are newer still, so these can never be matched
+            while (!pending[other].empty() && pending[other].front().timestampUs + config.toleranceUs < item.timestampUs) {
+                Release(other, std::move(pending[other].front()), out);
+                pending[other].pop_front();
+            }
+
+            auto distance = [&](const Item &i) {
+                return i.timestampUs > item.timestampUs ? i.timestampUs - item.timestampUs : item.timestampUs - i.timestampUs;
+            };
+            auto best = std::min_element(pending[other].begin(), pending[other].end(), [&](const Item &a, const Item &b) {
+                return distance(a) < distance(b);
+            });
+            if (best != pending[other].end() && distance(*best) <= config.toleranceUs) {
+                // everything waiting ahead of the pair is older and lost its chance
+                for (auto it = pending[other].begin(); it != best; ++it) {
+                    Release(other, std::move(*it), out);
+                }
+                while (!pending[stream].empty()) {
+                    Release(stream, std::move(pending[stream].front()), out);
+                    pending[stream].pop_front();
+                }
+                Item partner = std::move(*best);
+                pending[other].erase(pending[other].begin(), best + 1);
+
+                matchLatencies.push_back(std::chrono::duration<double, std::milli>(item.arrivalTs - partner.arrivalTs).count());
+                ++stats.matched;
+                if (stream == color) {
+                    out.push_back(Pair{std::move(item), std::move(partner)});
+                } else {
+                    out.push_back(Pair{std::move(partner), std::move(item)});
+                }
+            } else {
+                pending[stream].push_back(std::move(item));
+                if (pending[stream].size() > config.bufferSize) {
+                    Release(stream, std::move(pending[stream].front()), out);
+                    pending[stream].pop_front();
+                }
+            }
+        }
+        Emit(out);
+    }
+
+    void FrameSynchronizer::Release(Stream stream, Item item, std::vector<Pair> &out) {
+        if (stream == color) {
+            if (config.emitLoneColor) {
+                ++stats.loneColor;
+                out.push_back(Pair{std::move(item), {}});
+            } else {
+                ++stats.droppedColor;
+            }
+        } else {
+            if (config.emitLoneDepth) {
+                ++stats.loneDepth;
+                out.push_back(Pair{{}, std::move(item)});
+            } else {
+                ++stats.droppedDepth;
+            }
+        }
+    }
+
+    void FrameSynchronizer::Emit(std::vector<Pair> &out) {
+        if (!pairCallback) {
+            return;
+        }
+        for (auto &p : out) {
+            pairCallback(std::move(p));
+        }
+    }
+
+    FrameSynchronizer::Stats FrameSynchronizer::GetStats() const {
+        std::scoped_lock<std::mutex> lk{mutex_};
+        return stats;
+    }
+
+    void FrameSynchronizer::Report() const {
+        std::scoped_lock<std::mutex> lk{mutex_};
+        auto rate = [](uint64_t n, uint64_t total) { return total > 0 ? 100. * double(n) / double(total) : 0.; };
+        spdlog::info("{0}: frame sync - color: {1} depth: {2} matched: {3} tolerance: {4}us",
+                     name, stats.colorFrames, stats.depthFrames, stats.matched, config.toleranceUs);
+        spdlog::info("{0}: frame sync - unmatched color: {1:.1f}% ({2} forwarded, {3} dropped) "
+                     "unmatched depth: {4:.1f}% ({5} forwarded, {6} dropped)",
+                     name, rate(stats.loneColor + stats.droppedColor, stats.colorFrames), stats.loneColor, stats.droppedColor,
+                     rate(stats.loneDepth + stats.droppedDepth, stats.depthFrames), stats.loneDepth, stats.droppedDepth);
+        report_stats(name + " sync_match_latency", matchLatencies);
+    }
+
+} // tcn
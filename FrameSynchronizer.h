@@ -0,0 +1,96 @@
+#ifndef ORBBEC_CAPTURE_TEST_FRAMESYNCHRONIZER_H
+#define ORBBEC_CAPTURE_TEST_FRAMESYNCHRONIZER_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "libobsensor/ObSensor.hpp"
+
+namespace tcn {
+
+    struct SyncConfig {
+        // largest device timestamp difference of a color / depth pair
+        uint64_t toleranceUs{20000};
+        // frames held per stream while waiting for a partner
+        std::size_t bufferSize{8};
+        // forward color frames whose depth partner never arrived
+        bool emitLoneColor{true};
+        bool emitLoneDepth{false};
+    };
+
+    /**
+     * Pairs color and depth frames that arrive independently by device timestamp.
+     * Replaces the SDK frame sync, which withholds or splits framesets under network jitter.
+     * Timestamps are expected to increase per stream; a frame older than the newest frame of the
+     * other stream minus the tolerance can no longer be matched and is released unmatched.
+     */
+    class FrameSynchronizer {
+    public:
+        struct Item {
+            // keeps the SDK memory of frame alive
+            std::shared_ptr<ob::FrameSet> frameSet;
+            std::shared_ptr<ob::Frame> frame;
+            uint64_t timestampUs{0};
+            std::chrono::steady_clock::time_point arrivalTs;
+        };
+
+        // either side may be empty for lone frames
+        struct Pair {
+            Item color;
+            Item depth;
+        };
+
+        struct Stats {
+            uint64_t colorFrames{0};
+            uint64_t depthFrames{0};
+            uint64_t matched{0};
+            uint64_t loneColor{0};
+            uint64_t loneDepth{0};
+            uint64_t droppedColor{0};
+            uint64_t droppedDepth{0};
+        };
+
+        typedef std::function<void(Pair pair)> pair_cb;
+
+        FrameSynchronizer(std::string name, SyncConfig cfg, pair_cb cb);
+
+        void PushColor(std::shared_ptr<ob::FrameSet> frame_set, std::shared_ptr<ob::Frame> frame);
+        void PushDepth(std::shared_ptr<ob::FrameSet> frame_set, std::shared_ptr<ob::Frame> frame);
+
+        Stats GetStats() const;
+        void Report() const;
+
+    private:
+        enum Stream {
+            color = 0,
+            depth = 1
+        };
+
+        void Push(Stream stream, Item item);
+
+        // expects mutex_ to be held, appends released frames to out
+        void Release(Stream stream, Item item, std::vector<Pair> &out);
+
+        void Emit(std::vector<Pair> &out);
+
+        std::string name;
+        SyncConfig config;
+        pair_cb pairCallback;
+
+        mutable std::mutex mutex_;
+        std::deque<Item> pending[2];
+        uint64_t newestUs[2]{0, 0};
+        Stats stats;
+        // host time the first frame of a pair waited for its partner
+        std::vector<double> matchLatencies;
+    };
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_FRAMESYNCHRONIZER_H
@@ -0,0 +1,71 @@
+#include "H26xBitstream.h"
+
+namespace tcn::vpf {
+
+    namespace {
+        size_t next_start_code(const uint8_t *data, size_t size, size_t from) {
+            for (size_t k = from; k + 3 <= size; ++k) {
+                if (data[k] == 0 && data[k + 1] == 0 && data[k + 2] == 1) {
+                    return k;
+                }
+            }
+            return size;
+        }
+    }
+
+    bool is_h26x_format(OBFormat format) {
+        return format == OB_FORMAT_H264 || format == OB_FORMAT_H265 || format == OB_FORMAT_HEVC;
+    }
+
+    void for_each_nal(const uint8_t *data, size_t size, const std::function<void(const uint8_t *, size_t)> &cb) {
+        size_t i = next_start_code(data, size, 0);
+        while (i < size) {
+            size_t payload = i + 3;
+            size_t end = next_start_code(data, size, payload);
+            // a 4 byte start code leaves a trailing zero on the previous unit
+            size_t unit_end = (end < size && end > payload && data[end - 1] == 0) ? end - 1 : end;
+            if (payload < unit_end) {
+                cb(data + payload, unit_end - payload);
+            }
+            i = end;
+        }
+    }
+
+    AccessUnitInfo inspect_access_unit(OBFormat format, const uint8_t *data, size_t size) {
+        AccessUnitInfo info;
+        bool hevc = format == OB_FORMAT_H265 || format == OB_FORMAT_HEVC;
+        for_each_nal(data, size, [&](const uint8_t *nal, size_t) {
+            if (hevc) {
+                int type = (nal[0] >> 1) & 0x3f;
+                if (type <= 31) {
+                    // VCL: even types below 16 are sub-layer non-reference pictures (TRAIL_N, RASL_N, ...)
+                    ++info.sliceCount;
+                    if (type >= 16 && type <= 23) {
+                        info.keyframe = true;
+                    }
+                    if (type >= 16 || type % 2 == 1) {
+                        info.reference = true;
+                    }
+                } else if (type >= 32 && type <= 34) {
+                    info.hasParameterSets = true;
+                }
+            } else {
+                int type = nal[0] & 0x1f;
+                int ref_idc = (nal[0] >> 5) & 0x3;
+                if (type == 1 || type == 5) {
+                    ++info.sliceCount;
+                    if (type == 5) {
+                        info.keyframe = true;
+                    }
+                    if (ref_idc != 0) {
+                        info.reference = true;
+                    }
+                } else if (type == 7 || type == 8) {
+                    info.hasParameterSets = true;
+                }
+            }
+        });
+        return info;
+    }
+
+} // tcn::vpf
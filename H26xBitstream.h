@@ -0,0 +1,33 @@
+#ifndef ORBBEC_CAPTURE_TEST_H26XBITSTREAM_H
+#define ORBBEC_CAPTURE_TEST_H26XBITSTREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include <libobsensor/h/ObTypes.h>
+
+namespace tcn::vpf {
+
+    /**
+     * What an Annex-B access unit means for decoding, derived from its NAL unit headers only.
+     */
+    struct AccessUnitInfo {
+        // IDR (H.264) or IRAP (H.265) picture: decoding can restart here
+        bool keyframe{false};
+        // other pictures may reference this one, dropping it corrupts the rest of the GOP
+        bool reference{false};
+        bool hasParameterSets{false};
+        int sliceCount{0};
+    };
+
+    bool is_h26x_format(OBFormat format);
+
+    // calls cb(nal_payload, nal_size) for every NAL unit, payload starts at the NAL header
+    void for_each_nal(const uint8_t *data, size_t size, const std::function<void(const uint8_t *, size_t)> &cb);
+
+    AccessUnitInfo inspect_access_unit(OBFormat format, const uint8_t *data, size_t size);
+
+} // tcn::vpf
+
+#endif //ORBBEC_CAPTURE_TEST_H26XBITSTREAM_H
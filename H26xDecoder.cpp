@@ -1,12 +1,36 @@
 #include "H26xDecoder.h"
+#include "H26xBitstream.h"
 #include <spdlog/spdlog.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavutil/pixdesc.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <exception>
 #include <utility>
 
 namespace tcn {
     namespace vpf {
 
+        // free callback of zero-copy packets, drops the reference to the memory owner (e.g. an ob::FrameSet)
+        static void release_packet_owner(void *opaque, uint8_t *) {
+            delete static_cast<std::shared_ptr<const void> *>(opaque);
+        }
+
+        // the output image belongs to the application, it is the one allocation per frame
+        static cv::Mat allocate_output_image(int rows, int cols) {
+            AllocationIgnoreScope output_allocation;
+            return cv::Mat(rows, cols, CV_8UC3);
+        }
 
         static enum AVPixelFormat get_hw_format(AVCodecContext *ctx,
                                                 const enum AVPixelFormat *pix_fmts) {
@@ -25,7 +49,16 @@ namespace tcn {
                     return *p;
                 }
             }
-            spdlog::error("Failed to select NV12 output format.");
+            // e.g. the mjpeg decoder offers only its native YUVJ422P / YUVJ420P next to the hw formats,
+            // swscale converts it to NV12 like any other software format
+            for (p = pix_fmts; *p != -1; p++) {
+                const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(*p);
+                if (desc != nullptr && !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+                    spdlog::info("Decoder: selected output format: {0}", av_get_pix_fmt_name(*p));
+                    return *p;
+                }
+            }
+            spdlog::error("Failed to select a software output format.");
             return AV_PIX_FMT_NONE;
         }
 
@@ -36,23 +69,23 @@ namespace tcn {
 
         void H26xDecoder::DecoderTeardown() {
 
-            // drain the codec parser
-            if (cctx) {
-                if (avcodec_send_packet(cctx, NULL))
-                {
-                    spdlog::error("avcodec_send_packet fail");
-                }
-                while (true) {
-                    if (avcodec_receive_frame(cctx, frame) == AVERROR_EOF) {
-                        break;
-                    }
-                }
-            }
-
             if (cctx != nullptr) {
+                allocationCheck.Report();
                 avcodec_free_context(&cctx);
             }
 
+            if (pCodecParserCtx != nullptr) {
+                av_parser_close(pCodecParserCtx);
+                pCodecParserCtx = nullptr;
+            }
+
+            // packets still holding pool buffers keep the pool alive until they are released
+            av_buffer_pool_uninit(&packetPool);
+            packetPoolSize = 0;
+
+            FreeConversion();
+            tensorConverter.reset();
+
             if (avpkt != nullptr) {
                 av_packet_free(&avpkt);
             }
@@ -71,11 +104,154 @@ namespace tcn {
 
         }
 
+        uint64_t H26xDecoder::AttachMeta(const FrameMeta *meta)
+        {
+            if (meta == nullptr || discardOutput) {
+                return 0;
+            }
+            const uint64_t key = nextMetaKey++;
+            auto &slot = metaSlots[key % kMetaSlots];
+            slot.key = key;
+            slot.meta = *meta;
+            slot.meta.valid = true;
+            return key;
+        }
+
+        FrameMeta H26xDecoder::TakeMeta(const AVFrame *decoded)
+        {
+            const auto key = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(decoded->opaque));
+            auto &slot = metaSlots[key % kMetaSlots];
+            if (key == 0 || slot.key != key) {
+                return FrameMeta{};
+            }
+            slot.key = 0;
+            return std::move(slot.meta);
+        }
+
+        void H26xDecoder::ReleaseMeta(uint64_t key)
+        {
+            auto &slot = metaSlots[key % kMetaSlots];
+            if (key != 0 && slot.key == key) {
+                // releases the depth frame attached
+                slot = MetaSlot{};
+            }
+        }
+
+        void H26xDecoder::ClearMeta()
+        {
+            for (auto &slot : metaSlots) {
+                // releases the depth frames still attached
+                slot = MetaSlot{};
+            }
+        }
+
+        int H26xDecoder::Flush(std::chrono::steady_clock::time_point deadline)
+        {
+            if (!cctx) {
+                ClearMeta();
+                return 0;
+            }
+            int ret = avcodec_send_packet(cctx, nullptr);
+            if (ret < 0 && ret != AVERROR_EOF) {
+                char err[AV_ERROR_MAX_STRING_SIZE]{};
+                av_strerror(ret, err, sizeof(err));
+                spdlog::warn("flush: avcodec_send_packet failed: {0}", err);
+                avcodec_flush_buffers(cctx);
+                ClearMeta();
+                return 0;
+            }
+            int delivered{0};
+            int dropped{0};
+            // a hardware error while handling a frame can reopen (or free) the context, its output is gone
+            const uint64_t reopens = recoveryStats.reopens;
+            while (true) {
+                ret = avcodec_receive_frame(cctx, frame);
+                // draining never asks for more input, EAGAIN would only spin
+                if (ret == AVERROR_EOF || ret == AVERROR(EAGAIN)) {
+                    break;
+                }
+                if (ret < 0) {
+                    char err[AV_ERROR_MAX_STRING_SIZE]{};
+                    av_strerror(ret, err, sizeof(err));
+                    spdlog::warn("flush: avcodec_receive_frame failed: {0}", err);
+                    break;
+                }
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    av_frame_unref(frame);
+                    ++dropped;
+                    break;
+                }
+                if (recoveryState != RecoveryState::decoding) {
+                    av_frame_unref(frame);
+                    continue;
+                }
+                const bool handled = HandleDecodedFrame(frame);
+                av_frame_unref(frame);
+                if (!handled || cctx == nullptr || recoveryStats.reopens != reopens) {
+                    break;
+                }
+                ++delivered;
+            }
+            if (dropped > 0) {
+                spdlog::warn("flush: deadline reached, dropping the frames left in the codec");
+            }
+            // leaves draining mode, anything not received yet goes with it
+            if (cctx) {
+                avcodec_flush_buffers(cctx);
+            }
+            ClearMeta();
+            return delivered;
+        }
+
+        void H26xDecoder::SetDecodeShortcuts(AVDiscard loop_filter, AVDiscard idct, AVDiscard frames, int downscale) {
+            skipLoopFilter = loop_filter;
+            skipIdct = idct;
+            skipFrame = frames;
+            if (cctx) {
+                // read by the h264/hevc decoders per frame, safe to change between packets
+                cctx->skip_loop_filter = loop_filter;
+                cctx->skip_idct = idct;
+                cctx->skip_frame = frames;
+            }
+            outputDownscale = std::max(1, downscale);
+        }
+
+        int H26xDecoder::OutputDimension(int full) const {
+            // NV12 needs even dimensions
+            return (full / outputDownscale) & ~1;
+        }
+
+        int H26xDecoder::Resync(std::chrono::steady_clock::time_point deadline) {
+            return Flush(deadline);
+        }
+
+        bool H26xDecoder::Supports(OBFormat stream_format)
+        {
+            return is_h26x_format(stream_format) || stream_format == OB_FORMAT_MJPG || IsRawFormat(stream_format);
+        }
+
+        bool H26xDecoder::IsRawFormat(OBFormat stream_format)
+        {
+            return stream_format == OB_FORMAT_YUYV || stream_format == OB_FORMAT_YUY2;
+        }
+
         bool H26xDecoder::DecoderInit(AVHWDeviceType device_type, OBFormat stream_format, OBFormat output_format)
         {
             inputFormat = stream_format;
             outputFormat = output_format;
 
+            if (IsRawFormat(stream_format)) {
+                // no codec, the frame only wraps the capture buffer for the conversion
+                deviceType = AV_HWDEVICE_TYPE_NONE;
+                frame = av_frame_alloc();
+                if (!frame) {
+                    spdlog::error("Could not allocate video frame.");
+                    return false;
+                }
+                spdlog::info("Decoder: selected raw yuyv conversion.");
+                return true;
+            }
+
             avpkt = av_packet_alloc();
             if (!avpkt) {
                 spdlog::error("Could not allocate packet");
@@ -90,6 +266,9 @@ namespace tcn {
                 case OB_FORMAT_HEVC:
                     codec = avcodec_find_decoder(AV_CODEC_ID_H265);
                     break;
+                case OB_FORMAT_MJPG:
+                    codec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+                    break;
                 default:
                     spdlog::error("Unhandled input stream format: {0}", static_cast<int>(stream_format));
                     return false;
@@ -103,10 +282,17 @@ namespace tcn {
             if (device_type != AV_HWDEVICE_TYPE_NONE) {
                 for (int i = 0;; i++) {
                     const AVCodecHWConfig *config = avcodec_get_hw_config(codec, i);
+                    if (!config && !is_h26x_format(stream_format)) {
+                        // intra-only JPEG decodes fast enough on the cpu, the device is optional there
+                        spdlog::warn("Decoder {0} does not support device type {1}, decoding in software.",
+                                     codec->name, av_hwdevice_get_type_name(device_type));
+                        device_type = AV_HWDEVICE_TYPE_NONE;
+                        break;
+                    }
                     if (!config) {
                         spdlog::error("Decoder {0} does not support device type {1}.",
                                       codec->name, av_hwdevice_get_type_name(device_type));
-                        throw std::runtime_error("Error");
+                        return false;
                     }
                     if (config->methods&AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX &&
                         config->device_type == device_type) {
@@ -116,12 +302,6 @@ namespace tcn {
                 }
             }
 
-            cctx = avcodec_alloc_context3(codec);
-            if (!cctx) {
-                spdlog::error("Could not allocate video codec context.");
-                return false;
-            }
-
             // how to determine the potential output formats of the selected decoder?
             if (device_type == AV_HWDEVICE_TYPE_CUDA) {
                 hwOutputFormat = AV_PIX_FMT_CUDA;
@@ -135,32 +315,28 @@ namespace tcn {
             } else {
                 spdlog::info("Decoder: selected software decoder.");
             }
-            cctx->get_format = get_hw_format;
+            deviceType = device_type;
 
             if (device_type != AV_HWDEVICE_TYPE_NONE) {
-                if (av_hwdevice_ctx_create(&hw_device_ctx, device_type,
+                if (sharedDeviceCtx != nullptr) {
+                    hw_device_ctx = av_buffer_ref(sharedDeviceCtx);
+                } else if (av_hwdevice_ctx_create(&hw_device_ctx, device_type,
                                                   NULL, NULL, 0) < 0) {
                     spdlog::error("Failed to create specified HW device.");
                     return false;
                 }
-                cctx->hw_device_ctx = av_buffer_ref(hw_device_ctx);
             }
 
-            pCodecParserCtx = av_parser_init(cctx->codec_id); //初始化 AVCodecParserContext
+            pCodecParserCtx = av_parser_init(codec->id); //初始化 AVCodecParserContext
             if (!pCodecParserCtx) {
                 spdlog::error("Could not allocate video parser context.");
                 return false;
             }
 
-            if (avcodec_open2(cctx, codec, nullptr) < 0) {
-                spdlog::error("Could not open codec.");
+            if (!OpenCodec()) {
                 return false;
             }
 
-            if (cctx->hwaccel != nullptr) {
-                assert(hwOutputFormat == cctx->hwaccel->pix_fmt);
-            }
-
             frame = av_frame_alloc();
             if (!frame) {
                 spdlog::error("Could not allocate video frame.");
@@ -176,127 +352,573 @@ namespace tcn {
             return true;
         }
 
-        bool H26xDecoder::DecodeOnePacket(int cur_size, uint8_t *cur_ptr)
+        bool H26xDecoder::OpenCodec()
+        {
+            cctx = avcodec_alloc_context3(codec);
+            if (!cctx) {
+                spdlog::error("Could not allocate video codec context.");
+                return false;
+            }
+            cctx->get_format = get_hw_format;
+            // packet opaque values reach the decoded frames, they carry the FrameMeta keys
+            cctx->flags |= AV_CODEC_FLAG_COPY_OPAQUE;
+            if (deviceType == AV_HWDEVICE_TYPE_NONE) {
+                // several pipelines share the host, so the caller budgets codec threads per stream
+                cctx->thread_count = threadCount;
+                cctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+            } else {
+                cctx->hw_device_ctx = av_buffer_ref(hw_device_ctx);
+            }
+
+            if (!primeParameterSets.empty()) {
+                // in-band Annex-B parameter sets are accepted as extradata by the h264/hevc decoders
+                cctx->extradata = static_cast<uint8_t *>(av_mallocz(primeParameterSets.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+                if (cctx->extradata) {
+                    memcpy(cctx->extradata, primeParameterSets.data(), primeParameterSets.size());
+                    cctx->extradata_size = static_cast<int>(primeParameterSets.size());
+                }
+            }
+            cctx->skip_loop_filter = skipLoopFilter;
+            cctx->skip_idct = skipIdct;
+            cctx->skip_frame = skipFrame;
+
+            // codec threads started here are counted with this decoder
+            AllocationGroupScope codec_threads{allocationCheck};
+            if (avcodec_open2(cctx, codec, nullptr) < 0) {
+                spdlog::error("Could not open codec.");
+                return false;
+            }
+
+            if (cctx->hwaccel != nullptr) {
+                assert(hwOutputFormat == cctx->hwaccel->pix_fmt);
+            }
+            return true;
+        }
+
+        bool H26xDecoder::DecoderInit(AVHWDeviceType device_type, OBFormat stream_format, OBFormat output_format,
+                                      int stream_width, int stream_height, const std::vector<uint8_t> &parameter_sets)
+        {
+            primeParameterSets = parameter_sets;
+            if (!DecoderInit(device_type, stream_format, output_format)) {
+                return false;
+            }
+            if (stream_width <= 0 || stream_height <= 0) {
+                return true;
+            }
+
+            // hw frames are transferred as NV12, the software decoders output planar 4:2:0, camera JPEGs are 4:2:2
+            AVPixelFormat predicted = deviceType != AV_HWDEVICE_TYPE_NONE ? AV_PIX_FMT_NV12
+                                      : IsRawFormat(stream_format) ? AV_PIX_FMT_YUYV422
+                                      : stream_format == OB_FORMAT_MJPG ? AV_PIX_FMT_YUVJ422P : AV_PIX_FMT_YUV420P;
+            if (deviceType != AV_HWDEVICE_TYPE_NONE) {
+                sw_frame->format = AV_PIX_FMT_NV12;
+                sw_frame->width = stream_width;
+                sw_frame->height = stream_height;
+                if (av_frame_get_buffer(sw_frame, 0) < 0) {
+                    spdlog::error("Could not preallocate transfer frame.");
+                    return false;
+                }
+            }
+            // a wrong prediction is handled like any other format change on the first frame
+            if (!InitConversion(stream_width, stream_height, predicted)) {
+                return false;
+            }
+            formatChanges = 0;
+            spdlog::info("Decoder: prepared {0}x{1} {2}, {3} bytes of parameter sets",
+                         stream_width, stream_height, av_get_pix_fmt_name(predicted), parameter_sets.size());
+            return true;
+        }
+
+        std::vector<uint8_t> H26xDecoder::ExtractParameterSets(OBFormat stream_format, const uint8_t *data, size_t size)
+        {
+            std::vector<uint8_t> sets;
+            if (!is_h26x_format(stream_format)) {
+                return sets;
+            }
+            bool hevc = stream_format == OB_FORMAT_H265 || stream_format == OB_FORMAT_HEVC;
+            for_each_nal(data, size, [&](const uint8_t *nal, size_t nal_size) {
+                int type = hevc ? (nal[0] >> 1) & 0x3f : nal[0] & 0x1f;
+                bool is_parameter_set = hevc ? (type >= 32 && type <= 34) : (type == 7 || type == 8);
+                if (is_parameter_set) {
+                    static const uint8_t start_code[] = {0, 0, 0, 1};
+                    sets.insert(sets.end(), start_code, start_code + 4);
+                    sets.insert(sets.end(), nal, nal + nal_size);
+                }
+            });
+            return sets;
+        }
+
+        bool H26xDecoder::DecodeOnePacket(int cur_size, uint8_t *cur_ptr, const FrameMeta *meta)
         {
+            if (cctx == nullptr && !OpenCodec()) {
+                // a reopen after an error failed, try again with the next packet
+                avcodec_free_context(&cctx);
+                return false;
+            }
 
+            // the parser reports the pts of the input an access unit started in, it stands in for the meta key
+            const uint64_t key = AttachMeta(meta);
+            const int64_t input_pts = key != 0 ? static_cast<int64_t>(key) : AV_NOPTS_VALUE;
             bool decodedImage{false};
+            bool ok{true};
             while (cur_size > 0)
             {
-                unsigned char *buf = nullptr;
                 int len = av_parser_parse2(
                         pCodecParserCtx, cctx,
                         &(avpkt->data), &(avpkt->size),
                         cur_ptr, cur_size,
-                        AV_NOPTS_VALUE, AV_NOPTS_VALUE, AV_NOPTS_VALUE);
+                        input_pts, AV_NOPTS_VALUE, AV_NOPTS_VALUE);
+                if (len < 0) {
+                    EnterRecovery(DecodeError::corruptData, "av_parser_parse2", len);
+                    return false;
+                }
 
-                // some checks ??
                 cur_ptr += len;
                 cur_size -= len;
-                if (avpkt->size)
-                {
-                    if (avcodec_send_packet(cctx, avpkt))
-                    {
-                        spdlog::error("avcodec_send_packet fail");
-                        return false;
-                    }
-                    if (avcodec_receive_frame(cctx, frame))
+                // the rest of the input is still parsed after a failed packet, the parser keeps state across calls
+                if (avpkt->size && discardOutput) {
+                    avpkt->flags |= AV_PKT_FLAG_DISCARD;
+                }
+                const uint64_t packet_key = pCodecParserCtx->pts != AV_NOPTS_VALUE ?
+                                            static_cast<uint64_t>(pCodecParserCtx->pts) : 0;
+                if (avpkt->size) {
+                    avpkt->opaque = reinterpret_cast<void *>(static_cast<uintptr_t>(packet_key));
+                }
+                if (avpkt->size && !AdmitPacket(avpkt->data, static_cast<size_t>(avpkt->size))) {
+                    ReleaseMeta(packet_key);
+                } else if (avpkt->size && !SendPacket(decodedImage)) {
+                    ok = false;
+                }
+            }
+            if (!decodedImage) {
+                // expected for the first frames when frame threading delays output
+                spdlog::debug("no image decoded...");
+            }
+            return ok;
+        }
+
+        bool H26xDecoder::DecodeAccessUnit(const uint8_t *data, int size, std::shared_ptr<const void> owner, bool padded,
+                                           const FrameMeta *meta)
+        {
+            if (size <= 0) {
+                return true;
+            }
+            if (cctx == nullptr && !OpenCodec()) {
+                avcodec_free_context(&cctx);
+                return false;
+            }
+            if (!AdmitPacket(data, static_cast<size_t>(size))) {
+                return true;
+            }
+            if (padded && owner) {
+                auto *holder = new std::shared_ptr<const void>(std::move(owner));
+                avpkt->buf = av_buffer_create(const_cast<uint8_t *>(data), static_cast<size_t>(size),
+                                              release_packet_owner, holder, AV_BUFFER_FLAG_READONLY);
+                if (!avpkt->buf) {
+                    delete holder;
+                    spdlog::error("av_buffer_create fail");
+                    return false;
+                }
+                avpkt->data = const_cast<uint8_t *>(data);
+                avpkt->size = size;
+            } else {
+                // the bitstream readers may read past the end, unpadded input needs one copy
+                size_t needed = static_cast<size_t>(size) + AV_INPUT_BUFFER_PADDING_SIZE;
+                if (needed > packetPoolSize) {
+                    // grow with headroom, so a few larger keyframes do not recreate the pool each time
+                    av_buffer_pool_uninit(&packetPool);
+                    packetPoolSize = needed + needed / 2;
+                    packetPool = av_buffer_pool_init(packetPoolSize, av_buffer_alloc);
+                }
+                avpkt->buf = packetPool ? av_buffer_pool_get(packetPool) : nullptr;
+                if (!avpkt->buf) {
+                    spdlog::error("av_buffer_pool_get fail");
+                    return false;
+                }
+                avpkt->data = avpkt->buf->data;
+                avpkt->size = size;
+                std::memcpy(avpkt->data, data, static_cast<size_t>(size));
+                std::memset(avpkt->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+            }
+            if (discardOutput) {
+                avpkt->flags |= AV_PKT_FLAG_DISCARD;
+            }
+            avpkt->opaque = reinterpret_cast<void *>(static_cast<uintptr_t>(AttachMeta(meta)));
+
+            bool decodedImage{false};
+            if (!SendPacket(decodedImage)) {
+                return false;
+            }
+            if (!decodedImage) {
+                spdlog::debug("no image decoded...");
+            }
+            return true;
+        }
+
+        bool H26xDecoder::DecodeRawFrame(const uint8_t *data, int size, int frame_width, int frame_height,
+                                         const FrameMeta *meta)
+        {
+            if (!IsRawFormat(inputFormat) || frame == nullptr) {
+                spdlog::error("Decoder: raw frames need a decoder initialized for yuyv");
+                return false;
+            }
+            const int row_bytes = frame_width * 2;
+            if (frame_width <= 0 || frame_height <= 0 || (frame_width & 1) ||
+                static_cast<int64_t>(size) < static_cast<int64_t>(row_bytes) * frame_height) {
+                spdlog::error("Decoder: {0} bytes do not hold a {1}x{2} yuyv frame", size, frame_width, frame_height);
+                return false;
+            }
+            // borrowed for the call, the conversion reads the capture buffer directly
+            frame->format = AV_PIX_FMT_YUYV422;
+            frame->width = frame_width;
+            frame->height = frame_height;
+            frame->data[0] = const_cast<uint8_t *>(data);
+            frame->linesize[0] = row_bytes;
+            frame->opaque = reinterpret_cast<void *>(static_cast<uintptr_t>(AttachMeta(meta)));
+            frame->flags = discardOutput ? AV_FRAME_FLAG_DISCARD : 0;
+            bool ok = HandleDecodedFrame(frame);
+            frame->data[0] = nullptr;
+            frame->linesize[0] = 0;
+            frame->opaque = nullptr;
+            return ok;
+        }
+
+        bool H26xDecoder::SendPacket(bool &decodedImage)
+        {
+            if (skipFrame >= AVDISCARD_NONREF && is_h26x_format(inputFormat) && !(avpkt->flags & AV_PKT_FLAG_DISCARD) &&
+                !inspect_access_unit(inputFormat, avpkt->data, static_cast<size_t>(avpkt->size)).reference) {
+                // the codec drops it without output, a policy drop rather than a decode loss. its meta goes now
+                ++skippedFrames;
+                ReleaseMeta(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(avpkt->opaque)));
+            }
+            int ret = avcodec_send_packet(cctx, avpkt);
+            bool drained{true};
+            if (ret == AVERROR(EAGAIN)) {
+                // output is pending, collect it and retry once
+                drained = ReceiveFrames(decodedImage);
+                if (drained) {
+                    ret = avcodec_send_packet(cctx, avpkt);
+                }
+            }
+            // the codec holds its own reference for as long as it needs the bitstream
+            av_packet_unref(avpkt);
+            if (!drained) {
+                return false;
+            }
+            if (ret < 0) {
+                EnterRecovery(ClassifyError(ret), "avcodec_send_packet", ret);
+                return false;
+            }
+            return ReceiveFrames(decodedImage);
+        }
+
+        bool H26xDecoder::ReceiveFrames(bool &decodedImage)
+        {
+            // with frame threading a packet may yield zero or several frames
+            while (true) {
+                int ret = avcodec_receive_frame(cctx, frame);
+                if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+                    return true;
+                }
+                if (ret < 0) {
+                    EnterRecovery(ClassifyError(ret), "avcodec_receive_frame", ret);
+                    return false;
+                }
+                bool handled = HandleDecodedFrame(frame);
+                av_frame_unref(frame);
+                if (!handled) {
+                    return false;
+                }
+                decodedImage = true;
+            }
+        }
+
+        H26xDecoder::DecodeError H26xDecoder::ClassifyError(int averror)
+        {
+            if (averror == AVERROR(ENOMEM) || averror == AVERROR(EINVAL)) {
+                return DecodeError::fatal;
+            }
+            if (averror == AVERROR_EXTERNAL || averror == AVERROR(EIO)) {
+                return DecodeError::hardware;
+            }
+            return DecodeError::corruptData;
+        }
+
+        void H26xDecoder::EnterRecovery(DecodeError error, const char *where, int averror)
+        {
+            char message[AV_ERROR_MAX_STRING_SIZE]{};
+            av_strerror(averror, message, sizeof(message));
+            ++recoveryStats.errors;
+            if (!recoveryPending) {
+                recoveryPending = true;
+                recoveryStartTs = std::chrono::steady_clock::now();
+                ++recoveryStats.recoveries;
+                spdlog::warn("Decoder: {0} failed ({1}), discarding input until the next keyframe", where, message);
+            } else {
+                spdlog::debug("Decoder: {0} failed ({1}) while recovering", where, message);
+            }
+
+            // a hardware error that survives a flush, or a broken context, needs a fresh codec context
+            bool reopen = error == DecodeError::fatal ||
+                          (error == DecodeError::hardware && ++hardwareErrorsInRecovery > 1);
+            if (reopen) {
+                ++recoveryStats.reopens;
+                avcodec_free_context(&cctx);
+                if (!OpenCodec()) {
+                    spdlog::error("Decoder: reopening the codec failed");
+                    avcodec_free_context(&cctx);
+                }
+            } else if (cctx != nullptr) {
+                avcodec_flush_buffers(cctx);
+            }
+            ClearMeta();
+            if (error == DecodeError::hardware) {
+                av_frame_unref(sw_frame);
+            }
+            recoveryState = RecoveryState::awaitingKeyframe;
+            discardedInRecovery = 0;
+        }
+
+        bool H26xDecoder::AdmitPacket(const uint8_t *data, size_t size)
+        {
+            if (recoveryState == RecoveryState::decoding) {
+                return true;
+            }
+            if (!is_h26x_format(inputFormat)) {
+                // every JPEG stands on its own, the next one decodes cleanly
+                recoveryState = RecoveryState::decoding;
+                return true;
+            }
+            auto au = inspect_access_unit(inputFormat, data, size);
+            if (au.keyframe || au.hasParameterSets) {
+                recoveryState = RecoveryState::decoding;
+                spdlog::info("Decoder: resuming at {0} after {1} discarded packets",
+                             au.keyframe ? "keyframe" : "parameter sets", discardedInRecovery);
+                return true;
+            }
+            if (discardedInRecovery >= recoveryTimeoutPackets) {
+                // e.g. intra refresh streams without IDR pictures, the codec conceals until it catches up
+                recoveryState = RecoveryState::decoding;
+                spdlog::warn("Decoder: no keyframe within {0} packets, resuming anyway", discardedInRecovery);
+                return true;
+            }
+            ++discardedInRecovery;
+            ++recoveryStats.discardedPackets;
+            return false;
+        }
+
+        bool H26xDecoder::HandleDecodedFrame(AVFrame *decoded)
+        {
+            AVFrame *tmp_frame{nullptr};
+            // also for frames that are not delivered, so their slot lets go of the depth frame
+            const FrameMeta meta = TakeMeta(decoded);
+
+            const bool corrupt = (decoded->flags & AV_FRAME_FLAG_CORRUPT) || decoded->decode_error_flags;
+            if (corrupt) {
+                ++recoveryStats.corruptedFrames;
+                if (Recovering()) {
+                    return true;
+                }
+                if (++consecutiveCorrupt >= corruptFramesToRecover) {
+                    // the damage keeps propagating, hold output back until the next keyframe
+                    consecutiveCorrupt = 0;
+                    EnterRecovery(DecodeError::corruptData, "decoded frame", AVERROR_INVALIDDATA);
+                    return true;
+                }
+                // a single concealed picture after lost data is still usable
+                ++recoveryStats.concealedFrames;
+            } else {
+                consecutiveCorrupt = 0;
+            }
+            if (decoded->flags & AV_FRAME_FLAG_DISCARD) {
+                // preroll picture, libavcodec normally withholds these already
+                return true;
+            }
+
+            if (cctx != nullptr && cctx->hw_device_ctx != nullptr && (decoded->format == AV_PIX_FMT_CUDA ||
+                    decoded->format == AV_PIX_FMT_VIDEOTOOLBOX)) { // potentially other hw-accelerated formats here..
+                /* retrieve data from GPU to CPU */
+                if (sw_frame->buf[0] != nullptr && (sw_frame->width != decoded->width || sw_frame->height != decoded->height)) {
+                    // transfer buffers are sized for the previous geometry
+                    av_frame_unref(sw_frame);
+                }
+                // sw_frame keeps its buffers between frames, so the transfer reuses them
+                int ret = av_hwframe_transfer_data(sw_frame, decoded, 0);
+                if (ret < 0) {
+                    spdlog::error("Error transferring the data to system memory");
+                    EnterRecovery(DecodeError::hardware, "av_hwframe_transfer_data", ret);
+                    return false;
+                }
+                tmp_frame = sw_frame;
+            } else {
+                tmp_frame = decoded;
+            }
+
+            bool stream_changed = tmp_frame->format != decoderOutputFormat ||
+                                  tmp_frame->width != width || tmp_frame->height != height;
+            if (!bIsInit || stream_changed ||
+                OutputDimension(tmp_frame->width) != outputWidth || OutputDimension(tmp_frame->height) != outputHeight)
+            {
+                if (bIsInit && stream_changed) {
+                    ++formatChanges;
+                    spdlog::info("Decoder: stream changed from {0}x{1} {2} to {3}x{4} {5}",
+                                 width, height, av_get_pix_fmt_name(decoderOutputFormat),
+                                 tmp_frame->width, tmp_frame->height,
+                                 av_get_pix_fmt_name(static_cast<AVPixelFormat>(tmp_frame->format)));
+                }
+                if (!InitConversion(tmp_frame->width, tmp_frame->height, static_cast<AVPixelFormat>(tmp_frame->format))) {
+                    return false;
+                }
+            }
+
+            if (tensorOutput) {
+                if (!tensorConverter) {
+                    tensorConverter = std::make_unique<TensorConverter>(tensor);
+                }
+                // 4:2:0 planes are read as decoded, anything else goes through swscale to NV12 first
+                const AVFrame *planes = tmp_frame;
+                if (!TensorConverter::Supports(tmp_frame->format) && imgCtx != nullptr) {
+                    sws_scale(imgCtx, tmp_frame->data, tmp_frame->linesize, 0, height,
+                              converted_frame->data, converted_frame->linesize);
+                    planes = converted_frame;
+                }
+                cv::Mat tensor_mat;
+                if (!tensorConverter->Convert(planes, tensor_mat)) {
+                    return false;
+                }
+                frameCallback(tensor_mat, meta);
+            } else {
+                cv::Mat bgr_mat;
+                if (tmp_frame->format == AV_PIX_FMT_YUYV422 && outputWidth == width && outputHeight == height) {
+                    // one vectorized pass over the capture buffer, no intermediate NV12 planes
+                    cv::Mat yuyv_mat = cv::Mat(tmp_frame->height, tmp_frame->width, CV_8UC2, tmp_frame->data[0], tmp_frame->linesize[0]);
+                    bgr_mat = allocate_output_image(yuyv_mat.rows, yuyv_mat.cols);
+                    cv::cvtColor(yuyv_mat, bgr_mat, cv::COLOR_YUV2BGR_YUYV);
+                } else if (imgCtx != nullptr) {
+                    sws_scale(imgCtx, tmp_frame->data, tmp_frame->linesize, 0, height,
+                              converted_frame->data, converted_frame->linesize);
+
+                    cv::Mat y_mat = cv::Mat(converted_frame->height, converted_frame->width, CV_8UC1, converted_frame->data[0], converted_frame->linesize[0]);
+                    cv::Mat uv_mat = cv::Mat(converted_frame->height / 2, converted_frame->width / 2, CV_8UC2, converted_frame->data[1], converted_frame->linesize[1]);
+                    bgr_mat = allocate_output_image(y_mat.rows, y_mat.cols);
+                    cv::cvtColorTwoPlane(y_mat, uv_mat, bgr_mat, cv::COLOR_YUV2BGR_NV12);
+                } else {
+                    cv::Mat y_mat = cv::Mat(tmp_frame->height, tmp_frame->width, CV_8UC1, tmp_frame->data[0], tmp_frame->linesize[0]);
+                    cv::Mat uv_mat = cv::Mat(tmp_frame->height / 2, tmp_frame->width / 2, CV_8UC2, tmp_frame->data[1], tmp_frame->linesize[1]);
+                    bgr_mat = allocate_output_image(y_mat.rows, y_mat.cols);
+                    cv::cvtColorTwoPlane(y_mat, uv_mat, bgr_mat, cv::COLOR_YUV2BGR_NV12);
+                }
+
+                frameCallback(bgr_mat, meta);
+            }
+
+            // a concealed frame does not end a recovery, the next clean one does
+            if (recoveryPending && !corrupt) {
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recoveryStartTs).count();
+                recoveryPending = false;
+                hardwareErrorsInRecovery = 0;
+                recoveryStats.lastRecoveryMs = ms;
+                recoveryStats.maxRecoveryMs = std::max(recoveryStats.maxRecoveryMs, ms);
+                recoveryStats.totalRecoveryMs += ms;
+                spdlog::info("Decoder: recovered after {0:.1f}ms", ms);
+            }
+            return true;
+        }
+
+        bool H26xDecoder::InitConversion(int frame_width, int frame_height, AVPixelFormat decoded_format)
+        {
+            width = frame_width;
+            height = frame_height;
+            decoderOutputFormat = decoded_format;
+            frameOutputFormat = AV_PIX_FMT_NV12;
+            outputFormat = OB_FORMAT_NV12;
+            bIsInit = false;
+
+            outputWidth = OutputDimension(width);
+            outputHeight = OutputDimension(height);
+
+            auto it = std::find_if(conversionCache.begin(), conversionCache.end(), [&](const Conversion &c) {
+                return c.width == width && c.height == height &&
+                       c.srcFormat == decoderOutputFormat && c.dstFormat == frameOutputFormat &&
+                       c.dstWidth == outputWidth && c.dstHeight == outputHeight;
+            });
+            if (it != conversionCache.end()) {
+                std::rotate(conversionCache.begin(), it, it + 1);
+            } else {
+                Conversion conversion;
+                conversion.width = width;
+                conversion.height = height;
+                conversion.srcFormat = decoderOutputFormat;
+                conversion.dstFormat = frameOutputFormat;
+                conversion.dstWidth = outputWidth;
+                conversion.dstHeight = outputHeight;
+
+                // NV12 at full size is consumed directly
+                if (decoderOutputFormat != frameOutputFormat || outputWidth != width || outputHeight != height) {
+                    // the reduced resolution level exists to save time, so it scales with a cheap filter
+                    int flags = outputWidth != width ? SWS_FAST_BILINEAR : SWS_BICUBIC;
+                    conversion.ctx = sws_getContext(width, height, decoderOutputFormat,
+                                                    outputWidth, outputHeight, frameOutputFormat,
+                                                    flags, nullptr, nullptr, nullptr);
+
+                    if (!conversion.ctx)
                     {
-                        spdlog::error("avcodec_receive_frame fail");
+                        spdlog::error("initialization of swscale context failed.");
                         return false;
                     }
-                    AVFrame *tmp_frame{nullptr};
-
-                    if (cctx->hw_device_ctx != nullptr && (cctx->pix_fmt == AV_PIX_FMT_CUDA ||
-                            cctx->pix_fmt == AV_PIX_FMT_VIDEOTOOLBOX)) { // potentially other hw-accelerated formats here..
-                        /* retrieve data from GPU to CPU */
-                        int ret{0};
-                        if (av_hwframe_transfer_data(sw_frame, frame, 0) < 0) {
-                            spdlog::error("Error transferring the data to system memory");
-                            av_frame_free(&sw_frame);
-                            return false;
-                        }
-                        tmp_frame = sw_frame;
-                    } else {
-                        tmp_frame = frame;
+                    if (decoderOutputFormat == AV_PIX_FMT_YUVJ422P || decoderOutputFormat == AV_PIX_FMT_YUVJ420P) {
+                        // camera JPEGs are full range, the NV12 output (and its BGR conversion) is video range
+                        const int *coefficients = sws_getCoefficients(SWS_CS_DEFAULT);
+                        sws_setColorspaceDetails(conversion.ctx, coefficients, 1, coefficients, 0, 0, 1 << 16, 1 << 16);
                     }
 
-                    if (!bIsInit)
-                    {
-                        width = cctx->width;
-                        height = cctx->height;
-                        decoderOutputFormat = static_cast<AVPixelFormat>(tmp_frame->format);
-                        frameOutputFormat = AV_PIX_FMT_NV12;
-                        outputFormat = OB_FORMAT_NV12;
-//                        switch(outputFormat) {
-//                            case OB_FORMAT_BGR:
-//                                frameOutputFormat = AV_PIX_FMT_BGR24;
-//                                break;
-//                            case OB_FORMAT_BGRA:
-//                                frameOutputFormat = AV_PIX_FMT_BGRA;
-//                                break;
-//                            case OB_FORMAT_RGB:
-//                                frameOutputFormat = AV_PIX_FMT_RGB24;
-//                                break;
-//                            case OB_FORMAT_NV12:
-//                                frameOutputFormat = AV_PIX_FMT_NV12;
-//                                break;
-//                            default:
-//                                spdlog::error("Unhandled output format: {0}", static_cast<int>(outputFormat));
-//                                return false;
-//                        }
-
-                        // skip if in/out are identical ?
-                        if (decoderOutputFormat != frameOutputFormat) {
-                            imgCtx = sws_getContext(cctx->width, cctx->height, decoderOutputFormat,
-                                                    cctx->width, cctx->height, frameOutputFormat,
-                                                    SWS_BICUBIC, nullptr, nullptr, nullptr);
-
-                            if (!imgCtx)
-                            {
-                                spdlog::error("initialization of swscale context failed.");
-                                return false;
-                            }
-
-                            converted_frame = av_frame_alloc();
-                            converted_frame->width = width;
-                            converted_frame->height = height;
-                            converted_frame->format = frameOutputFormat;
-                            vsize = av_image_get_buffer_size(frameOutputFormat, cctx->width, cctx->height, 1);
-                            buf = (uint8_t *)av_malloc(vsize);
-                            av_image_fill_arrays(converted_frame->data, converted_frame->linesize, buf,
-                                                 frameOutputFormat, cctx->width, cctx->height, 1);
-                        }
-                        bIsInit = true;
+                    conversion.frame = av_frame_alloc();
+                    if (!conversion.frame) {
+                        sws_freeContext(conversion.ctx);
+                        spdlog::error("Could not allocate conversion frame.");
+                        return false;
                     }
-
-                    if (bIsInit)
-                    {
-                        cv::Mat bgr_mat;
-                        if (decoderOutputFormat != AV_PIX_FMT_NV12) {
-                            sws_scale(imgCtx, tmp_frame->data, tmp_frame->linesize, 0, cctx->height,
-                                      converted_frame->data, converted_frame->linesize);
-
-                            //float time = cctx->time_base.den / cctx->time_base.num;
-
-                            cv::Mat y_mat = cv::Mat(converted_frame->height, converted_frame->width, CV_8UC1, converted_frame->data[0], converted_frame->linesize[0]);
-                            cv::Mat uv_mat = cv::Mat(converted_frame->height / 2, converted_frame->width / 2, CV_8UC2, converted_frame->data[1], converted_frame->linesize[1]);
-                            cv::cvtColorTwoPlane(y_mat, uv_mat, bgr_mat, cv::COLOR_YUV2BGR_NV12);
-                        } else {
-                            cv::Mat y_mat = cv::Mat(tmp_frame->height, tmp_frame->width, CV_8UC1, tmp_frame->data[0], tmp_frame->linesize[0]);
-                            cv::Mat uv_mat = cv::Mat(tmp_frame->height / 2, tmp_frame->width / 2, CV_8UC2, tmp_frame->data[1], tmp_frame->linesize[1]);
-                            cv::cvtColorTwoPlane(y_mat, uv_mat, bgr_mat, cv::COLOR_YUV2BGR_NV12);
-                        }
-
-                        frameCallback(bgr_mat);
-                        decodedImage = true;
+                    conversion.frame->width = outputWidth;
+                    conversion.frame->height = outputHeight;
+                    conversion.frame->format = frameOutputFormat;
+                    vsize = av_image_get_buffer_size(frameOutputFormat, outputWidth, outputHeight, 1);
+                    // refcounted, so av_frame_free releases it with the frame
+                    if (av_frame_get_buffer(conversion.frame, 0) < 0) {
+                        av_frame_free(&conversion.frame);
+                        sws_freeContext(conversion.ctx);
+                        spdlog::error("Could not allocate conversion buffer.");
+                        return false;
                     }
                 }
+
+                if (conversionCache.size() >= kMaxCachedConversions) {
+                    Conversion &evicted = conversionCache.back();
+                    sws_freeContext(evicted.ctx);
+                    av_frame_free(&evicted.frame);
+                    conversionCache.pop_back();
+                }
+                conversionCache.insert(conversionCache.begin(), conversion);
             }
-            if (!decodedImage) {
-                spdlog::warn("no image decoded...");
-            }
+
+            imgCtx = conversionCache.front().ctx;
+            converted_frame = conversionCache.front().frame;
+            bIsInit = true;
             return true;
         }
 
+        void H26xDecoder::FreeConversion()
+        {
+            for (auto &c : conversionCache) {
+                if (c.ctx != nullptr) {
+                    sws_freeContext(c.ctx);
+                }
+                av_frame_free(&c.frame);
+            }
+            conversionCache.clear();
+            imgCtx = nullptr;
+            converted_frame = nullptr;
+            bIsInit = false;
+        }
+
     } // vpf
 } // tcn
\ No newline at end of file
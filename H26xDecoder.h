@@ -1,8 +1,12 @@
 #ifndef ORBBEC_CAPTURE_TEST_H26XDECODER_H
 #define ORBBEC_CAPTURE_TEST_H26XDECODER_H
 
+#include <array>
 #include <cstdio>
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <memory>
 #include <string>
 #include <vector>
 #include <functional>
@@ -24,12 +28,56 @@ extern "C" {
 #include <libobsensor/h/ObTypes.h>
 #include <opencv2/opencv.hpp>
 
+#include "AllocationCounter.h"
+#include "TensorConverter.h"
+
+namespace ob {
+    class Frame;
+}
+
 namespace tcn::vpf {
 
+    /**
+     * What the caller knows about an encoded frame. Attached to its packet, carried through the codec
+     * (AVPacket::opaque -> AVFrame::opaque) and handed back with the decoded image, also when the codec
+     * reorders or frame threads hold several pictures.
+     */
+    struct FrameMeta {
+        uint64_t index{0};
+        uint64_t deviceTimestampUs{0};
+        uint64_t systemTimestampUs{0};
+        // host steady clock when the encoded frame was received
+        std::chrono::steady_clock::time_point receivedTs;
+        // depth frame paired with this color frame, if any
+        std::shared_ptr<ob::Frame> depthFrame;
+        // false for images whose packet carried no metadata
+        bool valid{false};
+    };
+
+    /**
+     * Counters of the decoder's error recovery, times in milliseconds.
+     */
+    struct RecoveryStats {
+        uint64_t errors{0};
+        // entries into the recovery state (errors while already recovering are not counted again)
+        uint64_t recoveries{0};
+        // codec contexts recreated after errors a flush cannot clear
+        uint64_t reopens{0};
+        // packets discarded while waiting for a keyframe
+        uint64_t discardedPackets{0};
+        // decoded frames flagged corrupt by the codec
+        uint64_t corruptedFrames{0};
+        // corrupt frames delivered anyway, the codec concealed the damage (see corruptFramesToRecover)
+        uint64_t concealedFrames{0};
+        double lastRecoveryMs{0.};
+        double maxRecoveryMs{0.};
+        double totalRecoveryMs{0.};
+    };
+
     class H26xDecoder {
     public:
 
-        typedef std::function<void(cv::Mat image)> frame_handler_cb;
+        typedef std::function<void(cv::Mat image, const FrameMeta &meta)> frame_handler_cb;
         H26xDecoder(frame_handler_cb cb);
         ~H26xDecoder();
 
@@ -44,16 +92,83 @@ namespace tcn::vpf {
         AVPacket *avpkt{nullptr};
         AVFrame *converted_frame{nullptr};
 
+        // active entry of the conversion cache
         struct SwsContext *imgCtx{nullptr};
         bool bIsInit{false};
+        // number of geometry / pixel format changes seen in the decoded stream
+        int formatChanges{0};
+        // non-reference access units the codec drops without output under skip_frame (SetDecodeShortcuts)
+        uint64_t skippedFrames{0};
+        int outputDownscale{1};
+        int outputWidth{0};
+        int outputHeight{0};
         int vsize{0};
     public:
         bool DecoderInit(AVHWDeviceType device_type, OBFormat stream_format, OBFormat output_format);
 
-        bool DecodeOnePacket(int cur_size, uint8_t *cur_ptr);
+        // eager variant: opens the codec primed with the stream's parameter sets (Annex-B SPS/PPS, may be empty)
+        // and preallocates the conversion buffers for the given geometry, so the first frame pays no setup
+        bool DecoderInit(AVHWDeviceType device_type, OBFormat stream_format, OBFormat output_format,
+                         int stream_width, int stream_height, const std::vector<uint8_t> &parameter_sets);
+
+        // collects the SPS/PPS (and VPS for H.265) NAL units of an Annex-B access unit
+        static std::vector<uint8_t> ExtractParameterSets(OBFormat stream_format, const uint8_t *data, size_t size);
+
+        // stream formats DecoderInit accepts: H.264 / H.265, MJPEG and uncompressed YUYV
+        static bool Supports(OBFormat stream_format);
+        // uncompressed input, converted straight from the capture buffer without a codec (DecodeRawFrame)
+        static bool IsRawFormat(OBFormat stream_format);
 
+        // meta (optional) comes back with the image of the access unit that starts in this input
+        bool DecodeOnePacket(int cur_size, uint8_t *cur_ptr, const FrameMeta *meta = nullptr);
+
+        // sends one complete access unit straight to the codec, bypassing the parser.
+        // with padded set (AV_INPUT_BUFFER_PADDING_SIZE readable bytes after data) the packet references data
+        // and holds owner until the codec releases it, otherwise the access unit is copied once.
+        // meta (optional) comes back with its image
+        bool DecodeAccessUnit(const uint8_t *data, int size, std::shared_ptr<const void> owner, bool padded,
+                              const FrameMeta *meta = nullptr);
+
+        // one uncompressed YUYV frame, data is only read during the call
+        bool DecodeRawFrame(const uint8_t *data, int size, int frame_width, int frame_height,
+                            const FrameMeta *meta = nullptr);
+
+        // end of stream: hands out the frames still buffered in the codec (frame threads, reordering)
+        // until EOF, an error or the deadline, after which they are dropped. returns the delivered count,
+        // the codec accepts packets again afterwards
+        int Flush(std::chrono::steady_clock::time_point deadline);
+
+        // frames still buffered in the codec are dropped, Flush() first to get them
         void DecoderTeardown();
 
+        // trade quality for decode time: codec skip flags plus an integer downscale of the output image
+        void SetDecodeShortcuts(AVDiscard loop_filter, AVDiscard idct, AVDiscard frames, int downscale);
+
+        // forget all reference pictures, call before a keyframe that follows a gap. the frames already
+        // buffered in the codec were decoded before the gap and are handed out first, until the deadline
+        // (see Flush). returns the delivered count
+        int Resync(std::chrono::steady_clock::time_point deadline);
+
+        // true while input is discarded after an error until the next keyframe / parameter sets
+        bool Recovering() const { return recoveryState == RecoveryState::awaitingKeyframe; }
+        const RecoveryStats &GetRecoveryStats() const { return recoveryStats; }
+
+        // number of codec threads for software decoding (0 = ffmpeg default), set before DecoderInit
+        int threadCount{0};
+        // device context owned by a DecoderService, referenced instead of creating one per decoder
+        AVBufferRef *sharedDeviceCtx{nullptr};
+        // steady state allocation check, only active in ALLOCATION_ACCOUNTING builds
+        AllocationCheck allocationCheck;
+        // resume decoding without a keyframe after discarding this many packets (intra refresh streams)
+        uint64_t recoveryTimeoutPackets{250};
+        // consecutive corrupt frames that enter recovery, fewer are concealed and delivered
+        uint64_t corruptFramesToRecover{3};
+        // deliver a normalized planar float tensor (TensorConfig) instead of the BGR image, set before DecoderInit
+        bool tensorOutput{false};
+        TensorConfig tensor;
+        // access units sent while set only build up references, their pictures are not delivered (seek preroll)
+        bool discardOutput{false};
+
         OBFormat inputFormat{OB_FORMAT_UNKNOWN};
         OBFormat outputFormat{OB_FORMAT_BGR};
         AVPixelFormat hwOutputFormat{AV_PIX_FMT_NONE};
@@ -64,6 +179,105 @@ namespace tcn::vpf {
         int width{0};
         int height{0};
 
+    private:
+        enum class RecoveryState {
+            decoding,
+            awaitingKeyframe
+        };
+
+        enum class DecodeError {
+            // damaged or missing bitstream data, a flush and the next keyframe fix it
+            corruptData,
+            // device / transfer failure, retried once with a flush, then the codec is reopened
+            hardware,
+            // the codec context itself is unusable (out of memory, invalid state)
+            fatal
+        };
+
+        static DecodeError ClassifyError(int averror);
+
+        // flushes the codec (reopening it if needed) and discards input until decoding can restart
+        void EnterRecovery(DecodeError error, const char *where, int averror);
+
+        // false if the packet is discarded while recovering
+        bool AdmitPacket(const uint8_t *data, size_t size);
+
+        bool SendPacket(bool &decodedImage);
+
+        bool OpenCodec();
+
+        bool ReceiveFrames(bool &decodedImage);
+
+        // selects (or creates) the cached conversion for this geometry and format
+        bool InitConversion(int frame_width, int frame_height, AVPixelFormat decoded_format);
+
+        void FreeConversion();
+
+        int OutputDimension(int full) const;
+
+        /**
+         * swscale context plus output buffer for one (width, height, src fmt, dst fmt, output size).
+         * Kept around so switching back to a previous profile needs no allocation.
+         */
+        struct Conversion {
+            int width{0};
+            int height{0};
+            AVPixelFormat srcFormat{AV_PIX_FMT_NONE};
+            AVPixelFormat dstFormat{AV_PIX_FMT_NONE};
+            int dstWidth{0};
+            int dstHeight{0};
+            struct SwsContext *ctx{nullptr};
+            AVFrame *frame{nullptr};
+        };
+        static constexpr size_t kMaxCachedConversions{4};
+        // most recently used first
+        std::vector<Conversion> conversionCache;
+
+        std::vector<uint8_t> primeParameterSets;
+
+        // created on the first frame in tensor mode, owns the tensor pool
+        std::unique_ptr<TensorConverter> tensorConverter;
+
+        // bitstream copies of unpadded access units, recreated only when an access unit outgrows it
+        AVBufferPool *packetPool{nullptr};
+        size_t packetPoolSize{0};
+
+        AVHWDeviceType deviceType{AV_HWDEVICE_TYPE_NONE};
+        // kept so a reopened codec context continues at the same quality level
+        AVDiscard skipLoopFilter{AVDISCARD_DEFAULT};
+        AVDiscard skipIdct{AVDISCARD_DEFAULT};
+        AVDiscard skipFrame{AVDISCARD_DEFAULT};
+
+        RecoveryState recoveryState{RecoveryState::decoding};
+        RecoveryStats recoveryStats;
+        std::chrono::steady_clock::time_point recoveryStartTs;
+        // an error was seen and no good frame has been delivered since
+        bool recoveryPending{false};
+        int hardwareErrorsInRecovery{0};
+        uint64_t discardedInRecovery{0};
+        uint64_t consecutiveCorrupt{0};
+
+        bool HandleDecodedFrame(AVFrame *decoded);
+
+        // stores meta for a packet, returns the key carried in AVPacket::opaque (0 = none, also for
+        // preroll packets: their output is discarded, nothing would take the meta back)
+        uint64_t AttachMeta(const FrameMeta *meta);
+        // the meta of a decoded frame, moved out of its slot
+        FrameMeta TakeMeta(const AVFrame *decoded);
+        // the packet of the key never produces output (rejected while recovering, skipped by the codec)
+        void ReleaseMeta(uint64_t key);
+        // frames dropped inside the codec never come back for their meta (flush, recovery)
+        void ClearMeta();
+
+        // more than the pictures a codec holds at once (frame threads + reorder delay), a slot is
+        // reused only after its picture has long been delivered or dropped
+        static constexpr size_t kMetaSlots{64};
+        struct MetaSlot {
+            uint64_t key{0};
+            FrameMeta meta;
+        };
+        std::array<MetaSlot, kMetaSlots> metaSlots;
+        uint64_t nextMetaKey{1};
     };
 
 } // vpf
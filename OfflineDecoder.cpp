@@ -0,0 +1,359 @@
+#include "OfflineDecoder.h"
+#include "budgeted_channel.h"
+#include "H26xDecoder.h"
+#include "Statistics.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace tcn::vpf {
+
+    namespace {
+        // the packets of one GOP, from a keyframe up to the next one
+        struct Gop {
+            uint64_t index{0};
+            uint64_t firstFrame{0};
+            std::vector<std::shared_ptr<AVPacket>> packets;
+            std::size_t bytes{0};
+        };
+
+        /**
+         * Hands the decoded GOPs to the sink in GOP order. Whichever worker completes the next GOP
+         * delivers it (and any later ones already waiting), so the sink sees one thread at a time.
+         * Images of GOPs after the next one are charged to a byte budget, a worker waits for room before
+         * it keeps another one, which bounds the decoded images held back. The next GOP never waits,
+         * so delivery always makes progress.
+         */
+        class GopReorder {
+        public:
+            GopReorder(std::size_t byte_limit, const OfflineDecoder::frame_sink &sink) : budget(byte_limit), sink(sink) {}
+
+            // before a decoded image of the GOP is kept, returns the bytes charged to the budget
+            std::size_t Hold(uint64_t gop, const cv::Mat &image) {
+                const std::size_t bytes = image.total() * image.elemSize();
+                if (gop == next.load()) {
+                    return 0;
+                }
+                // cancelled once the GOP becomes the next one to deliver
+                if (budget.acquire(bytes, [&]() { return gop == next.load(); }) != channel_op_status::success) {
+                    return 0;
+                }
+                return bytes;
+            }
+
+            // charged: the sum Hold() returned for the GOP's images
+            void Complete(uint64_t gop, uint64_t first_frame, std::vector<cv::Mat> images, std::size_t charged) {
+                std::unique_lock<std::mutex> lk{mutex_};
+                ready.emplace(gop, Decoded{first_frame, std::move(images), charged});
+                if (delivering) {
+                    return;
+                }
+                delivering = true;
+                for (auto it = ready.find(next); it != ready.end(); it = ready.find(next)) {
+                    Decoded decoded = std::move(it->second);
+                    ready.erase(it);
+                    lk.unlock();
+                    for (std::size_t i = 0; i < decoded.images.size(); ++i) {
+                        sink(decoded.firstFrame + i, std::move(decoded.images[i]));
+                    }
+                    decoded.images.clear();
+                    budget.release(decoded.charged);
+                    lk.lock();
+                    ++next;
+                    // wakes the worker of the new next GOP too
+                    budget.notify_all();
+                }
+                delivering = false;
+            }
+
+            std::size_t PeakBytes() const { return budget.peak(); }
+
+        private:
+            struct Decoded {
+                uint64_t firstFrame;
+                std::vector<cv::Mat> images;
+                std::size_t charged;
+            };
+
+            byte_budget budget;
+            const OfflineDecoder::frame_sink &sink;
+            std::mutex mutex_;
+            std::map<uint64_t, Decoded> ready;
+            // written under mutex_, read by waiting workers
+            std::atomic<uint64_t> next{0};
+            bool delivering{false};
+        };
+    }
+
+    OfflineDecoder::OfflineDecoder(OfflineDecodeConfig cfg) : config(std::move(cfg)) {
+        if (config.workers <= 0) {
+            config.workers = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        }
+        if (config.readAheadGops == 0) {
+            config.readAheadGops = 2 * static_cast<std::size_t>(config.workers);
+        }
+    }
+
+    OfflineDecoder::~OfflineDecoder() {
+        CloseInput();
+        if (hwDeviceCtx != nullptr) {
+            av_buffer_unref(&hwDeviceCtx);
+        }
+    }
+
+    bool OfflineDecoder::OpenInput() {
+        if (avformat_open_input(&input, config.path.c_str(), nullptr, nullptr) != 0) {
+            spdlog::error("Offline: cannot open {0}", config.path);
+            return false;
+        }
+        if (avformat_find_stream_info(input, nullptr) < 0) {
+            spdlog::error("Offline: cannot find stream information in {0}", config.path);
+            return false;
+        }
+        streamIndex = av_find_best_stream(input, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        if (streamIndex < 0) {
+            spdlog::error("Offline: no video stream in {0}", config.path);
+            return false;
+        }
+        const AVCodecParameters *par = input->streams[streamIndex]->codecpar;
+        const char *bsf_name{nullptr};
+        switch (par->codec_id) {
+            case AV_CODEC_ID_H264:
+                streamFormat = OB_FORMAT_H264;
+                bsf_name = "h264_mp4toannexb";
+                break;
+            case AV_CODEC_ID_HEVC:
+                streamFormat = OB_FORMAT_H265;
+                bsf_name = "hevc_mp4toannexb";
+                break;
+            default:
+                spdlog::error("Offline: {0} is neither H.264 nor H.265", config.path);
+                return false;
+        }
+        // avcC / hvcC extradata (version byte 1) means length prefixed packets
+        if (par->extradata_size > 0 && par->extradata[0] == 1) {
+            const AVBitStreamFilter *filter = av_bsf_get_by_name(bsf_name);
+            if (filter == nullptr || av_bsf_alloc(filter, &bsf) < 0 ||
+                avcodec_parameters_copy(bsf->par_in, par) < 0 || av_bsf_init(bsf) < 0) {
+                spdlog::error("Offline: cannot set up {0} for {1}", bsf_name, config.path);
+                return false;
+            }
+        }
+        bsfDrained = false;
+        return true;
+    }
+
+    void OfflineDecoder::CloseInput() {
+        if (bsf != nullptr) {
+            av_bsf_free(&bsf);
+        }
+        if (input != nullptr) {
+            avformat_close_input(&input);
+        }
+        streamIndex = -1;
+    }
+
+    bool OfflineDecoder::ReadPacket(AVPacket *pkt) {
+        while (true) {
+            if (bsf != nullptr) {
+                int ret = av_bsf_receive_packet(bsf, pkt);
+                if (ret == 0) {
+                    return true;
+                }
+                if (ret != AVERROR(EAGAIN)) {
+                    return false;
+                }
+                if (bsfDrained) {
+                    return false;
+                }
+            }
+            if (av_read_frame(input, pkt) < 0) {
+                if (bsf != nullptr && !bsfDrained) {
+                    bsfDrained = true;
+                    av_bsf_send_packet(bsf, nullptr);
+                    continue;
+                }
+                return false;
+            }
+            if (pkt->stream_index != streamIndex) {
+                av_packet_unref(pkt);
+                continue;
+            }
+            if (bsf == nullptr) {
+                return true;
+            }
+            if (av_bsf_send_packet(bsf, pkt) < 0) {
+                av_packet_unref(pkt);
+                spdlog::error("Offline: bitstream filter rejected a packet of {0}", config.path);
+                return false;
+            }
+        }
+    }
+
+    bool OfflineDecoder::Run(const frame_sink &sink, OfflineDecodeResult &result) {
+        result = OfflineDecodeResult{};
+        result.workers = config.workers;
+        keyframes.clear();
+        CloseInput();
+        if (!OpenInput()) {
+            CloseInput();
+            return false;
+        }
+        if (config.deviceType != AV_HWDEVICE_TYPE_NONE && hwDeviceCtx == nullptr &&
+            av_hwdevice_ctx_create(&hwDeviceCtx, config.deviceType, NULL, NULL, 0) < 0) {
+            spdlog::error("Offline: failed to create {0} device", av_hwdevice_get_type_name(config.deviceType));
+            CloseInput();
+            return false;
+        }
+        const auto t_start = std::chrono::steady_clock::now();
+
+        budgeted_channel<std::shared_ptr<Gop>> gops(config.readAheadGops, std::max<std::size_t>(config.readAheadBytes, 1),
+                                                    [](const std::shared_ptr<Gop> &gop) { return gop->bytes; });
+        GopReorder reorder(std::max<std::size_t>(config.reorderBytes, 1), sink);
+        std::mutex result_mutex;
+
+        std::vector<std::thread> workers;
+        for (int w = 0; w < config.workers; ++w) {
+            workers.emplace_back([&, w]() {
+                uint64_t frame_in_gop{0};
+                uint64_t first_frame{0};
+                uint64_t gop_index{0};
+                std::vector<cv::Mat> images;
+                std::size_t charged{0};
+                // the packets carry no metadata, the frame position is counted within the GOP
+                H26xDecoder decoder([&](cv::Mat image, const FrameMeta &) {
+                    if (config.ordered) {
+                        charged += reorder.Hold(gop_index, image);
+                        images.push_back(std::move(image));
+                    } else {
+                        sink(first_frame + frame_in_gop, std::move(image));
+                    }
+                    ++frame_in_gop;
+                });
+                // GOPs are the parallelism, so codec contexts stay single threaded
+                decoder.threadCount = 1;
+                decoder.sharedDeviceCtx = hwDeviceCtx;
+                bool ready = decoder.DecoderInit(config.deviceType, streamFormat, config.outputFormat);
+                if (!ready) {
+                    spdlog::error("Offline: worker {0} failed to open a decoder", w);
+                }
+                std::vector<double> durations;
+                uint64_t frames{0};
+                uint64_t failed{0};
+                std::shared_ptr<Gop> gop;
+                while (gops.pop(gop) == channel_op_status::success) {
+                    auto t_gop = std::chrono::steady_clock::now();
+                    frame_in_gop = 0;
+                    first_frame = gop->firstFrame;
+                    gop_index = gop->index;
+                    charged = 0;
+                    bool ok = ready;
+                    for (const auto &packet : gop->packets) {
+                        if (!ok) {
+                            break;
+                        }
+                        // demuxer packets are padded, the codec references them without a copy
+                        ok = decoder.DecodeAccessUnit(packet->data, packet->size, packet, true);
+                    }
+                    if (ready) {
+                        // the GOP's reordered tail, afterwards the codec starts clean at the next keyframe
+                        decoder.Flush(std::chrono::steady_clock::time_point::max());
+                    }
+                    durations.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_gop).count());
+                    frames += frame_in_gop;
+                    if (!ok) {
+                        ++failed;
+                    }
+                    const uint64_t index = gop->index;
+                    gop.reset();
+                    if (config.ordered) {
+                        // failed GOPs are still completed, later GOPs must not wait for them
+                        reorder.Complete(index, first_frame, std::move(images), charged);
+                        images.clear();
+                    }
+                }
+                if (ready) {
+                    decoder.DecoderTeardown();
+                }
+                std::scoped_lock<std::mutex> lk{result_mutex};
+                result.frames += frames;
+                result.failedGops += failed;
+                result.gopDecodeMs.insert(result.gopDecodeMs.end(), durations.begin(), durations.end());
+            });
+        }
+
+        // the reader builds the keyframe index while it cuts the packet stream into GOPs
+        AVPacket *pkt = av_packet_alloc();
+        std::shared_ptr<Gop> gop;
+        uint64_t frame{0};
+        uint64_t gop_count{0};
+        while (pkt != nullptr && ReadPacket(pkt)) {
+            ++result.packets;
+            if (pkt->flags & AV_PKT_FLAG_KEY) {
+                if (gop && gops.push(std::move(gop)) != channel_op_status::success) {
+                    break;
+                }
+                gop = std::make_shared<Gop>();
+                gop->index = gop_count++;
+                gop->firstFrame = frame;
+                keyframes.push_back(KeyframeEntry{frame, pkt->pts, pkt->pos});
+            }
+            if (!gop) {
+                ++result.skippedPackets;
+                ++frame;
+                av_packet_unref(pkt);
+                continue;
+            }
+            std::shared_ptr<AVPacket> packet(av_packet_alloc(), [](AVPacket *p) { av_packet_free(&p); });
+            av_packet_move_ref(packet.get(), pkt);
+            gop->bytes += static_cast<std::size_t>(packet->size);
+            gop->packets.push_back(std::move(packet));
+            ++frame;
+        }
+        if (gop) {
+            gops.push(std::move(gop));
+        }
+        av_packet_free(&pkt);
+        // the workers finish what is queued, then see the channel closed
+        gops.close();
+        for (auto &t : workers) {
+            t.join();
+        }
+        CloseInput();
+
+        result.gops = gop_count;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+        result.fps = result.seconds > 0. ? static_cast<double>(result.frames) / result.seconds : 0.;
+        spdlog::info("Offline: {0} - {1} workers decoded {2} frames in {3} GOPs in {4:.3f}s ({5:.1f} fps), "
+                     "{6} packets before the first keyframe skipped, {7} GOPs failed",
+                     config.path, result.workers, result.frames, result.gops, result.seconds, result.fps,
+                     result.skippedPackets, result.failedGops);
+        if (config.ordered) {
+            spdlog::info("Offline: reorder window peak {0:.1f}MB of {1:.1f}MB", reorder.PeakBytes() / 1e6,
+                         config.reorderBytes / 1e6);
+        }
+        return result.failedGops == 0;
+    }
+
+    void OfflineDecoder::ReportScaling(const std::string &name, const std::vector<OfflineDecodeResult> &runs) {
+        if (runs.empty()) {
+            return;
+        }
+        const auto &base = runs.front();
+        for (const auto &r : runs) {
+            double speedup = base.fps > 0. ? r.fps / base.fps : 0.;
+            double efficiency = r.workers > 0 && base.workers > 0 ? speedup * base.workers / r.workers : 0.;
+            spdlog::info("{0}: offline scaling - workers: {1} fps: {2:.1f} speedup: {3:.2f}x efficiency: {4:.0f}%",
+                         name, r.workers, r.fps, speedup, efficiency * 100.);
+            report_stats(name + " offline gop_decode_ms (" + std::to_string(r.workers) + " workers)", r.gopDecodeMs);
+        }
+    }
+
+} // tcn::vpf
@@ -0,0 +1,111 @@
+#ifndef ORBBEC_CAPTURE_TEST_OFFLINEDECODER_H
+#define ORBBEC_CAPTURE_TEST_OFFLINEDECODER_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavcodec/avcodec.h>
+#include <libavcodec/bsf.h>
+#include <libavformat/avformat.h>
+#include <libavutil/hwcontext.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+#include <libobsensor/h/ObTypes.h>
+#include <opencv2/opencv.hpp>
+
+namespace tcn::vpf {
+
+    struct OfflineDecodeConfig {
+        // any container / elementary stream libavformat reads, H.264 or H.265 video
+        std::string path;
+        AVHWDeviceType deviceType{AV_HWDEVICE_TYPE_NONE};
+        OBFormat outputFormat{OB_FORMAT_BGR};
+        // GOPs decoded at the same time, each on its own codec context, 0 = one per cpu
+        int workers{0};
+        // frames reach the sink in file order, otherwise as soon as their GOP is decoded
+        bool ordered{true};
+        // encoded GOPs read ahead of the decoders, bounded by count and packet memory (0 = 2 per worker)
+        std::size_t readAheadGops{0};
+        std::size_t readAheadBytes{256u << 20};
+        // ordered: decoded images held back for GOPs ahead of the one being delivered
+        std::size_t reorderBytes{512u << 20};
+    };
+
+    struct KeyframeEntry {
+        // position in the stream's packet order, one packet per frame
+        uint64_t frame{0};
+        int64_t pts{AV_NOPTS_VALUE};
+        // byte offset in the file, -1 if the demuxer does not know it
+        int64_t pos{-1};
+    };
+
+    struct OfflineDecodeResult {
+        int workers{0};
+        uint64_t gops{0};
+        uint64_t packets{0};
+        // packets before the first keyframe, they cannot be decoded on their own
+        uint64_t skippedPackets{0};
+        uint64_t frames{0};
+        uint64_t failedGops{0};
+        double seconds{0.};
+        double fps{0.};
+        // decode time of each GOP, milliseconds
+        std::vector<double> gopDecodeMs;
+    };
+
+    /**
+     * Decodes a recorded file GOP-parallel: one reader splits the packets at keyframes into independent
+     * GOPs, a fixed set of workers decode whole GOPs on their own single threaded codec contexts.
+     * Frames go to the sink in file order through a reorder window bounded by bytes, or unordered straight from
+     * the workers. Assumes closed GOPs (every keyframe an IDR), as the device encoder produces them.
+     */
+    class OfflineDecoder {
+    public:
+        // frame_index is the frame's position in the file. ordered: called by one thread at a time, in order,
+        // unordered: called concurrently from the workers
+        typedef std::function<void(uint64_t frame_index, cv::Mat image)> frame_sink;
+
+        explicit OfflineDecoder(OfflineDecodeConfig cfg);
+        ~OfflineDecoder();
+
+        OfflineDecoder(OfflineDecoder const &) = delete;
+        OfflineDecoder &operator=(OfflineDecoder const &) = delete;
+
+        bool Run(const frame_sink &sink, OfflineDecodeResult &result);
+
+        // keyframes of the last run
+        const std::vector<KeyframeEntry> &Keyframes() const { return keyframes; }
+
+        // throughput per worker count relative to the run with the fewest workers
+        static void ReportScaling(const std::string &name, const std::vector<OfflineDecodeResult> &runs);
+
+    private:
+        bool OpenInput();
+        void CloseInput();
+        // next packet of the video stream, Annex-B, false at the end of the file or on error
+        bool ReadPacket(AVPacket *pkt);
+
+        OfflineDecodeConfig config;
+        AVFormatContext *input{nullptr};
+        int streamIndex{-1};
+        OBFormat streamFormat{OB_FORMAT_UNKNOWN};
+        // length prefixed (mp4 / mkv) to Annex-B, the decoders only take Annex-B access units
+        AVBSFContext *bsf{nullptr};
+        bool bsfDrained{false};
+        AVBufferRef *hwDeviceCtx{nullptr};
+        std::vector<KeyframeEntry> keyframes;
+    };
+
+} // tcn::vpf
+
+#endif //ORBBEC_CAPTURE_TEST_OFFLINEDECODER_H
@@ -0,0 +1,84 @@
+#include "QualityController.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace tcn::vpf {
+
+    const char *quality_level_name(QualityLevel level) {
+        switch (level) {
+            case QualityLevel::full:
+                return "full";
+            case QualityLevel::skipLoopFilter:
+                return "skip-loop-filter";
+            case QualityLevel::skipNonRef:
+                return "skip-non-ref";
+            case QualityLevel::reducedResolution:
+                return "reduced-resolution";
+        }
+        return "unknown";
+    }
+
+    void apply_quality_level(H26xDecoder &decoder, QualityLevel level) {
+        switch (level) {
+            case QualityLevel::full:
+                decoder.SetDecodeShortcuts(AVDISCARD_DEFAULT, AVDISCARD_DEFAULT, AVDISCARD_DEFAULT, 1);
+                break;
+            case QualityLevel::skipLoopFilter:
+                decoder.SetDecodeShortcuts(AVDISCARD_ALL, AVDISCARD_DEFAULT, AVDISCARD_DEFAULT, 1);
+                break;
+            case QualityLevel::skipNonRef:
+                decoder.SetDecodeShortcuts(AVDISCARD_ALL, AVDISCARD_NONREF, AVDISCARD_NONREF, 1);
+                break;
+            case QualityLevel::reducedResolution:
+                decoder.SetDecodeShortcuts(AVDISCARD_ALL, AVDISCARD_NONREF, AVDISCARD_NONREF, 2);
+                break;
+        }
+    }
+
+    QualityController::QualityController(std::string name, QualityLadderConfig cfg, double frame_interval_ms)
+            : name(std::move(name)), config(cfg), frameIntervalMs(frame_interval_ms) {
+        entries[static_cast<int>(QualityLevel::full)] = 1;
+    }
+
+    bool QualityController::Update(double queue_fill, double decode_ms) {
+        double pressure = std::max(queue_fill, frameIntervalMs > 0. ? decode_ms / frameIntervalMs : 0.);
+        if (pressure >= config.highPressure) {
+            belowCount = 0;
+            if (++aboveCount >= config.stepDownFrames && level < config.lowestLevel) {
+                Step(1, pressure);
+                return true;
+            }
+        } else if (pressure <= config.lowPressure) {
+            aboveCount = 0;
+            if (++belowCount >= config.stepUpFrames && level > QualityLevel::full) {
+                Step(-1, pressure);
+                return true;
+            }
+        } else {
+            // inside the hysteresis band nothing accumulates
+            aboveCount = 0;
+            belowCount = 0;
+        }
+        return false;
+    }
+
+    void QualityController::Step(int delta, double pressure) {
+        auto previous = level;
+        level = static_cast<QualityLevel>(static_cast<int>(level) + delta);
+        aboveCount = 0;
+        belowCount = 0;
+        ++transitions;
+        ++entries[static_cast<int>(level)];
+        spdlog::info("{0}: decode quality {1} -> {2} (pressure {3:.2f})",
+                     name, quality_level_name(previous), quality_level_name(level), pressure);
+    }
+
+    void QualityController::Report() const {
+        spdlog::info("{0}: quality transitions: {1} entries full: {2} skip-loop-filter: {3} skip-non-ref: {4} "
+                     "reduced-resolution: {5}, final level: {6}",
+                     name, transitions, entries[0], entries[1], entries[2], entries[3], quality_level_name(level));
+    }
+
+} // tcn::vpf
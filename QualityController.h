@@ -0,0 +1,69 @@
+#ifndef ORBBEC_CAPTURE_TEST_QUALITYCONTROLLER_H
+#define ORBBEC_CAPTURE_TEST_QUALITYCONTROLLER_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "H26xDecoder.h"
+
+namespace tcn::vpf {
+
+    // ordered from full quality to cheapest
+    enum class QualityLevel {
+        full = 0,
+        skipLoopFilter,
+        skipNonRef,
+        reducedResolution,
+    };
+    constexpr int kQualityLevels = 4;
+
+    const char *quality_level_name(QualityLevel level);
+
+    // configures the decoder for a ladder step
+    void apply_quality_level(H26xDecoder &decoder, QualityLevel level);
+
+    struct QualityLadderConfig {
+        // pressure is max(queue fill, decode time / frame interval)
+        double highPressure{0.75};
+        double lowPressure{0.3};
+        // consecutive frames above / below the thresholds before stepping (hysteresis)
+        int stepDownFrames{5};
+        int stepUpFrames{50};
+        QualityLevel lowestLevel{QualityLevel::reducedResolution};
+    };
+
+    /**
+     * Steps a decoder down the quality ladder while the pipeline cannot keep up
+     * and back up once pressure is gone. Called once per decoded packet.
+     */
+    class QualityController {
+    public:
+        QualityController(std::string name, QualityLadderConfig cfg, double frame_interval_ms);
+
+        // returns true if the level changed, the caller then applies Level() to its decoder
+        bool Update(double queue_fill, double decode_ms);
+
+        QualityLevel Level() const { return level; }
+        uint64_t Transitions() const { return transitions; }
+        // how many times each level was entered
+        const std::array<uint64_t, kQualityLevels> &Entries() const { return entries; }
+
+        void Report() const;
+
+    private:
+        void Step(int delta, double pressure);
+
+        std::string name;
+        QualityLadderConfig config;
+        double frameIntervalMs;
+        QualityLevel level{QualityLevel::full};
+        int aboveCount{0};
+        int belowCount{0};
+        uint64_t transitions{0};
+        std::array<uint64_t, kQualityLevels> entries{};
+    };
+
+} // tcn::vpf
+
+#endif //ORBBEC_CAPTURE_TEST_QUALITYCONTROLLER_H
@@ -0,0 +1,276 @@
+#include "RecordingIndex.h"
+#include "H26xBitstream.h"
+#include "ReplayTiming.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+namespace tcn {
+
+    namespace {
+        constexpr const char *kIndexHeader = "# frame offset size device_timestamp_us keyframe";
+        // read size of the scan, the parser keeps its own copy of a partial access unit
+        constexpr std::size_t kScanChunkSize = 1 << 20;
+
+        // frame size from the first start-of-frame marker of a JPEG
+        bool jpeg_dimensions(const uint8_t *data, std::size_t size, uint32_t &width, uint32_t &height) {
+            std::size_t i = 2;
+            while (i + 9 <= size) {
+                if (data[i] != 0xff) {
+                    return false;
+                }
+                const uint8_t marker = data[i + 1];
+                if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+                    height = (static_cast<uint32_t>(data[i + 5]) << 8) | data[i + 6];
+                    width = (static_cast<uint32_t>(data[i + 7]) << 8) | data[i + 8];
+                    return true;
+                }
+                if (marker == 0xd9 || marker == 0xda) {
+                    return false;
+                }
+                i += 2 + ((static_cast<std::size_t>(data[i + 2]) << 8) | data[i + 3]);
+            }
+            return false;
+        }
+
+        // uncompressed frames all have the same size, no parser needed
+        bool split_raw_frames(std::istream &in, std::size_t frame_size, const access_unit_cb &cb) {
+            std::vector<uint8_t> buffer(frame_size);
+            uint64_t offset{0};
+            while (in.read(reinterpret_cast<char *>(buffer.data()), static_cast<std::streamsize>(frame_size))) {
+                if (!cb(offset, buffer.data(), frame_size)) {
+                    return true;
+                }
+                offset += frame_size;
+            }
+            if (in.gcount() > 0) {
+                spdlog::warn("Replay: ignoring {0} trailing bytes, less than one frame", in.gcount());
+            }
+            return true;
+        }
+    }
+
+    std::string index_path(const std::string &stream_path) {
+        return stream_path + ".index";
+    }
+
+    bool RecordingIndex::Load(const std::string &path) {
+        std::ifstream in(path);
+        if (!in) {
+            return false;
+        }
+        Clear();
+        std::string line;
+        int line_no{0};
+        while (std::getline(in, line)) {
+            ++line_no;
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            std::istringstream fields(line);
+            uint64_t frame{0};
+            int keyframe{0};
+            IndexEntry e;
+            if (!(fields >> frame >> e.offset >> e.size >> e.deviceTimestampUs >> keyframe) || frame != entries.size()) {
+                spdlog::warn("Index: {0}:{1}: expected frame {2} offset size device_timestamp_us keyframe",
+                             path, line_no, entries.size());
+                Clear();
+                return false;
+            }
+            e.keyframe = keyframe != 0;
+            Add(e);
+        }
+        return !entries.empty();
+    }
+
+    bool RecordingIndex::Save(const std::string &path) const {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) {
+            spdlog::warn("Index: cannot write {0}", path);
+            return false;
+        }
+        WriteHeader(out);
+        for (std::size_t i = 0; i < entries.size(); ++i) {
+            WriteEntry(out, i, entries[i]);
+        }
+        return static_cast<bool>(out);
+    }
+
+    void RecordingIndex::WriteHeader(std::ostream &out) {
+        out << kIndexHeader << "\n";
+    }
+
+    void RecordingIndex::WriteEntry(std::ostream &out, uint64_t frame, const IndexEntry &e) {
+        out << frame << ' ' << e.offset << ' ' << e.size << ' ' << e.deviceTimestampUs << ' ' << (e.keyframe ? 1 : 0) << '\n';
+    }
+
+    void RecordingIndex::Add(const IndexEntry &entry) {
+        if (entry.keyframe) {
+            keyframes.push_back(entries.size());
+        }
+        entries.push_back(entry);
+    }
+
+    void RecordingIndex::Clear() {
+        entries.clear();
+        keyframes.clear();
+    }
+
+    uint64_t RecordingIndex::StreamBytes() const {
+        return entries.empty() ? 0 : entries.back().offset + entries.back().size;
+    }
+
+    bool RecordingIndex::KeyframeAtOrBefore(uint64_t frame, uint64_t &keyframe) const {
+        auto it = std::upper_bound(keyframes.begin(), keyframes.end(), frame);
+        if (it == keyframes.begin()) {
+            return false;
+        }
+        keyframe = *(it - 1);
+        return true;
+    }
+
+    uint64_t RecordingIndex::FrameAtTimestamp(uint64_t device_timestamp_us) const {
+        if (entries.empty()) {
+            return 0;
+        }
+        auto it = std::lower_bound(entries.begin(), entries.end(), device_timestamp_us,
+                                   [](const IndexEntry &e, uint64_t ts) { return e.deviceTimestampUs < ts; });
+        return it == entries.end() ? entries.size() - 1 : static_cast<uint64_t>(it - entries.begin());
+    }
+
+    bool split_access_units(std::istream &in, OBFormat format, const access_unit_cb &cb,
+                            uint32_t &width, uint32_t &height) {
+        if (format == OB_FORMAT_YUYV || format == OB_FORMAT_YUY2) {
+            if (width == 0 || height == 0) {
+                spdlog::error("Replay: raw yuyv streams need the frame size");
+                return false;
+            }
+            return split_raw_frames(in, static_cast<std::size_t>(width) * height * 2, cb);
+        }
+        AVCodecID codec_id;
+        switch (format) {
+            case OB_FORMAT_H264:
+                codec_id = AV_CODEC_ID_H264;
+                break;
+            case OB_FORMAT_H265:
+            case OB_FORMAT_HEVC:
+                codec_id = AV_CODEC_ID_H265;
+                break;
+            case OB_FORMAT_MJPG:
+                codec_id = AV_CODEC_ID_MJPEG;
+                break;
+            default:
+                spdlog::error("Replay: unhandled stream format: {0}", static_cast<int>(format));
+                return false;
+        }
+
+        // the parser needs a codec context to report stream parameters into
+        const AVCodec *codec = avcodec_find_decoder(codec_id);
+        AVCodecContext *cctx = avcodec_alloc_context3(codec);
+        AVCodecParserContext *parser = av_parser_init(codec_id);
+        if (!cctx || !parser) {
+            spdlog::error("Replay: could not allocate parser.");
+            avcodec_free_context(&cctx);
+            if (parser) {
+                av_parser_close(parser);
+            }
+            return false;
+        }
+
+        std::vector<uint8_t> chunk(kScanChunkSize);
+        uint64_t offset{0};
+        bool ok{true};
+        bool more{true};
+        bool flushed{false};
+        while (more && !flushed) {
+            in.read(reinterpret_cast<char *>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+            const auto read = static_cast<int>(in.gcount());
+            const uint8_t *cur_ptr = chunk.data();
+            int cur_size = read;
+            // a final call with an empty buffer flushes the last access unit out of the parser
+            flushed = read == 0;
+            do {
+                uint8_t *out_data{nullptr};
+                int out_size{0};
+                int len = av_parser_parse2(parser, cctx, &out_data, &out_size, cur_ptr, cur_size,
+                                           AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+                if (len < 0) {
+                    spdlog::error("Replay: error while parsing the stream");
+                    ok = false;
+                    more = false;
+                    break;
+                }
+                cur_ptr += len;
+                cur_size -= len;
+                if (out_size > 0) {
+                    // the parser hands out the input bytes unchanged and back to back
+                    if (codec_id == AV_CODEC_ID_MJPEG) {
+                        // the jpeg parser only splits, the size is in the frame header
+                        jpeg_dimensions(out_data, static_cast<std::size_t>(out_size), width, height);
+                    } else {
+                        width = static_cast<uint32_t>(parser->width);
+                        height = static_cast<uint32_t>(parser->height);
+                    }
+                    if (!cb(offset, out_data, static_cast<std::size_t>(out_size))) {
+                        more = false;
+                        break;
+                    }
+                    offset += static_cast<uint64_t>(out_size);
+                }
+            } while (cur_size > 0);
+        }
+        if (codec_id != AV_CODEC_ID_MJPEG) {
+            width = static_cast<uint32_t>(parser->width);
+            height = static_cast<uint32_t>(parser->height);
+        }
+
+        av_parser_close(parser);
+        avcodec_free_context(&cctx);
+        return ok;
+    }
+
+    bool build_recording_index(const std::string &stream_path, OBFormat format, int64_t frame_interval_us,
+                               RecordingIndex &out, uint32_t &width, uint32_t &height,
+                               const access_unit_cb &on_access_unit) {
+        std::ifstream in(stream_path, std::ios::binary);
+        if (!in) {
+            spdlog::error("Index: cannot open {0}", stream_path);
+            return false;
+        }
+        std::vector<ArrivalRecord> arrivals;
+        if (std::ifstream(timing_path(stream_path))) {
+            load_arrival_records(timing_path(stream_path), arrivals);
+        }
+        const auto t_start = std::chrono::steady_clock::now();
+        out.Clear();
+        bool ok = split_access_units(in, format, [&](uint64_t offset, const uint8_t *data, std::size_t size) {
+            const uint64_t frame = out.Size();
+            IndexEntry e;
+            e.offset = offset;
+            e.size = size;
+            const auto interval = static_cast<uint64_t>(std::max<int64_t>(frame_interval_us, 1));
+            if (frame < arrivals.size()) {
+                e.deviceTimestampUs = arrivals[frame].deviceTimestampUs;
+            } else if (!arrivals.empty()) {
+                e.deviceTimestampUs = arrivals.back().deviceTimestampUs + (frame - arrivals.size() + 1) * interval;
+            } else {
+                e.deviceTimestampUs = frame * interval;
+            }
+            // intra-only formats restart anywhere
+            e.keyframe = !vpf::is_h26x_format(format) || vpf::inspect_access_unit(format, data, size).keyframe;
+            out.Add(e);
+            return !on_access_unit || on_access_unit(offset, data, size);
+        }, width, height);
+        spdlog::info("Index: scanned {0} frames, {1} keyframes of {2} in {3:.1f}ms", out.Size(), out.Keyframes(),
+                     stream_path, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count());
+        return ok && !out.Empty();
+    }
+
+} // tcn
@@ -0,0 +1,80 @@
+#ifndef ORBBEC_CAPTURE_TEST_RECORDINGINDEX_H
+#define ORBBEC_CAPTURE_TEST_RECORDINGINDEX_H
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <libobsensor/h/ObTypes.h>
+
+namespace tcn {
+
+    /**
+     * Where one access unit of a recorded elementary stream lives, one line of a "<stream>.index" sidecar.
+     */
+    struct IndexEntry {
+        uint64_t offset{0};
+        uint64_t size{0};
+        uint64_t deviceTimestampUs{0};
+        // decoding can restart here (IDR / IRAP)
+        bool keyframe{false};
+    };
+
+    // sidecar next to a recorded elementary stream
+    std::string index_path(const std::string &stream_path);
+
+    /**
+     * Frame position -> byte range, device timestamp and nearest preceding keyframe of a recording,
+     * so a replay can start anywhere by reading and decoding one partial GOP.
+     */
+    class RecordingIndex {
+    public:
+        bool Load(const std::string &path);
+        bool Save(const std::string &path) const;
+
+        // sidecar lines, for writers that append while recording
+        static void WriteHeader(std::ostream &out);
+        static void WriteEntry(std::ostream &out, uint64_t frame, const IndexEntry &entry);
+
+        // the next frame, in stream order
+        void Add(const IndexEntry &entry);
+        void Clear();
+
+        std::size_t Size() const { return entries.size(); }
+        bool Empty() const { return entries.empty(); }
+        const IndexEntry &Entry(uint64_t frame) const { return entries[frame]; }
+        std::size_t Keyframes() const { return keyframes.size(); }
+        // bytes of stream the entries cover
+        uint64_t StreamBytes() const;
+
+        // latest keyframe at or before frame, false if there is none (decoding cannot get to the frame)
+        bool KeyframeAtOrBefore(uint64_t frame, uint64_t &keyframe) const;
+        // first frame at or after the device timestamp, the last frame if all are earlier
+        uint64_t FrameAtTimestamp(uint64_t device_timestamp_us) const;
+
+    private:
+        std::vector<IndexEntry> entries;
+        // frame positions of the keyframes, ascending
+        std::vector<uint64_t> keyframes;
+    };
+
+    typedef std::function<bool(uint64_t offset, const uint8_t *data, std::size_t size)> access_unit_cb;
+
+    // splits an Annex-B H.264 / H.265 or MJPEG stream into access units in one pass over fixed size chunks.
+    // cb returning false ends the scan early. width / height are taken from the parsed SPS / JPEG header,
+    // for raw YUYV they are the frame size the stream is cut at
+    bool split_access_units(std::istream &in, OBFormat format, const access_unit_cb &cb,
+                            uint32_t &width, uint32_t &height);
+
+    // one-pass scan for recordings without a sidecar. device timestamps come from the timing sidecar
+    // if there is one, otherwise from the frame interval. on_access_unit (optional) sees every access unit
+    bool build_recording_index(const std::string &stream_path, OBFormat format, int64_t frame_interval_us,
+                               RecordingIndex &out, uint32_t &width, uint32_t &height,
+                               const access_unit_cb &on_access_unit = nullptr);
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_RECORDINGINDEX_H
@@ -0,0 +1,238 @@
+#include "ReplayTiming.h"
+#include "FrameSource.h"
+#include "H26xBitstream.h"
+#include "RecordingIndex.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+namespace tcn {
+
+    namespace {
+        constexpr const char *kTimingHeader = "# index arrival_us device_timestamp_us size";
+        // large sequential writes, the source thread should not wait on small ones
+        constexpr std::size_t kRecordBufferSize = 4 << 20;
+    }
+
+    std::string timing_path(const std::string &stream_path) {
+        return stream_path + ".timing";
+    }
+
+    bool load_arrival_records(const std::string &path, std::vector<ArrivalRecord> &out) {
+        std::ifstream in(path);
+        if (!in) {
+            spdlog::error("Replay: cannot open timing file {0}", path);
+            return false;
+        }
+        out.clear();
+        std::string line;
+        int line_no{0};
+        while (std::getline(in, line)) {
+            ++line_no;
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            std::istringstream fields(line);
+            ArrivalRecord r;
+            if (!(fields >> r.index >> r.arrivalUs >> r.deviceTimestampUs >> r.size)) {
+                spdlog::error("Replay: {0}:{1}: expected index arrival_us device_timestamp_us size", path, line_no);
+                return false;
+            }
+            if (!out.empty() && r.arrivalUs < out.back().arrivalUs) {
+                spdlog::error("Replay: {0}:{1}: arrival time goes backwards", path, line_no);
+                return false;
+            }
+            out.push_back(r);
+        }
+        if (out.empty()) {
+            spdlog::error("Replay: no arrival records in {0}", path);
+            return false;
+        }
+        return true;
+    }
+
+    bool StreamRecorder::Open(const std::string &p) {
+        path = p;
+        streamBuffer.resize(kRecordBufferSize);
+        stream.rdbuf()->pubsetbuf(streamBuffer.data(), static_cast<std::streamsize>(streamBuffer.size()));
+        stream.open(path, std::ios::binary | std::ios::trunc);
+        timing.open(timing_path(path), std::ios::trunc);
+        index.open(index_path(path), std::ios::trunc);
+        if (!stream || !timing || !index) {
+            spdlog::error("Record: cannot open {0} / {1} / {2}", path, timing_path(path), index_path(path));
+            Close();
+            return false;
+        }
+        timing << kTimingHeader << "\n";
+        RecordingIndex::WriteHeader(index);
+        frames = 0;
+        streamBytes = 0;
+        spdlog::info("Record: writing {0} and {1}", path, timing_path(path));
+        return true;
+    }
+
+    void StreamRecorder::Write(const EncodedFrame &frame, std::chrono::steady_clock::time_point arrival) {
+        if (!stream.is_open() || frame.data == nullptr) {
+            return;
+        }
+        if (frames == 0) {
+            firstArrival = arrival;
+        }
+        stream.write(reinterpret_cast<const char *>(frame.data), static_cast<std::streamsize>(frame.size));
+        timing << frame.index << ' '
+               << std::chrono::duration_cast<std::chrono::microseconds>(arrival - firstArrival).count() << ' '
+               << frame.deviceTimestampUs << ' ' << frame.size << '\n';
+        // only NAL headers are looked at, cheap enough for the source thread
+        IndexEntry entry;
+        entry.offset = streamBytes;
+        entry.size = frame.size;
+        entry.deviceTimestampUs = frame.deviceTimestampUs;
+        entry.keyframe = !vpf::is_h26x_format(frame.format) ||
+                         vpf::inspect_access_unit(frame.format, frame.data, frame.size).keyframe;
+        RecordingIndex::WriteEntry(index, frames, entry);
+        streamBytes += frame.size;
+        ++frames;
+    }
+
+    void StreamRecorder::Close() {
+        if (stream.is_open()) {
+            stream.close();
+        }
+        if (index.is_open()) {
+            index.close();
+        }
+        if (timing.is_open()) {
+            timing.close();
+            spdlog::info("Record: {0} frames written to {1}", frames, path);
+        }
+    }
+
+    std::string ImpairmentProfile::Describe() const {
+        return fmt::format("seed={0},jitter={1},burst={2}:{3},stall={4}:{5},loss={6}",
+                           seed, jitterMs, burstProbability, burstFrames, stallProbability, stallMs, lossProbability);
+    }
+
+    bool parse_impairment_profile(const std::string &text, ImpairmentProfile &out) {
+        ImpairmentProfile parsed;
+        // "P:N" for burst / stall
+        auto split_pair = [](const std::string &value, double &probability, double &amount) {
+            auto colon = value.find(':');
+            if (colon == std::string::npos) {
+                return false;
+            }
+            probability = std::stod(value.substr(0, colon));
+            amount = std::stod(value.substr(colon + 1));
+            return true;
+        };
+        std::size_t pos{0};
+        while (pos < text.size()) {
+            auto comma = text.find(',', pos);
+            auto item = text.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+            pos = comma == std::string::npos ? text.size() : comma + 1;
+            auto eq = item.find('=');
+            if (eq == std::string::npos) {
+                spdlog::error("impairment profile: expected key=value, got {0}", item);
+                return false;
+            }
+            auto key = item.substr(0, eq);
+            auto value = item.substr(eq + 1);
+            try {
+                if (key == "seed") {
+                    parsed.seed = std::stoull(value);
+                } else if (key == "jitter") {
+                    parsed.jitterMs = std::max(0., std::stod(value));
+                } else if (key == "burst") {
+                    double frames{0.};
+                    if (!split_pair(value, parsed.burstProbability, frames)) {
+                        spdlog::error("impairment profile: burst expects PROBABILITY:FRAMES, got {0}", value);
+                        return false;
+                    }
+                    parsed.burstFrames = std::max(0, static_cast<int>(frames));
+                } else if (key == "stall") {
+                    if (!split_pair(value, parsed.stallProbability, parsed.stallMs)) {
+                        spdlog::error("impairment profile: stall expects PROBABILITY:MS, got {0}", value);
+                        return false;
+                    }
+                } else if (key == "loss") {
+                    parsed.lossProbability = std::stod(value);
+                } else {
+                    spdlog::error("impairment profile: unknown key {0}", key);
+                    return false;
+                }
+            } catch (const std::exception &) {
+                spdlog::error("impairment profile: bad value for {0}: {1}", key, value);
+                return false;
+            }
+        }
+        for (double p : {parsed.burstProbability, parsed.stallProbability, parsed.lossProbability}) {
+            if (p < 0. || p > 1.) {
+                spdlog::error("impairment profile: probabilities must be within [0, 1]");
+                return false;
+            }
+        }
+        out = parsed;
+        return true;
+    }
+
+    ArrivalImpairer::ArrivalImpairer(ImpairmentProfile p, int64_t frame_interval_us)
+            : profile(p), frameIntervalUs(std::max<int64_t>(frame_interval_us, 1)), state(p.seed) {
+    }
+
+    uint64_t ArrivalImpairer::NextRandom() {
+        // splitmix64
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    double ArrivalImpairer::Uniform() {
+        // 53 random bits in [0, 1)
+        return static_cast<double>(NextRandom() >> 11) * 0x1.0p-53;
+    }
+
+    double ArrivalImpairer::Normal() {
+        double u1 = 1. - Uniform();
+        double u2 = Uniform();
+        return std::sqrt(-2. * std::log(u1)) * std::cos(2. * M_PI * u2);
+    }
+
+    ArrivalImpairer::Arrival ArrivalImpairer::Next(int64_t scheduled_us) {
+        // every frame draws the same numbers whatever the profile enables, so e.g. the lost frames of a
+        // seed stay the same when only the jitter is changed
+        const double loss_draw = Uniform();
+        const double burst_draw = Uniform();
+        const double stall_draw = Uniform();
+        const double jitter_draw = Normal();
+
+        if (scheduled_us > holdUntilUs && profile.burstFrames > 1 && burst_draw < profile.burstProbability) {
+            holdUntilUs = scheduled_us + (profile.burstFrames - 1) * frameIntervalUs;
+            ++stats.bursts;
+        }
+        if (profile.stallMs > 0. && stall_draw < profile.stallProbability) {
+            holdUntilUs = std::max(holdUntilUs, scheduled_us + static_cast<int64_t>(profile.stallMs * 1000.));
+            ++stats.stalls;
+        }
+
+        Arrival a;
+        a.deliverUs = scheduled_us + static_cast<int64_t>(std::fabs(jitter_draw) * profile.jitterMs * 1000.);
+        if (scheduled_us <= holdUntilUs) {
+            a.deliverUs = std::max(a.deliverUs, holdUntilUs);
+        }
+        // one connection, nothing overtakes
+        a.deliverUs = std::max(a.deliverUs, lastDeliverUs);
+        lastDeliverUs = a.deliverUs;
+        a.lost = loss_draw < profile.lossProbability;
+        if (a.lost) {
+            ++stats.lost;
+        } else {
+            double delay_ms = static_cast<double>(a.deliverUs - scheduled_us) / 1000.;
+            stats.maxDelayMs = std::max(stats.maxDelayMs, delay_ms);
+            stats.totalDelayMs += delay_ms;
+        }
+        return a;
+    }
+
+} // tcn
@@ -0,0 +1,126 @@
+#ifndef ORBBEC_CAPTURE_TEST_REPLAYTIMING_H
+#define ORBBEC_CAPTURE_TEST_REPLAYTIMING_H
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace tcn {
+
+    struct EncodedFrame;
+
+    /**
+     * When one frame reached the host, one line of a "<stream>.timing" sidecar.
+     */
+    struct ArrivalRecord {
+        uint64_t index{0};
+        // host steady clock, relative to the first recorded frame
+        int64_t arrivalUs{0};
+        uint64_t deviceTimestampUs{0};
+        uint64_t size{0};
+    };
+
+    // sidecar next to a recorded elementary stream
+    std::string timing_path(const std::string &stream_path);
+
+    bool load_arrival_records(const std::string &path, std::vector<ArrivalRecord> &out);
+
+    /**
+     * Writes received frames as an Annex-B elementary stream plus their arrival times, so a
+     * replay can reproduce the exact inter-arrival pattern of the recorded network session.
+     * The keyframe index (index_path) is written alongside, so replays can seek without a scan.
+     * Written on the calling (source) thread, arrival times are taken before the write.
+     */
+    class StreamRecorder {
+    public:
+        bool Open(const std::string &path);
+        void Write(const EncodedFrame &frame, std::chrono::steady_clock::time_point arrival);
+        void Close();
+
+        uint64_t Frames() const { return frames; }
+
+    private:
+        std::string path;
+        std::ofstream stream;
+        std::ofstream timing;
+        std::ofstream index;
+        std::vector<char> streamBuffer;
+        uint64_t streamBytes{0};
+        std::chrono::steady_clock::time_point firstArrival;
+        uint64_t frames{0};
+    };
+
+    /**
+     * Synthetic network impairments on top of the replay schedule. Parsed from
+     * "seed=N,jitter=MS,burst=P:FRAMES,stall=P:MS,loss=P", probabilities are per frame.
+     */
+    struct ImpairmentProfile {
+        uint64_t seed{1};
+        // absolute value of a normal distribution with this standard deviation is added to every arrival
+        double jitterMs{0.};
+        // a burst holds back this many frames and releases them together
+        double burstProbability{0.};
+        int burstFrames{0};
+        // nothing arrives for stallMs, then everything held back arrives at once
+        double stallProbability{0.};
+        double stallMs{0.};
+        // the frame never arrives
+        double lossProbability{0.};
+
+        bool Enabled() const {
+            return jitterMs > 0. || (burstProbability > 0. && burstFrames > 1) ||
+                   (stallProbability > 0. && stallMs > 0.) || lossProbability > 0.;
+        }
+
+        std::string Describe() const;
+    };
+
+    bool parse_impairment_profile(const std::string &text, ImpairmentProfile &out);
+
+    /**
+     * Turns scheduled arrival times into impaired ones. The random sequence is generated here
+     * (splitmix64, Box-Muller) instead of by <random> distributions, so a seed gives the same
+     * arrivals with every standard library. Arrivals stay in order, like on a single connection.
+     */
+    class ArrivalImpairer {
+    public:
+        struct Arrival {
+            int64_t deliverUs{0};
+            bool lost{false};
+        };
+
+        struct Stats {
+            uint64_t lost{0};
+            uint64_t bursts{0};
+            uint64_t stalls{0};
+            // delivery after the schedule, milliseconds
+            double maxDelayMs{0.};
+            double totalDelayMs{0.};
+        };
+
+        ArrivalImpairer(ImpairmentProfile profile, int64_t frame_interval_us);
+
+        // scheduled_us must not decrease between calls
+        Arrival Next(int64_t scheduled_us);
+
+        const Stats &GetStats() const { return stats; }
+
+    private:
+        uint64_t NextRandom();
+        double Uniform();
+        double Normal();
+
+        ImpairmentProfile profile;
+        int64_t frameIntervalUs;
+        uint64_t state;
+        // frames scheduled before this are held back until then (burst / stall)
+        int64_t holdUntilUs{-1};
+        int64_t lastDeliverUs{0};
+        Stats stats;
+    };
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_REPLAYTIMING_H
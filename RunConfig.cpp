@@ -0,0 +1,409 @@
+#include "RunConfig.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <iostream>
+#include <set>
+
+namespace tcn {
+
+    namespace {
+        // options that take no value on the command line
+        const std::set<std::string> kFlags{
+                "headless", "unpaced", "pin", "fixed-quality", "drop-any", "lazy-init",
+                "pool-degrade", "sdk-sync", "depth", "no-depth", "parser", "padded-frames", "tensor-bgr", "tensor-fp16",
+                "replay-timing", "offline-unordered", "offline-scaling", "reprobe", "help"
+        };
+
+        std::string trim(const std::string &s) {
+            auto first = s.find_first_not_of(" \t\r");
+            if (first == std::string::npos) {
+                return {};
+            }
+            auto last = s.find_last_not_of(" \t\r");
+            return s.substr(first, last - first + 1);
+        }
+
+        // "a,b,c"
+        bool parse_triplet(const std::string &value, std::array<float, 3> &out) {
+            std::array<float, 3> parsed{};
+            std::size_t pos{0};
+            for (int i = 0; i < 3; ++i) {
+                auto comma = value.find(',', pos);
+                if ((i < 2) != (comma != std::string::npos)) {
+                    return false;
+                }
+                parsed[i] = std::stof(value.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos));
+                pos = comma + 1;
+            }
+            out = parsed;
+            return true;
+        }
+
+        // "threshold,spatial,temporal,hole-fill" in the order they are applied, or "all"
+        bool parse_depth_filters(const std::string &value, std::vector<DepthFilterKind> &out) {
+            if (value == "all") {
+                out = DepthFilterConfig{}.chain;
+                return true;
+            }
+            std::vector<DepthFilterKind> parsed;
+            std::size_t pos{0};
+            while (pos <= value.size()) {
+                auto comma = value.find(',', pos);
+                auto name = value.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+                if (name == "threshold") {
+                    parsed.push_back(DepthFilterKind::threshold);
+                } else if (name == "spatial") {
+                    parsed.push_back(DepthFilterKind::spatial);
+                } else if (name == "temporal") {
+                    parsed.push_back(DepthFilterKind::temporal);
+                } else if (name == "hole-fill") {
+                    parsed.push_back(DepthFilterKind::holeFill);
+                } else {
+                    return false;
+                }
+                if (comma == std::string::npos) {
+                    break;
+                }
+                pos = comma + 1;
+            }
+            out = std::move(parsed);
+            return true;
+        }
+
+        bool parse_flag(const std::string &value, bool &out) {
+            if (value.empty() || value == "true" || value == "1" || value == "yes" || value == "on") {
+                out = true;
+            } else if (value == "false" || value == "0" || value == "no" || value == "off") {
+                out = false;
+            } else {
+                return false;
+            }
+            return true;
+        }
+    }
+
+    const char *codec_name(OBFormat format) {
+        switch (format) {
+            case OB_FORMAT_H264:
+                return "h264";
+            case OB_FORMAT_H265:
+            case OB_FORMAT_HEVC:
+                return "h265";
+            case OB_FORMAT_MJPG:
+                return "mjpeg";
+            case OB_FORMAT_YUYV:
+            case OB_FORMAT_YUY2:
+                return "yuyv";
+            default:
+                return "unknown";
+        }
+    }
+
+    OBFormat codec_from_path(const std::string &path, OBFormat fallback) {
+        auto dot = path.rfind('.');
+        if (dot == std::string::npos || path.find('/', dot) != std::string::npos) {
+            return fallback;
+        }
+        const std::string ext = path.substr(dot + 1);
+        if (ext == "h264" || ext == "264") {
+            return OB_FORMAT_H264;
+        } else if (ext == "h265" || ext == "265" || ext == "hevc") {
+            return OB_FORMAT_H265;
+        } else if (ext == "mjpeg" || ext == "mjpg") {
+            return OB_FORMAT_MJPG;
+        } else if (ext == "yuyv") {
+            return OB_FORMAT_YUYV;
+        }
+        return fallback;
+    }
+
+    bool apply_run_option(RunConfig &cfg, const std::string &key, const std::string &value) {
+        bool flag{true};
+        if (kFlags.count(key) && !parse_flag(value, flag)) {
+            spdlog::error("option {0}: expected a boolean, got {1}", key, value);
+            return false;
+        }
+        try {
+            if (key == "headless") {
+                cfg.display = !flag;
+            } else if (key == "sink") {
+                if (value == "display") {
+                    cfg.display = true;
+                } else if (value == "none") {
+                    cfg.display = false;
+                } else {
+                    spdlog::error("option sink: expected display or none, got {0}", value);
+                    return false;
+                }
+            } else if (key == "unpaced") {
+                cfg.unpaced = flag;
+            } else if (key == "pin") {
+                cfg.pinThreads = flag;
+            } else if (key == "rt-priority") {
+                cfg.rtPriority = std::stoi(value);
+            } else if (key == "nice") {
+                cfg.niceValue = std::stoi(value);
+            } else if (key == "fixed-quality") {
+                cfg.adaptiveQuality = !flag;
+            } else if (key == "drop-any") {
+                cfg.dropMode = flag ? DropMode::any : DropMode::keyframe;
+            } else if (key == "lazy-init") {
+                cfg.eagerInit = !flag;
+            } else if (key == "decoder-pool") {
+                cfg.poolWorkers = std::stoi(value);
+            } else if (key == "pool-capacity") {
+                cfg.poolCapacityMpxPerSec = std::stod(value);
+            } else if (key == "pool-degrade") {
+                cfg.poolOverload = flag ? vpf::OverloadPolicy::degrade : vpf::OverloadPolicy::queue;
+            } else if (key == "parser") {
+                cfg.parserBypass = !flag;
+            } else if (key == "padded-frames") {
+                cfg.paddedFrames = flag;
+            } else if (key == "sdk-sync") {
+                cfg.hostSync = !flag;
+            } else if (key == "sync-tolerance") {
+                cfg.syncToleranceUs = std::stoull(value);
+            } else if (key == "queue-mb") {
+                cfg.queueMegabytes = std::max(0., std::stod(value));
+            } else if (key == "memory-budget-mb") {
+                cfg.memoryBudgetMegabytes = std::max(0., std::stod(value));
+            } else if (key == "drain-ms") {
+                cfg.drainTimeoutMs = std::max(0, std::stoi(value));
+            } else if (key == "tensor") {
+                auto x = value.find('x');
+                if (x == std::string::npos) {
+                    spdlog::error("option tensor: expected WIDTHxHEIGHT, got {0}", value);
+                    return false;
+                }
+                cfg.tensorOutput = true;
+                cfg.tensor.width = std::stoi(value.substr(0, x));
+                cfg.tensor.height = std::stoi(value.substr(x + 1));
+            } else if (key == "tensor-mean" || key == "tensor-std") {
+                if (!parse_triplet(value, key == "tensor-mean" ? cfg.tensor.mean : cfg.tensor.std)) {
+                    spdlog::error("option {0}: expected three comma separated values, got {1}", key, value);
+                    return false;
+                }
+            } else if (key == "tensor-bgr") {
+                cfg.tensor.rgb = !flag;
+            } else if (key == "tensor-fp16") {
+                cfg.tensor.fp16 = flag;
+            } else if (key == "depth-filter") {
+                if (!parse_depth_filters(value, cfg.depthFilterConfig.chain)) {
+                    spdlog::error("option depth-filter: expected all or a list of threshold, spatial, temporal, "
+                                  "hole-fill, got {0}", value);
+                    return false;
+                }
+                cfg.depthFilter = true;
+            } else if (key == "depth-range") {
+                auto comma = value.find(',');
+                if (comma == std::string::npos) {
+                    spdlog::error("option depth-range: expected MIN,MAX, got {0}", value);
+                    return false;
+                }
+                cfg.depthFilterConfig.minDepth = static_cast<uint16_t>(std::clamp(std::stoi(value.substr(0, comma)), 0, 65535));
+                cfg.depthFilterConfig.maxDepth = static_cast<uint16_t>(std::clamp(std::stoi(value.substr(comma + 1)), 0, 65535));
+            } else if (key == "depth-workers") {
+                cfg.depthFilterConfig.workers = std::max(0, std::stoi(value));
+            } else if (key == "record") {
+                cfg.recordPrefix = value;
+            } else if (key == "replay-timing") {
+                cfg.replayTiming = flag;
+            } else if (key == "impair") {
+                if (!parse_impairment_profile(value, cfg.impairment)) {
+                    return false;
+                }
+            } else if (key == "replay-start") {
+                cfg.replayStart = std::stoull(value);
+            } else if (key == "offline") {
+                cfg.offlinePath = value;
+            } else if (key == "offline-workers") {
+                cfg.offlineWorkers = std::max(0, std::stoi(value));
+            } else if (key == "offline-unordered") {
+                cfg.offlineOrdered = !flag;
+            } else if (key == "offline-scaling") {
+                cfg.offlineScaling = flag;
+            } else if (key == "backend") {
+                if (value != "auto" && value != "software" && av_hwdevice_find_type_by_name(value.c_str()) == AV_HWDEVICE_TYPE_NONE) {
+                    spdlog::error("option backend: expected auto, software or an ffmpeg device type, got {0}", value);
+                    return false;
+                }
+                cfg.backend = value;
+            } else if (key == "probe-sample") {
+                cfg.probeSample = value;
+            } else if (key == "backend-cache") {
+                cfg.backendCache = value;
+            } else if (key == "reprobe") {
+                cfg.reprobe = flag;
+            } else if (key == "display-fps") {
+                cfg.displayFps = std::max(1., std::stod(value));
+            } else if (key == "display-scale") {
+                cfg.displayScale = std::stod(value);
+            } else if (key == "frames") {
+                cfg.frameLimit = std::stoull(value);
+            } else if (key == "duration") {
+                cfg.durationSeconds = std::stod(value);
+            } else if (key == "codec") {
+                if (value == "h264") {
+                    cfg.codec = OB_FORMAT_H264;
+                } else if (value == "h265" || value == "hevc") {
+                    cfg.codec = OB_FORMAT_H265;
+                } else if (value == "mjpeg" || value == "mjpg") {
+                    cfg.codec = OB_FORMAT_MJPG;
+                } else if (value == "yuyv") {
+                    cfg.codec = OB_FORMAT_YUYV;
+                } else {
+                    spdlog::error("option codec: expected h264, h265, mjpeg or yuyv, got {0}", value);
+                    return false;
+                }
+            } else if (key == "resolution") {
+                auto x = value.find('x');
+                if (x == std::string::npos) {
+                    spdlog::error("option resolution: expected WIDTHxHEIGHT, got {0}", value);
+                    return false;
+                }
+                cfg.width = static_cast<uint32_t>(std::stoul(value.substr(0, x)));
+                cfg.height = static_cast<uint32_t>(std::stoul(value.substr(x + 1)));
+            } else if (key == "fps") {
+                cfg.fps = static_cast<uint32_t>(std::stoul(value));
+            } else if (key == "depth") {
+                cfg.depth = flag;
+            } else if (key == "no-depth") {
+                cfg.depth = !flag;
+            } else if (key == "device") {
+                cfg.deviceIps.push_back(value);
+            } else if (key == "replay") {
+                cfg.replayFiles.push_back(value);
+            } else if (key == "report") {
+                cfg.reportPath = value;
+            } else if (key == "config") {
+                return load_run_config(value, cfg);
+            } else if (key == "help") {
+                cfg.showHelp = flag;
+            } else {
+                spdlog::error("unknown option: {0}", key);
+                return false;
+            }
+        } catch (const std::exception &) {
+            spdlog::error("option {0}: invalid value {1}", key, value);
+            return false;
+        }
+        return true;
+    }
+
+    bool load_run_config(const std::string &path, RunConfig &cfg) {
+        std::ifstream in(path);
+        if (!in) {
+            spdlog::error("cannot open config file {0}", path);
+            return false;
+        }
+        std::string line;
+        int line_no{0};
+        while (std::getline(in, line)) {
+            ++line_no;
+            auto comment = line.find('#');
+            if (comment != std::string::npos) {
+                line.erase(comment);
+            }
+            line = trim(line);
+            if (line.empty()) {
+                continue;
+            }
+            auto eq = line.find('=');
+            std::string key = trim(line.substr(0, eq));
+            std::string value = eq == std::string::npos ? std::string{} : trim(line.substr(eq + 1));
+            if (!apply_run_option(cfg, key, value)) {
+                spdlog::error("{0}:{1}: invalid entry", path, line_no);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool parse_run_args(int argc, char **argv, RunConfig &cfg) {
+        cfg.interactive = argc <= 1;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "-h") {
+                arg = "--help";
+            }
+            if (arg.rfind("--", 0) != 0) {
+                cfg.deviceIps.push_back(arg);
+                continue;
+            }
+            std::string key = arg.substr(2);
+            std::string value;
+            auto eq = key.find('=');
+            if (eq != std::string::npos) {
+                value = key.substr(eq + 1);
+                key.erase(eq);
+            } else if (!kFlags.count(key)) {
+                if (i + 1 >= argc) {
+                    spdlog::error("option {0} needs a value", arg);
+                    return false;
+                }
+                value = argv[++i];
+            }
+            if (!apply_run_option(cfg, key, value)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void print_usage(const char *prog) {
+        std::cout << "usage: " << prog << " [--config FILE] [--headless] [--frames N] [--duration SECONDS] [--report FILE]\n"
+                  << "       [--codec h264|h265|mjpeg|yuyv] [--resolution WxH] [--fps N] [--depth|--no-depth] [--sink display|none]\n"
+                  << "       [--unpaced] [--pin] [--rt-priority N] [--nice N]\n"
+                  << "       [--lazy-init] [--drop-any] [--fixed-quality] [--decoder-pool WORKERS] [--pool-capacity MPX_PER_S] [--pool-degrade]\n"
+                  << "       [--parser] [--padded-frames] [--sdk-sync] [--sync-tolerance US] [--display-fps N] [--display-scale F]\n"
+                  << "       [--queue-mb MB] [--memory-budget-mb MB] [--drain-ms MS]\n"
+                  << "       [--backend auto|software|DEVICE] [--probe-sample FILE] [--backend-cache FILE] [--reprobe]\n"
+                  << "       [--tensor WxH] [--tensor-mean R,G,B] [--tensor-std R,G,B] [--tensor-bgr] [--tensor-fp16]\n"
+                  << "       [--depth-filter all|LIST] [--depth-range MIN,MAX] [--depth-workers N]\n"
+                  << "       [--record PREFIX] [--replay-timing] [--impair PROFILE] [--replay-start FRAME]\n"
+                  << "       [--replay FILE]... [DEVICE_IP]...\n"
+                  << "   or: " << prog << " --offline FILE [--offline-workers N] [--offline-unordered] [--offline-scaling]\n"
+                  << "  without arguments the device ip and depth mode are read interactively.\n"
+                  << "  --config reads \"option = value\" lines (long option names, flags take true / false),\n"
+                  << "    later command line options override the file.\n"
+                  << "  --frames / --duration end the run at whichever limit is reached first (0 = no limit).\n"
+                  << "  --depth is the default for devices, as in interactive mode; --no-depth streams color only.\n"
+                  << "  --report writes a json throughput / latency report at exit.\n"
+                  << "  --pin places each pipeline on its own block of cpus (and the numa node of that block).\n"
+                  << "  --decoder-pool decodes all streams on one shared worker pool (0 = one worker per cpu).\n"
+                  << "  --parser runs every frame through the bitstream parser (fragmented streams), by default complete\n"
+                  << "    access units go straight to the codec. --padded-frames decodes SDK frame memory without a copy.\n"
+                  << "  --sync-tolerance pairs color and depth on the host within this device timestamp distance,\n"
+                  << "    --sdk-sync uses the SDK frame sync instead (incomplete framesets are skipped).\n"
+                  << "  --queue-mb bounds the memory of each pipeline's queued frames, --memory-budget-mb the memory of\n"
+                  << "    all queued frames together; a full budget drops (live) or blocks the source (--unpaced).\n"
+                  << "  --drain-ms is how long stopping pipelines still decode queued frames (default 200, 0 = discard).\n"
+                  << "  --tensor delivers WxH planar float tensors ((x / 255 - mean) / std per channel, RGB unless\n"
+                  << "    --tensor-bgr, float16 with --tensor-fp16) straight from the decoded planes, implies no display.\n"
+                  << "  --depth-filter runs the depth frames through threshold, spatial, temporal and hole-fill filters\n"
+                  << "    (comma separated, in that order unless listed otherwise) on their own threads and shows them\n"
+                  << "    next to the color stream. --depth-range is the valid depth in mm (default 100,10000),\n"
+                  << "    --depth-workers the threads per stream (default half the stream's share of the cpus).\n"
+                  << "  --codec mjpeg decodes JPEG frames in software if the device type has no jpeg decoder, yuyv is\n"
+                  << "    converted to BGR directly. with several formats in one run their latencies are compared.\n"
+                  << "  --record writes each device stream to PREFIX[-N].h264|h265|mjpeg|yuyv and its frame arrival times\n"
+                  << "    to FILE.timing. replays take the format from that extension, --codec otherwise, raw yuyv the\n"
+                  << "    frame size from --resolution. --replay-timing replays FILE at the arrival times in FILE.timing.\n"
+                  << "  --impair adds seeded network impairments to replays, \"seed=N,jitter=MS,burst=P:FRAMES,\n"
+                  << "    stall=P:MS,loss=P\" (per frame probabilities), the same seed gives the same arrivals.\n"
+                  << "  --replay-start starts replays at this frame, decoding from the nearest keyframe before it. the\n"
+                  << "    keyframe index is read from FILE.index (written by --record, otherwise scanned once and saved).\n"
+                  << "  --offline decodes a recorded file (raw stream or container) as fast as possible, whole GOPs in\n"
+                  << "    parallel on --offline-workers codec contexts (default one per cpu). frames are consumed in file\n"
+                  << "    order unless --offline-unordered, --offline-scaling repeats the run for 1, 2, 4, ... workers.\n"
+                  << "  --backend auto tries the hardware decoders of the platform, then multithreaded software decoding,\n"
+                  << "    and times each on --probe-sample (default the first replay file) to pick the fastest. the result\n"
+                  << "    is cached per host and build in --backend-cache (default ~/.cache/orbbec_capture_test/backends),\n"
+                  << "    later starts use it without probing. --reprobe probes again.\n"
+                  << "  --display-fps refreshes the windows at this rate with the latest decoded image (default 30).\n";
+    }
+
+} // tcn
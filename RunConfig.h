@@ -0,0 +1,110 @@
+#ifndef ORBBEC_CAPTURE_TEST_RUNCONFIG_H
+#define ORBBEC_CAPTURE_TEST_RUNCONFIG_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "libobsensor/ObSensor.hpp"
+
+#include "DecoderService.h"
+#include "DepthFilter.h"
+#include "FrameDropPolicy.h"
+
+namespace tcn {
+
+    /**
+     * Everything a run is configured with. Filled from the command line and / or a config file
+     * with one "key = value" per line, where the keys are the long option names without dashes.
+     */
+    struct RunConfig {
+        // sources
+        std::vector<std::string> deviceIps;
+        std::vector<std::string> replayFiles;
+        // stream profile requested from devices, codec also selects the replay bitstream format
+        // unless the file extension names one (codec_from_path). mjpeg / yuyv skip the video codec path
+        OBFormat codec{OB_FORMAT_H264};
+        uint32_t width{2560};
+        uint32_t height{1440};
+        uint32_t fps{25};
+        // depth stream next to color, on by default like the interactive prompt
+        bool depth{true};
+        // run length, whichever limit is reached first; 0 disables a limit
+        uint64_t frameLimit{500};
+        double durationSeconds{0.};
+        // sinks
+        bool display{true};
+        double displayFps{30.};
+        double displayScale{1.};
+        std::string reportPath;
+
+        bool unpaced{false};
+        bool pinThreads{false};
+        int rtPriority{0};
+        int niceValue{0};
+        // -1 = one decoder thread per pipeline
+        int poolWorkers{-1};
+        double poolCapacityMpxPerSec{0.};
+        vpf::OverloadPolicy poolOverload{vpf::OverloadPolicy::queue};
+        bool eagerInit{true};
+        DropMode dropMode{DropMode::keyframe};
+        // quality ladder of live and paced streams, --unpaced runs always decode at full quality
+        bool adaptiveQuality{true};
+        bool parserBypass{true};
+        bool paddedFrames{false};
+        bool hostSync{true};
+        uint64_t syncToleranceUs{20000};
+        // frame queue memory in MB per pipeline and shared by all pipelines, 0 = no byte limit
+        double queueMegabytes{0.};
+        double memoryBudgetMegabytes{0.};
+        // how long stopping pipelines keep decoding queued frames, 0 = discard them
+        int drainTimeoutMs{200};
+        // deliver normalized planar float tensors instead of BGR images (no display)
+        bool tensorOutput{false};
+        vpf::TensorConfig tensor;
+        // filter device depth frames and show them next to the color stream
+        bool depthFilter{false};
+        DepthFilterConfig depthFilterConfig;
+        // device streams are recorded to "<prefix>.<codec>" with arrival timing for later timed replays
+        std::string recordPrefix;
+        // replay at the recorded arrival times instead of the nominal fps, plus synthetic impairments
+        bool replayTiming{false};
+        ImpairmentProfile impairment;
+        // replays start at this frame, reached through the keyframe index
+        uint64_t replayStart{0};
+        // decode this recorded file GOP-parallel instead of running capture pipelines
+        std::string offlinePath;
+        int offlineWorkers{0};
+        bool offlineOrdered{true};
+        // repeat the offline decode with 1, 2, 4, ... workers up to offlineWorkers
+        bool offlineScaling{false};
+        // decode backend: "auto" probes (or takes the cached profile), "software", or an ffmpeg device type name
+        std::string backend{"auto"};
+        // raw recording the probe times the candidates on, defaults to the first replay file
+        std::string probeSample;
+        // empty = vpf::default_backend_cache_path()
+        std::string backendCache;
+        bool reprobe{false};
+
+        // no source given on a bare command line, ask on stdin
+        bool interactive{false};
+        bool showHelp{false};
+    };
+
+    // applies one option (long name without dashes), flags accept an empty value as true
+    bool apply_run_option(RunConfig &cfg, const std::string &key, const std::string &value);
+
+    bool load_run_config(const std::string &path, RunConfig &cfg);
+
+    // options are applied in order, so options after --config FILE override the file
+    bool parse_run_args(int argc, char **argv, RunConfig &cfg);
+
+    void print_usage(const char *prog);
+
+    const char *codec_name(OBFormat format);
+    // format of a recording named "<prefix>.<codec>", fallback for other extensions
+    OBFormat codec_from_path(const std::string &path, OBFormat fallback);
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_RUNCONFIG_H
@@ -0,0 +1,186 @@
+#include "RunReport.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <thread>
+
+namespace tcn {
+
+    namespace {
+        std::string json_string(const std::string &s) {
+            std::string out{"\""};
+            for (char c : s) {
+                switch (c) {
+                    case '"':
+                        out += "\\\"";
+                        break;
+                    case '\\':
+                        out += "\\\\";
+                        break;
+                    case '\n':
+                        out += "\\n";
+                        break;
+                    case '\t':
+                        out += "\\t";
+                        break;
+                    default:
+                        if (static_cast<unsigned char>(c) < 0x20) {
+                            out += fmt::format("\\u{0:04x}", static_cast<int>(c));
+                        } else {
+                            out += c;
+                        }
+                }
+            }
+            return out + "\"";
+        }
+
+        std::string json_summary(const SampleSummary &s) {
+            return fmt::format(R"({{"count": {0}, "mean": {1:.4f}, "stddev": {2:.4f}, "min": {3:.4f}, "max": {4:.4f}}})",
+                               s.count, s.mean, s.stddev, s.min, s.max);
+        }
+
+        std::string utc_timestamp() {
+            std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            std::tm tm{};
+#if defined(_WIN32)
+            gmtime_s(&tm, &now);
+#else
+            gmtime_r(&now, &tm);
+#endif
+            char buf[32];
+            std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+            return buf;
+        }
+    }
+
+    bool write_run_report(const std::string &path, const RunConfig &cfg,
+                          const std::vector<PipelineReport> &pipelines, double wall_seconds) {
+        std::ofstream out(path);
+        if (!out) {
+            spdlog::error("cannot write report {0}", path);
+            return false;
+        }
+        uint64_t received{0}, dropped{0}, decoded{0};
+        for (const auto &p : pipelines) {
+            received += p.receivedFrames;
+            dropped += p.droppedFrames;
+            decoded += p.decodedFrames;
+        }
+
+        std::string depth_filter{"null"};
+        if (cfg.depthFilter) {
+            depth_filter = "[";
+            for (auto kind : cfg.depthFilterConfig.chain) {
+                depth_filter += (depth_filter.size() > 1 ? ", " : "") + json_string(depth_filter_name(kind));
+            }
+            depth_filter += "]";
+        }
+
+        out << "{\n";
+        out << fmt::format("  \"version\": 1,\n  \"timestamp\": {0},\n  \"build\": {1},\n  \"cpus\": {2},\n",
+                           json_string(utc_timestamp()), json_string(std::string(__DATE__) + " " + __TIME__),
+                           std::thread::hardware_concurrency());
+        out << fmt::format("  \"config\": {{\"codec\": {0}, \"width\": {1}, \"height\": {2}, \"fps\": {3}, \"depth\": {4}, "
+                           "\"frame_limit\": {5}, \"duration_s\": {6}, \"display\": {7}, \"unpaced\": {8}, "
+                           "\"decoder_pool\": {9}, \"eager_init\": {10}, \"adaptive_quality\": {11}, \"drop_mode\": {12}, "
+                           "\"parser_bypass\": {13}, \"queue_mb\": {14}, \"memory_budget_mb\": {15}, \"drain_ms\": {16}, \"tensor\": {17}, "
+                           "\"depth_filter\": {18}, \"replay_timing\": {19}, \"impairment\": {20}}},\n",
+                           json_string(codec_name(cfg.codec)), cfg.width, cfg.height, cfg.fps, cfg.depth,
+                           cfg.frameLimit, cfg.durationSeconds, cfg.display, cfg.unpaced,
+                           cfg.poolWorkers, cfg.eagerInit, cfg.adaptiveQuality,
+                           json_string(cfg.dropMode == DropMode::any ? "any" : "keyframe"), cfg.parserBypass,
+                           cfg.queueMegabytes, cfg.memoryBudgetMegabytes, cfg.drainTimeoutMs,
+                           cfg.tensorOutput ? fmt::format("{{\"width\": {0}, \"height\": {1}, \"fp16\": {2}}}",
+                                                          cfg.tensor.width, cfg.tensor.height, cfg.tensor.fp16)
+                                            : std::string{"null"},
+                           depth_filter, json_string(!cfg.replayTiming ? "fps" : "recorded"),
+                           cfg.impairment.Enabled() ? json_string(cfg.impairment.Describe()) : std::string{"null"});
+        out << "  \"pipelines\": [";
+        for (size_t i = 0; i < pipelines.size(); ++i) {
+            const auto &p = pipelines[i];
+            out << (i == 0 ? "\n" : ",\n");
+            out << "    {";
+            out << fmt::format("\"name\": {0}, \"codec\": {1}, \"width\": {2}, \"height\": {3}, \"fps_nominal\": {4}, ",
+                               json_string(p.name), json_string(codec_name(p.stream.format)),
+                               p.stream.width, p.stream.height, p.stream.fps);
+            out << fmt::format("\"received\": {0}, \"dropped\": {1}, \"decoded\": {2}, \"fps\": {3:.3f}, \"format_changes\": {4}, ",
+                               p.receivedFrames, p.droppedFrames, p.decodedFrames, p.fps, p.formatChanges);
+            out << fmt::format("\"drops\": {{\"non_reference\": {0}, \"gop_tail\": {1}, \"resyncs\": {2}}}, ",
+                               p.drops.nonReferenceDrops, p.drops.gopTailDrops, p.drops.resyncs);
+            out << fmt::format("\"recovery\": {{\"errors\": {0}, \"recoveries\": {1}, \"reopens\": {2}, \"discarded_packets\": {3}, "
+                               "\"corrupted_frames\": {4}, \"concealed_frames\": {5}, \"max_ms\": {6:.3f}, \"total_ms\": {7:.3f}}}, ",
+                               p.recovery.errors, p.recovery.recoveries, p.recovery.reopens, p.recovery.discardedPackets,
+                               p.recovery.corruptedFrames, p.recovery.concealedFrames, p.recovery.maxRecoveryMs,
+                               p.recovery.totalRecoveryMs);
+            out << fmt::format("\"loss\": {{\"expected\": {0}, \"delivered\": {1}, \"network\": {2}, \"source\": {3}, "
+                               "\"policy\": {4}, \"queue\": {5}, \"decode\": {6}, \"rate\": {7:.6f}, \"peak_rolling_rate\": {8:.6f}}}, ",
+                               p.loss.expected, p.loss.delivered, p.loss.network, p.loss.source, p.loss.policy,
+                               p.loss.queue, p.loss.decode, p.loss.Rate(), p.lossPeakRollingRate);
+            out << fmt::format("\"queue_peak_bytes\": {0}, ", p.queuePeakBytes);
+            out << fmt::format("\"depth_filter\": {{\"filtered\": {0}, \"dropped\": {1}}}, ", p.depthFiltered, p.depthDropped);
+            out << fmt::format("\"shutdown\": {{\"stop_ms\": {0:.3f}, \"discarded\": {1}, \"flushed\": {2}}}, ",
+                               p.stopMs, p.stopDiscards, p.stopFlushed);
+            out << fmt::format("\"decode_ms\": {0}, \"decode_p50_ms\": {1:.4f}, \"decode_p95_ms\": {2:.4f}, \"decode_p99_ms\": {3:.4f}, ",
+                               json_summary(p.decode), p.decodeP50, p.decodeP95, p.decodeP99);
+            out << fmt::format("\"output_interval_ms\": {0}, \"output_interval_p99_ms\": {1:.4f}, ",
+                               json_summary(p.outputInterval), p.outputIntervalP99);
+            out << fmt::format("\"latency_ms\": {0}, \"latency_p99_ms\": {1:.4f}, ",
+                               json_summary(p.latency), p.latencyP99);
+            out << fmt::format("\"startup_ms\": {{\"open\": {0:.3f}, \"decoder_ready\": {1:.3f}, \"first_frame\": {2:.3f}, \"first_image\": {3:.3f}}}",
+                               p.openMs, p.decoderReadyMs, p.firstFrameMs, p.firstImageMs);
+            out << "}";
+        }
+        out << (pipelines.empty() ? "],\n" : "\n  ],\n");
+        out << fmt::format("  \"aggregate\": {{\"pipelines\": {0}, \"received\": {1}, \"dropped\": {2}, \"decoded\": {3}, "
+                           "\"wall_s\": {4:.3f}, \"fps\": {5:.3f}}}\n",
+                           pipelines.size(), received, dropped, decoded, wall_seconds,
+                           wall_seconds > 0. ? double(decoded) / wall_seconds : 0.);
+        out << "}\n";
+        if (!out) {
+            spdlog::error("error writing report {0}", path);
+            return false;
+        }
+        spdlog::info("report written to {0}", path);
+        return true;
+    }
+
+    void report_latency_comparison(const std::vector<PipelineReport> &pipelines) {
+        struct FormatLatency {
+            std::size_t pipelines{0};
+            uint64_t frames{0};
+            // frame weighted sums, milliseconds
+            double latency{0.};
+            double decode{0.};
+            double latencyP99{0.};
+            double decodeP99{0.};
+        };
+        std::map<std::string, FormatLatency> formats;
+        for (const auto &p : pipelines) {
+            if (p.latency.count == 0) {
+                continue;
+            }
+            auto &f = formats[codec_name(p.stream.format)];
+            const auto n = static_cast<double>(p.latency.count);
+            f.pipelines++;
+            f.frames += p.latency.count;
+            f.latency += p.latency.mean * n;
+            f.decode += p.decode.mean * n;
+            f.latencyP99 = std::max(f.latencyP99, p.latencyP99);
+            f.decodeP99 = std::max(f.decodeP99, p.decodeP99);
+        }
+        if (formats.size() < 2) {
+            return;
+        }
+        for (const auto &[name, f] : formats) {
+            const auto n = static_cast<double>(f.frames);
+            spdlog::info("latency {0:>6}: {1} pipelines, {2} frames, latency mean {3:.2f}ms p99 {4:.2f}ms, "
+                         "decode mean {5:.2f}ms p99 {6:.2f}ms",
+                         name, f.pipelines, f.frames, f.latency / n, f.latencyP99, f.decode / n, f.decodeP99);
+        }
+    }
+
+} // tcn
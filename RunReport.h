@@ -0,0 +1,25 @@
+#ifndef ORBBEC_CAPTURE_TEST_RUNREPORT_H
+#define ORBBEC_CAPTURE_TEST_RUNREPORT_H
+
+#include <string>
+#include <vector>
+
+#include "CapturePipeline.h"
+#include "RunConfig.h"
+
+namespace tcn {
+
+    /**
+     * Writes the run configuration and per-pipeline throughput / latency results as json,
+     * so runs of different builds can be compared by scripts.
+     */
+    bool write_run_report(const std::string &path, const RunConfig &cfg,
+                          const std::vector<PipelineReport> &pipelines, double wall_seconds);
+
+    // capture to image latency and decode time side by side, one line per stream format
+    // when the run mixes formats (e.g. the same scene replayed as .h264, .mjpeg and .yuyv)
+    void report_latency_comparison(const std::vector<PipelineReport> &pipelines);
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_RUNREPORT_H
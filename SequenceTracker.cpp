@@ -0,0 +1,87 @@
+#include "SequenceTracker.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace tcn {
+
+    namespace {
+        // the rolling window is kept as cumulative samples this far apart
+        constexpr std::chrono::milliseconds kSampleInterval{250};
+    }
+
+    double LossCounters::Rate() const {
+        return expected > 0 ? double(Lost()) / double(expected) : 0.;
+    }
+
+    SequenceTracker::SequenceTracker(std::string name, int window_ms, double warn_rate)
+            : name(std::move(name)), window(std::max(window_ms, 1)), warnRate(warn_rate) {}
+
+    uint64_t SequenceTracker::OnArrival(uint64_t index, bool discontinuity, std::chrono::steady_clock::time_point ts) {
+        uint64_t missing{0};
+        if (started && !discontinuity && index > lastIndex) {
+            missing = index - lastIndex - 1;
+        } else if (started && !discontinuity) {
+            // device restart or a replay loop, the sequence starts over
+            spdlog::info("{0}: frame index went from {1} to {2}, restarting the sequence", name, lastIndex, index);
+        }
+        started = true;
+        lastIndex = index;
+        gaps += missing;
+        ++received;
+        UpdateRollingRate(ts);
+        return missing;
+    }
+
+    LossCounters SequenceTracker::Counters() const {
+        LossCounters c;
+        const uint64_t n_received = received;
+        const uint64_t n_gaps = gaps;
+        c.expected = n_received + n_gaps;
+        c.delivered = delivered;
+        // discarded frames leave a gap in the index once the next frame arrives
+        c.source = std::min<uint64_t>(sourceDiscards, n_gaps);
+        c.network = n_gaps - c.source;
+        c.policy = policyDrops + decoderSkips;
+        c.queue = queueDrops;
+        const uint64_t accounted = c.policy + c.queue + c.delivered;
+        c.decode = n_received > accounted ? n_received - accounted : 0;
+        return c;
+    }
+
+    void SequenceTracker::UpdateRollingRate(std::chrono::steady_clock::time_point ts) {
+        if (!samples.empty() && ts - samples.back().ts < kSampleInterval) {
+            return;
+        }
+        const auto c = Counters();
+        samples.push_back(Sample{ts, c.expected, c.Lost()});
+        while (samples.size() > 2 && ts - samples[1].ts >= window) {
+            samples.pop_front();
+        }
+        const auto &first = samples.front();
+        if (c.expected <= first.expected) {
+            return;
+        }
+        const double rate = double(c.Lost() - std::min(c.Lost(), first.lost)) / double(c.expected - first.expected);
+        rollingRate = rate;
+        if (rate > peakRollingRate) {
+            peakRollingRate = rate;
+        }
+        if (rate >= warnRate && ts - lastWarnTs >= window) {
+            lastWarnTs = ts;
+            spdlog::warn("{0}: losing {1:.1f}% of frames over the last {2}ms, totals - network: {3} source: {4} "
+                         "policy: {5} queue: {6} decode: {7}",
+                         name, rate * 100., window.count(), c.network, c.source, c.policy, c.queue, c.decode);
+        }
+    }
+
+    void SequenceTracker::Report() const {
+        const auto c = Counters();
+        spdlog::info("{0}: frame loss - expected: {1} delivered: {2} lost: {3} ({4:.2f}%), network: {5} source: {6} "
+                     "policy: {7} queue: {8} decode: {9}, rolling loss last: {10:.2f}% peak: {11:.2f}%",
+                     name, c.expected, c.delivered, c.Lost(), c.Rate() * 100., c.network, c.source,
+                     c.policy, c.queue, c.decode, rollingRate.load() * 100., peakRollingRate.load() * 100.);
+    }
+
+} // tcn
@@ -0,0 +1,96 @@
+#ifndef ORBBEC_CAPTURE_TEST_SEQUENCETRACKER_H
+#define ORBBEC_CAPTURE_TEST_SEQUENCETRACKER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+namespace tcn {
+
+    /**
+     * Every frame of a stream that never became an image, by the stage it was lost in.
+     */
+    struct LossCounters {
+        // frames the device produced going by its frame index, missing ones included
+        uint64_t expected{0};
+        uint64_t delivered{0};
+        // index gaps the source does not account for: lost on the network / in the device
+        // (replays: simulated loss)
+        uint64_t network{0};
+        // reached the host, discarded by the source (incomplete framesets, unmatched frame sync)
+        uint64_t source{0};
+        // dropped on purpose under overload (non-reference frames, GOP tails, codec skip_frame)
+        uint64_t policy{0};
+        // queue full past the frame interval, no decoder capacity, discarded on stop
+        uint64_t queue{0};
+        // handed to the decoder without an image coming out (errors, recovery). includes the
+        // frames still in the queue / codec while the stream runs
+        uint64_t decode{0};
+
+        uint64_t Lost() const { return network + source + policy + queue + decode; }
+        // lost / expected
+        double Rate() const;
+    };
+
+    /**
+     * Follows the device frame index of one stream and classifies the frames that are missing from it.
+     * Arrivals and drops are reported from the source callback thread, deliveries from the decoder thread.
+     * The rolling loss rate covers the last window_ms, it is what tells network loss, queue depth and
+     * decode capacity problems apart while a run is going.
+     */
+    class SequenceTracker {
+    public:
+        explicit SequenceTracker(std::string name, int window_ms = 5000, double warn_rate = 0.01);
+
+        // every non-preroll frame the pipeline receives. discontinuity: the index restarts here on purpose (seek),
+        // the jump is not loss. returns the frames missing right before this one
+        uint64_t OnArrival(uint64_t index, bool discontinuity, std::chrono::steady_clock::time_point ts);
+        void OnPolicyDrop() { ++policyDrops; }
+        void OnQueueDrop(uint64_t count = 1) { queueDrops += count; }
+        void OnDelivered() { ++delivered; }
+        // cumulative count of frames the source discarded before handing them on
+        void SetSourceDiscards(uint64_t count) { sourceDiscards = count; }
+        // cumulative count of frames the codec skipped under a reduced quality level, counted as policy
+        void SetDecoderSkips(uint64_t count) { decoderSkips = count; }
+
+        LossCounters Counters() const;
+        double RollingRate() const { return rollingRate; }
+        double PeakRollingRate() const { return peakRollingRate; }
+
+        void Report() const;
+
+    private:
+        struct Sample {
+            std::chrono::steady_clock::time_point ts;
+            uint64_t expected{0};
+            uint64_t lost{0};
+        };
+
+        void UpdateRollingRate(std::chrono::steady_clock::time_point ts);
+
+        std::string name;
+        std::chrono::milliseconds window;
+        double warnRate;
+
+        // written by the source callback thread only
+        bool started{false};
+        uint64_t lastIndex{0};
+        std::deque<Sample> samples;
+        std::chrono::steady_clock::time_point lastWarnTs;
+
+        std::atomic<uint64_t> received{0};
+        std::atomic<uint64_t> gaps{0};
+        std::atomic<uint64_t> sourceDiscards{0};
+        std::atomic<uint64_t> policyDrops{0};
+        std::atomic<uint64_t> decoderSkips{0};
+        std::atomic<uint64_t> queueDrops{0};
+        std::atomic<uint64_t> delivered{0};
+        std::atomic<double> rollingRate{0.};
+        std::atomic<double> peakRollingRate{0.};
+    };
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_SEQUENCETRACKER_H
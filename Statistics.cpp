@@ -0,0 +1,110 @@
+#include "Statistics.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace tcn {
+
+    SampleSummary summarize(const std::vector<double> &v) {
+        SampleSummary s;
+        if (v.empty()) {
+            return s;
+        }
+        double sum = std::accumulate(std::begin(v), std::end(v), 0.0);
+        s.count = v.size();
+        s.mean = sum / v.size();
+
+        double accum = 0.0;
+        std::for_each(std::begin(v), std::end(v), [&](const double d) {
+            accum += (d - s.mean) * (d - s.mean);
+        });
+
+        s.stddev = v.size() > 1 ? std::sqrt(accum / (v.size() - 1)) : 0.0;
+        s.min = *std::min_element(std::begin(v), std::end(v));
+        s.max = *std::max_element(std::begin(v), std::end(v));
+        return s;
+    }
+
+    void report_stats(const std::string &name, const std::vector<double> &v) {
+        if (v.empty()) {
+            spdlog::info("{0} has no measurements", name);
+            return;
+        }
+        auto s = summarize(v);
+        spdlog::info("{0} stats - count: {1} mean: {2}, std-dev: {3}, min: {4}, max: {5}",
+                     name, s.count, s.mean, s.stddev, s.min, s.max);
+    }
+
+    SampleReservoir::SampleReservoir() {
+        samples.reserve(kReservedSamples);
+    }
+
+    void SampleReservoir::Add(double value) {
+        ++seen;
+        const double d = value - mean;
+        mean += d / static_cast<double>(seen);
+        m2 += d * (value - mean);
+        min = seen == 1 ? value : std::min(min, value);
+        max = seen == 1 ? value : std::max(max, value);
+        if (samples.size() < kReservedSamples) {
+            samples.push_back(value);
+            return;
+        }
+        // xorshift, the n-th sample replaces a kept one with probability kReservedSamples / n
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        const uint64_t slot = rng % seen;
+        if (slot < kReservedSamples) {
+            samples[slot] = value;
+        }
+    }
+
+    SampleSummary SampleReservoir::Summary() const {
+        SampleSummary s;
+        s.count = seen;
+        s.mean = mean;
+        s.stddev = seen > 1 ? std::sqrt(m2 / static_cast<double>(seen - 1)) : 0.0;
+        s.min = min;
+        s.max = max;
+        return s;
+    }
+
+    void report_stats(const std::string &name, const SampleReservoir &r) {
+        auto s = r.Summary();
+        if (s.count == 0) {
+            spdlog::info("{0} has no measurements", name);
+            return;
+        }
+        spdlog::info("{0} stats - count: {1} mean: {2}, std-dev: {3}, min: {4}, max: {5}",
+                     name, s.count, s.mean, s.stddev, s.min, s.max);
+    }
+
+    double percentile(std::vector<double> v, double p) {
+        if (v.empty()) {
+            return 0.0;
+        }
+        auto n = static_cast<size_t>(std::clamp(p, 0.0, 1.0) * static_cast<double>(v.size() - 1));
+        std::nth_element(v.begin(), v.begin() + n, v.end());
+        return v[n];
+    }
+
+    void report_jitter(const std::string &name, const std::vector<double> &intervals_ms, double nominal_ms) {
+        if (intervals_ms.empty()) {
+            spdlog::info("{0} jitter has no measurements", name);
+            return;
+        }
+        double period = nominal_ms > 0. ? nominal_ms : summarize(intervals_ms).mean;
+        std::vector<double> deviation;
+        deviation.reserve(intervals_ms.size());
+        for (double d : intervals_ms) {
+            deviation.push_back(std::abs(d - period));
+        }
+        spdlog::info("{0} jitter - period: {1:.3f}ms p50: {2:.3f}ms p99: {3:.3f}ms max: {4:.3f}ms",
+                     name, period, percentile(deviation, 0.5), percentile(deviation, 0.99),
+                     *std::max_element(deviation.begin(), deviation.end()));
+    }
+
+} // tcn
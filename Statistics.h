@@ -0,0 +1,62 @@
+#ifndef ORBBEC_CAPTURE_TEST_STATISTICS_H
+#define ORBBEC_CAPTURE_TEST_STATISTICS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tcn {
+
+    // sample vectors reserve this many entries up front, so recording a sample does not allocate in steady state
+    constexpr std::size_t kReservedSamples{1 << 16};
+
+    struct SampleSummary {
+        size_t count{0};
+        double mean{0.0};
+        double stddev{0.0};
+        double min{0.0};
+        double max{0.0};
+    };
+
+    SampleSummary summarize(const std::vector<double> &v);
+
+    void report_stats(const std::string &name, const std::vector<double> &v);
+
+    double percentile(std::vector<double> v, double p);
+
+    // reports how much successive intervals deviate from the nominal period (or their mean if 0)
+    void report_jitter(const std::string &name, const std::vector<double> &intervals_ms, double nominal_ms = 0.);
+
+    /**
+     * Samples of a run of any length in fixed memory, for the ones recorded inside the decode path.
+     * The summary covers every sample, percentiles come from a uniform subset of at most kReservedSamples
+     * (reservoir sampling). Adding never allocates.
+     */
+    class SampleReservoir {
+    public:
+        SampleReservoir();
+
+        void Add(double value);
+
+        SampleSummary Summary() const;
+        double Percentile(double p) const { return percentile(samples, p); }
+        // the subset kept, every sample until kReservedSamples were added
+        const std::vector<double> &Samples() const { return samples; }
+
+    private:
+        std::vector<double> samples;
+        uint64_t seen{0};
+        // running mean / variance (Welford)
+        double mean{0.};
+        double m2{0.};
+        double min{0.};
+        double max{0.};
+        uint64_t rng{0x9e3779b97f4a7c15ull};
+    };
+
+    void report_stats(const std::string &name, const SampleReservoir &r);
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_STATISTICS_H
@@ -0,0 +1,180 @@
+#include "TensorConverter.h"
+#include "AllocationCounter.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace tcn::vpf {
+
+    void TensorConverter::Axis::Build(int src, int dst) {
+        i0.resize(dst);
+        i1.resize(dst);
+        w.resize(dst);
+        const double ratio = double(src) / double(dst);
+        for (int o = 0; o < dst; ++o) {
+            // pixel centers aligned, like cv::resize INTER_LINEAR
+            double s = std::max(0., (o + 0.5) * ratio - 0.5);
+            int s0 = std::min(static_cast<int>(s), src - 1);
+            i0[o] = s0;
+            i1[o] = std::min(s0 + 1, src - 1);
+            w[o] = static_cast<float>(s - s0);
+        }
+    }
+
+    TensorConverter::TensorConverter(TensorConfig cfg) : config(cfg) {
+        config.width = std::max(1, config.width);
+        config.height = std::max(1, config.height);
+        for (int c = 0; c < 3; ++c) {
+            float stddev = config.std[c] != 0.f ? config.std[c] : 1.f;
+            scale[c] = 1.f / (255.f * stddev);
+            offset[c] = -config.mean[c] / stddev;
+        }
+        if (config.fp16) {
+            rowScratch.resize(3 * static_cast<std::size_t>(config.width));
+        }
+        pool.reserve(config.poolSize);
+    }
+
+    bool TensorConverter::Supports(int pixel_format) {
+        return pixel_format == AV_PIX_FMT_NV12 || pixel_format == AV_PIX_FMT_YUV420P ||
+               pixel_format == AV_PIX_FMT_YUVJ420P;
+    }
+
+    void TensorConverter::Prepare(int src_width, int src_height) {
+        srcWidth = src_width;
+        srcHeight = src_height;
+        lumaX.Build(src_width, config.width);
+        lumaY.Build(src_height, config.height);
+        chromaX.Build((src_width + 1) / 2, config.width);
+        chromaY.Build((src_height + 1) / 2, config.height);
+    }
+
+    cv::Mat TensorConverter::Acquire() {
+        // the pool holds one reference, anything above that is a consumer still using the tensor
+        for (const auto &m : pool) {
+            if (m.u != nullptr && m.u->refcount == 1) {
+                return m;
+            }
+        }
+        int sizes[] = {3, config.height, config.width};
+        cv::Mat m;
+        {
+            // the tensor is handed to the application, like the decoder's output image
+            AllocationIgnoreScope output_allocation;
+            m.create(3, sizes, config.fp16 ? CV_16F : CV_32F);
+        }
+        if (pool.size() < config.poolSize) {
+            pool.push_back(m);
+        } else {
+            ++poolMisses;
+        }
+        return m;
+    }
+
+    bool TensorConverter::Convert(const AVFrame *src, cv::Mat &out) {
+        if (!Supports(src->format)) {
+            spdlog::error("TensorConverter: unsupported pixel format {0}", src->format);
+            return false;
+        }
+        if (src->width != srcWidth || src->height != srcHeight) {
+            Prepare(src->width, src->height);
+        }
+        out = Acquire();
+        if (src->format == AV_PIX_FMT_NV12) {
+            ConvertRows<true>(src, out);
+        } else {
+            ConvertRows<false>(src, out);
+        }
+        return true;
+    }
+
+    template<bool interleavedChroma>
+    void TensorConverter::ConvertRows(const AVFrame *src, cv::Mat &out) {
+        const int w = config.width;
+        const int h = config.height;
+        const std::size_t plane = static_cast<std::size_t>(w) * h;
+
+        // BT.601 unless the stream says BT.709, limited range unless it says full
+        const bool full_range = src->color_range == AVCOL_RANGE_JPEG || src->format == AV_PIX_FMT_YUVJ420P;
+        const bool bt709 = src->colorspace == AVCOL_SPC_BT709;
+        const float y_offset = full_range ? 0.f : 16.f;
+        const float y_scale = full_range ? 1.f : 255.f / 219.f;
+        const float c_scale = full_range ? 1.f : 255.f / 224.f;
+        const float rv = (bt709 ? 1.5748f : 1.402f) * c_scale;
+        const float gu = (bt709 ? -0.1873f : -0.3441f) * c_scale;
+        const float gv = (bt709 ? -0.4681f : -0.7141f) * c_scale;
+        const float bu = (bt709 ? 1.8556f : 1.772f) * c_scale;
+
+        const int ri = config.rgb ? 0 : 2;
+        const int bi = config.rgb ? 2 : 0;
+        const float r_scale = scale[ri], g_scale = scale[1], b_scale = scale[bi];
+        const float r_offset = offset[ri], g_offset = offset[1], b_offset = offset[bi];
+
+        const int *lx0 = lumaX.i0.data();
+        const int *lx1 = lumaX.i1.data();
+        const float *lwx = lumaX.w.data();
+        const int *cx0 = chromaX.i0.data();
+        const int *cx1 = chromaX.i1.data();
+        const float *cwx = chromaX.w.data();
+
+        for (int oy = 0; oy < h; ++oy) {
+            const uint8_t *y0 = src->data[0] + static_cast<std::ptrdiff_t>(lumaY.i0[oy]) * src->linesize[0];
+            const uint8_t *y1 = src->data[0] + static_cast<std::ptrdiff_t>(lumaY.i1[oy]) * src->linesize[0];
+            const float wy = lumaY.w[oy];
+            const std::ptrdiff_t c0 = static_cast<std::ptrdiff_t>(chromaY.i0[oy]);
+            const std::ptrdiff_t c1 = static_cast<std::ptrdiff_t>(chromaY.i1[oy]);
+            const float wcy = chromaY.w[oy];
+            // NV12: U and V interleaved in plane 1, I420: U in plane 1, V in plane 2
+            const uint8_t *u0 = src->data[1] + c0 * src->linesize[1];
+            const uint8_t *u1 = src->data[1] + c1 * src->linesize[1];
+            const uint8_t *v0 = interleavedChroma ? u0 + 1 : src->data[2] + c0 * src->linesize[2];
+            const uint8_t *v1 = interleavedChroma ? u1 + 1 : src->data[2] + c1 * src->linesize[2];
+            constexpr int cstep = interleavedChroma ? 2 : 1;
+
+            float *dst[3];
+            for (int c = 0; c < 3; ++c) {
+                dst[c] = config.fp16 ? rowScratch.data() + static_cast<std::size_t>(c) * w
+                                     : out.ptr<float>() + c * plane + static_cast<std::size_t>(oy) * w;
+            }
+            float *__restrict r_out = dst[ri];
+            float *__restrict g_out = dst[1];
+            float *__restrict b_out = dst[bi];
+
+            // branch free, the bilinear taps are gathers through the precomputed index tables
+            for (int ox = 0; ox < w; ++ox) {
+                const int a = lx0[ox], b = lx1[ox];
+                const float wx = lwx[ox];
+                float top = y0[a] + wx * float(y0[b] - y0[a]);
+                float bottom = y1[a] + wx * float(y1[b] - y1[a]);
+                float luma = (top + wy * (bottom - top) - y_offset) * y_scale;
+
+                const int ca = cx0[ox] * cstep, cb = cx1[ox] * cstep;
+                const float wcx = cwx[ox];
+                float u_top = u0[ca] + wcx * float(u0[cb] - u0[ca]);
+                float u_bottom = u1[ca] + wcx * float(u1[cb] - u1[ca]);
+                float u = u_top + wcy * (u_bottom - u_top) - 128.f;
+                float v_top = v0[ca] + wcx * float(v0[cb] - v0[ca]);
+                float v_bottom = v1[ca] + wcx * float(v1[cb] - v1[ca]);
+                float v = v_top + wcy * (v_bottom - v_top) - 128.f;
+
+                float r = std::min(255.f, std::max(0.f, luma + rv * v));
+                float g = std::min(255.f, std::max(0.f, luma + gu * u + gv * v));
+                float bl = std::min(255.f, std::max(0.f, luma + bu * u));
+                r_out[ox] = r * r_scale + r_offset;
+                g_out[ox] = g * g_scale + g_offset;
+                b_out[ox] = bl * b_scale + b_offset;
+            }
+
+            if (config.fp16) {
+                // narrowed while the row is still in cache
+                for (int c = 0; c < 3; ++c) {
+                    cv::Mat row(1, w, CV_32F, dst[c]);
+                    cv::Mat half(1, w, CV_16F, out.ptr<uint16_t>() + c * plane + static_cast<std::size_t>(oy) * w);
+                    row.convertTo(half, CV_16F);
+                }
+            }
+        }
+    }
+
+} // tcn::vpf
@@ -0,0 +1,84 @@
+#ifndef ORBBEC_CAPTURE_TEST_TENSORCONVERTER_H
+#define ORBBEC_CAPTURE_TEST_TENSORCONVERTER_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavutil/frame.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+#include <opencv2/opencv.hpp>
+
+namespace tcn::vpf {
+
+    struct TensorConfig {
+        int width{640};
+        int height{640};
+        // per output channel, value = (sample / 255 - mean) / std
+        std::array<float, 3> mean{0.485f, 0.456f, 0.406f};
+        std::array<float, 3> std{0.229f, 0.224f, 0.225f};
+        // plane order, false = BGR
+        bool rgb{true};
+        bool fp16{false};
+        // output buffers recycled once the consumer released them
+        std::size_t poolSize{4};
+    };
+
+    /**
+     * Decoded YUV 4:2:0 planes (NV12 or I420) straight to a resized, normalized, planar (3 x H x W)
+     * float32 / float16 tensor: bilinear sampling, color conversion, normalization and the CHW layout
+     * happen in a single pass over the output instead of BGR image -> resize -> float -> normalize -> CHW.
+     */
+    class TensorConverter {
+    public:
+        explicit TensorConverter(TensorConfig cfg);
+
+        static bool Supports(int pixel_format);
+
+        // out is a 3 x height x width CV_32F / CV_16F Mat from the pool
+        bool Convert(const AVFrame *src, cv::Mat &out);
+
+        const TensorConfig &Config() const { return config; }
+        // tensors allocated outside the pool because every pooled one was still held by a consumer
+        uint64_t PoolMisses() const { return poolMisses; }
+
+    private:
+        // bilinear source positions of one output axis
+        struct Axis {
+            std::vector<int> i0;
+            std::vector<int> i1;
+            std::vector<float> w;
+
+            void Build(int src, int dst);
+        };
+
+        void Prepare(int src_width, int src_height);
+        cv::Mat Acquire();
+
+        template<bool interleavedChroma>
+        void ConvertRows(const AVFrame *src, cv::Mat &out);
+
+        TensorConfig config;
+        int srcWidth{0};
+        int srcHeight{0};
+        Axis lumaX, lumaY, chromaX, chromaY;
+        // normalization folded into value * scale + offset per output plane
+        std::array<float, 3> scale{};
+        std::array<float, 3> offset{};
+        // one output row per plane, only used to narrow to fp16
+        std::vector<float> rowScratch;
+        std::vector<cv::Mat> pool;
+        uint64_t poolMisses{0};
+    };
+
+} // tcn::vpf
+
+#endif //ORBBEC_CAPTURE_TEST_TENSORCONVERTER_H
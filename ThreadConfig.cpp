@@ -0,0 +1,162 @@
+#include "ThreadConfig.h"
+#include <spdlog/spdlog.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace tcn {
+
+    namespace {
+#if defined(__linux__)
+        // from <numaif.h>, spelled out to avoid a libnuma dependency
+        constexpr int kMpolPreferred = 1;
+
+        bool set_preferred_node(int node) {
+            unsigned long mask[16]{};
+            if (node < 0 || node >= static_cast<int>(sizeof(mask) * 8)) {
+                return false;
+            }
+            mask[node / (sizeof(unsigned long) * 8)] |= 1UL << (node % (sizeof(unsigned long) * 8));
+            return syscall(SYS_set_mempolicy, kMpolPreferred, mask, sizeof(mask) * 8 + 1) == 0;
+        }
+#endif
+    }
+
+    std::vector<int> parse_cpu_list(const std::string &list) {
+        std::vector<int> cpus;
+        std::stringstream ss(list);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            if (item.empty()) {
+                continue;
+            }
+            auto dash = item.find('-');
+            try {
+                if (dash == std::string::npos) {
+                    cpus.push_back(std::stoi(item));
+                } else {
+                    int first = std::stoi(item.substr(0, dash));
+                    int last = std::stoi(item.substr(dash + 1));
+                    for (int c = first; c <= last; ++c) {
+                        cpus.push_back(c);
+                    }
+                }
+            } catch (const std::exception &) {
+                spdlog::warn("ignoring invalid cpu list entry: {0}", item);
+            }
+        }
+        return cpus;
+    }
+
+    int numa_node_count() {
+        int count{0};
+        while (std::ifstream("/sys/devices/system/node/node" + std::to_string(count) + "/cpulist")) {
+            ++count;
+        }
+        return count;
+    }
+
+    std::vector<int> numa_node_cpus(int node) {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!in || !std::getline(in, list)) {
+            return {};
+        }
+        return parse_cpu_list(list);
+    }
+
+    int numa_node_of_cpu(int cpu) {
+        for (int node = 0, count = numa_node_count(); node < count; ++node) {
+            for (int c : numa_node_cpus(node)) {
+                if (c == cpu) {
+                    return node;
+                }
+            }
+        }
+        return -1;
+    }
+
+    bool apply_thread_settings(const ThreadSettings &settings) {
+        bool ok{true};
+#if defined(__linux__)
+        pthread_t self = pthread_self();
+        if (!settings.name.empty()) {
+            // kernel limit is 15 characters plus terminator
+            pthread_setname_np(self, settings.name.substr(0, 15).c_str());
+        }
+
+        std::vector<int> cpus = settings.cpus;
+        if (cpus.empty() && settings.numaNode >= 0) {
+            cpus = numa_node_cpus(settings.numaNode);
+        }
+        if (!cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int c : cpus) {
+                if (c >= 0 && c < CPU_SETSIZE) {
+                    CPU_SET(c, &set);
+                }
+            }
+            int ret = pthread_setaffinity_np(self, sizeof(set), &set);
+            if (ret != 0) {
+                spdlog::warn("{0}: setting cpu affinity failed: {1}", settings.name, std::strerror(ret));
+                ok = false;
+            }
+        }
+
+        int node = settings.numaNode;
+        if (node < 0 && !cpus.empty()) {
+            node = numa_node_of_cpu(cpus.front());
+        }
+        const bool numa = node >= 0 && numa_node_count() > 1;
+        if (numa && !set_preferred_node(node)) {
+            spdlog::warn("{0}: setting preferred numa node {1} failed: {2}", settings.name, node, std::strerror(errno));
+            ok = false;
+        }
+
+        bool fifo{false};
+        if (settings.fifoPriority > 0) {
+            sched_param param{};
+            param.sched_priority = settings.fifoPriority;
+            int ret = pthread_setschedparam(self, SCHED_FIFO, &param);
+            if (ret == 0) {
+                fifo = true;
+            } else {
+                // usually EPERM without CAP_SYS_NICE / rtprio limits, fall back to nice
+                spdlog::warn("{0}: SCHED_FIFO priority {1} not permitted: {2}",
+                             settings.name, settings.fifoPriority, std::strerror(ret));
+                ok = false;
+            }
+        }
+        if (!fifo && settings.niceValue != 0) {
+            // on linux the nice value is per thread when addressed by tid
+            if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), settings.niceValue) != 0) {
+                spdlog::warn("{0}: setting nice {1} failed: {2}", settings.name, settings.niceValue, std::strerror(errno));
+                ok = false;
+            }
+        }
+        // threads that only got a name are not worth a line each
+        if (!cpus.empty() || numa || settings.fifoPriority > 0 || settings.niceValue != 0) {
+            spdlog::info("{0}: thread placement cpus: {1} numa: {2} fifo: {3} nice: {4}",
+                         settings.name, cpus.size(), node, fifo ? settings.fifoPriority : 0, fifo ? 0 : settings.niceValue);
+        }
+#else
+        if (!settings.cpus.empty() || settings.fifoPriority > 0 || settings.niceValue != 0 || settings.numaNode >= 0) {
+            spdlog::warn("{0}: thread placement is only supported on linux", settings.name);
+            ok = false;
+        }
+#endif
+        return ok;
+    }
+
+} // tcn
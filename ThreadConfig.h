@@ -0,0 +1,40 @@
+#ifndef ORBBEC_CAPTURE_TEST_THREADCONFIG_H
+#define ORBBEC_CAPTURE_TEST_THREADCONFIG_H
+
+#include <string>
+#include <vector>
+
+namespace tcn {
+
+    /**
+     * Placement of one pipeline thread. Empty / zero fields leave the scheduler defaults untouched.
+     * Settings are applied from inside the thread itself, so threads created afterwards by that
+     * thread (e.g. ffmpeg codec workers) inherit the affinity mask and memory policy.
+     */
+    struct ThreadSettings {
+        std::string name;
+        // cpus to pin to; when empty and numaNode >= 0 the cpus of that node are used
+        std::vector<int> cpus;
+        // SCHED_FIFO priority (1..99), 0 keeps SCHED_OTHER
+        int fifoPriority{0};
+        // nice value used when fifoPriority is 0 or SCHED_FIFO is not permitted
+        int niceValue{0};
+        // prefer allocations from this NUMA node (first-touch of all buffers the thread creates)
+        int numaNode{-1};
+    };
+
+    // applies the settings to the calling thread, returns false if any part was refused
+    bool apply_thread_settings(const ThreadSettings &settings);
+
+    int numa_node_count();
+
+    std::vector<int> numa_node_cpus(int node);
+
+    int numa_node_of_cpu(int cpu);
+
+    // parses a linux cpulist such as "0-3,8,10-11"
+    std::vector<int> parse_cpu_list(const std::string &list);
+
+} // tcn
+
+#endif //ORBBEC_CAPTURE_TEST_THREADCONFIG_H
@@ -0,0 +1,409 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "buffered_channel.h"
+
+namespace tcn {
+
+    /**
+     * Bytes in flight shared by several channels, e.g. one ceiling for the frame queues of all pipelines.
+     * A single item larger than the whole budget is admitted once nothing else is in flight.
+     */
+    class byte_budget {
+    private:
+        mutable std::mutex mutex_{};
+        std::condition_variable released_{};
+        std::size_t limit_;
+        std::size_t used_{0};
+        std::size_t peak_{0};
+
+        bool fits_(std::size_t bytes) const noexcept {
+            return used_ == 0 || used_ + bytes <= limit_;
+        }
+
+        void take_(std::size_t bytes) noexcept {
+            used_ += bytes;
+            peak_ = std::max(peak_, used_);
+        }
+
+    public:
+        explicit byte_budget(std::size_t limit) : limit_{limit} {
+            if (limit_ == 0) {
+                throw std::length_error{"byte budget is invalid"};
+            }
+        }
+
+        byte_budget(byte_budget const &) = delete;
+
+        byte_budget &operator=(byte_budget const &) = delete;
+
+        bool try_acquire(std::size_t bytes) {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            if (!fits_(bytes)) {
+                return false;
+            }
+            take_(bytes);
+            return true;
+        }
+
+        // waits until the bytes fit, cancelled() is checked on every wake up (see notify_all)
+        template<typename Cancelled, typename Clock, typename Duration>
+        channel_op_status acquire_until(std::size_t bytes, Cancelled cancelled,
+                                        std::chrono::time_point<Clock, Duration> const &timeout_time_) {
+            std::chrono::system_clock::time_point timeout_time = detail::convert(timeout_time_);
+            std::unique_lock<std::mutex> lk{mutex_};
+            if (!released_.wait_until(lk, timeout_time, [&]() { return fits_(bytes) || cancelled(); })) {
+                return channel_op_status::timeout;
+            }
+            if (cancelled()) {
+                return channel_op_status::closed;
+            }
+            take_(bytes);
+            return channel_op_status::success;
+        }
+
+        template<typename Cancelled>
+        channel_op_status acquire(std::size_t bytes, Cancelled cancelled) {
+            std::unique_lock<std::mutex> lk{mutex_};
+            released_.wait(lk, [&]() { return fits_(bytes) || cancelled(); });
+            if (cancelled()) {
+                return channel_op_status::closed;
+            }
+            take_(bytes);
+            return channel_op_status::success;
+        }
+
+        void release(std::size_t bytes) noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            used_ -= std::min(bytes, used_);
+            released_.notify_all();
+        }
+
+        // wakes all waiters, so they re-check their cancellation predicate
+        void notify_all() noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            released_.notify_all();
+        }
+
+        std::size_t used() const noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            return used_;
+        }
+
+        std::size_t peak() const noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            return peak_;
+        }
+
+        std::size_t limit() const noexcept {
+            return limit_;
+        }
+    };
+
+    /**
+     * Channel bounded by bytes in flight as well as by item count. The byte size of an item is taken once
+     * on push and returned to the budget(s) on pop. push() applies backpressure, try_push() / push_wait_for()
+     * leave dropping to the caller, like buffered_channel. An item larger than the channel's byte limit
+     * is admitted into an empty channel. Unlike buffered_channel, close() only stops producers: queued items
+     * can still be popped (drained) or discarded with clear(), pops report closed once the channel is empty.
+     */
+    template<typename T>
+    class budgeted_channel {
+    public:
+        using value_type = typename std::remove_reference<T>::type;
+        using size_function = std::function<std::size_t(value_type const &)>;
+
+    private:
+        struct entry {
+            value_type value;
+            std::size_t bytes;
+        };
+
+        mutable std::mutex mutex_{};
+        std::condition_variable waiting_producers_{};
+        std::condition_variable waiting_consumers_{};
+        std::deque<entry> items_{};
+        std::size_t capacity_;
+        std::size_t byte_limit_;
+        size_function size_of_;
+        std::shared_ptr<byte_budget> shared_;
+        std::size_t bytes_{0};
+        std::size_t peak_bytes_{0};
+        std::atomic<bool> closed_{false};
+        detail::channel_observer *observer_{nullptr};
+        std::size_t observer_index_{0};
+
+        bool fits_(std::size_t bytes) const noexcept {
+            return items_.empty() || (items_.size() < capacity_ && bytes_ + bytes <= byte_limit_);
+        }
+
+        void enqueue_(value_type &&value, std::size_t bytes) {
+            items_.push_back(entry{std::move(value), bytes});
+            bytes_ += bytes;
+            peak_bytes_ = std::max(peak_bytes_, bytes_);
+            waiting_consumers_.notify_one();
+            if (observer_) {
+                observer_->on_ready(observer_index_);
+            }
+        }
+
+        std::size_t dequeue_(value_type &value) {
+            value = std::move(items_.front().value);
+            std::size_t bytes = items_.front().bytes;
+            items_.pop_front();
+            bytes_ -= bytes;
+            waiting_producers_.notify_one();
+            return bytes;
+        }
+
+        void release_shared_(std::size_t bytes) noexcept {
+            if (shared_) {
+                shared_->release(bytes);
+            }
+        }
+
+        template<typename Deadline>
+        channel_op_status push_(value_type &&value, Deadline const *timeout_time) {
+            if (closed_) {
+                return channel_op_status::closed;
+            }
+            std::size_t bytes = size_of_(value);
+            // the shared budget is reserved first, it is released again if the item does not make it in
+            if (shared_) {
+                auto cancelled = [this]() { return closed_.load(); };
+                auto status = timeout_time ? shared_->acquire_until(bytes, cancelled, *timeout_time)
+                                           : shared_->acquire(bytes, cancelled);
+                if (status != channel_op_status::success) {
+                    return status;
+                }
+            }
+            std::unique_lock<std::mutex> lk{mutex_};
+            auto ready = [&]() { return fits_(bytes) || closed_; };
+            if (timeout_time) {
+                if (!waiting_producers_.wait_until(lk, *timeout_time, ready)) {
+                    lk.unlock();
+                    release_shared_(bytes);
+                    return channel_op_status::timeout;
+                }
+            } else {
+                waiting_producers_.wait(lk, ready);
+            }
+            if (closed_) {
+                lk.unlock();
+                release_shared_(bytes);
+                return channel_op_status::closed;
+            }
+            enqueue_(std::move(value), bytes);
+            return channel_op_status::success;
+        }
+
+    public:
+        budgeted_channel(std::size_t capacity, std::size_t byte_limit, size_function size_of,
+                         std::shared_ptr<byte_budget> shared = nullptr) :
+                capacity_{capacity}, byte_limit_{byte_limit}, size_of_{std::move(size_of)}, shared_{std::move(shared)} {
+            if (capacity_ == 0 || byte_limit_ == 0 || !size_of_) {
+                throw std::length_error{"channel budget is invalid"};
+            }
+        }
+
+        ~budgeted_channel() {
+            close();
+            release_shared_(bytes_);
+        }
+
+        budgeted_channel(budgeted_channel const &) = delete;
+
+        budgeted_channel &operator=(budgeted_channel const &) = delete;
+
+        bool is_closed() const noexcept {
+            return closed_;
+        }
+
+        void close() noexcept {
+            {
+                std::scoped_lock<std::mutex> lk{mutex_};
+                if (closed_) {
+                    return;
+                }
+                closed_ = true;
+                waiting_producers_.notify_all();
+                waiting_consumers_.notify_all();
+                if (observer_) {
+                    observer_->on_ready(observer_index_);
+                }
+            }
+            // producers waiting for the shared budget
+            if (shared_) {
+                shared_->notify_all();
+            }
+        }
+
+        // discards the queued items, returns how many
+        std::size_t clear() noexcept {
+            std::size_t count;
+            std::size_t bytes;
+            {
+                std::scoped_lock<std::mutex> lk{mutex_};
+                count = items_.size();
+                bytes = bytes_;
+                items_.clear();
+                bytes_ = 0;
+                waiting_producers_.notify_all();
+            }
+            release_shared_(bytes);
+            return count;
+        }
+
+        // accepts items again after close(), for restarting a stopped pipeline
+        void reopen() noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            closed_ = false;
+        }
+
+        // an item can be popped without blocking, or the channel is closed
+        bool ready() const noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            return !items_.empty() || closed_;
+        }
+
+        // at most one observer, nullptr detaches it
+        void observe(detail::channel_observer *observer, std::size_t index) noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            observer_ = observer;
+            observer_index_ = index;
+        }
+
+        std::size_t size() const noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            return items_.size();
+        }
+
+        std::size_t capacity() const noexcept {
+            return capacity_;
+        }
+
+        std::size_t bytes() const noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            return bytes_;
+        }
+
+        std::size_t peak_bytes() const noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            return peak_bytes_;
+        }
+
+        std::size_t byte_limit() const noexcept {
+            return byte_limit_;
+        }
+
+        // occupancy in [0, 1], by items or bytes, whichever is closer to its limit
+        double fill() const noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            return std::min(1., std::max(double(items_.size()) / double(capacity_),
+                                         double(bytes_) / double(byte_limit_)));
+        }
+
+        channel_op_status try_push(value_type &&value) {
+            std::size_t bytes = size_of_(value);
+            // the budget never takes a channel lock, so it can be asked while holding ours
+            std::scoped_lock<std::mutex> lk{mutex_};
+            if (closed_) {
+                return channel_op_status::closed;
+            }
+            if (!fits_(bytes) || (shared_ && !shared_->try_acquire(bytes))) {
+                return channel_op_status::full;
+            }
+            enqueue_(std::move(value), bytes);
+            return channel_op_status::success;
+        }
+
+        channel_op_status try_push(value_type const &value) {
+            return try_push(value_type{value});
+        }
+
+        channel_op_status push(value_type &&value) {
+            return push_<std::chrono::system_clock::time_point>(std::move(value), nullptr);
+        }
+
+        channel_op_status push(value_type const &value) {
+            return push(value_type{value});
+        }
+
+        template<typename Rep, typename Period>
+        channel_op_status push_wait_for(value_type &&value,
+                                        std::chrono::duration<Rep, Period> const &timeout_duration) {
+            return push_wait_until(std::move(value), std::chrono::system_clock::now() + timeout_duration);
+        }
+
+        template<typename Clock, typename Duration>
+        channel_op_status push_wait_until(value_type &&value,
+                                          std::chrono::time_point<Clock, Duration> const &timeout_time_) {
+            std::chrono::system_clock::time_point timeout_time = detail::convert(timeout_time_);
+            return push_(std::move(value), &timeout_time);
+        }
+
+        channel_op_status try_pop(value_type &value) {
+            std::size_t bytes;
+            {
+                std::scoped_lock<std::mutex> lk{mutex_};
+                if (items_.empty()) {
+                    return closed_ ? channel_op_status::closed : channel_op_status::empty;
+                }
+                bytes = dequeue_(value);
+            }
+            release_shared_(bytes);
+            return channel_op_status::success;
+        }
+
+        channel_op_status pop(value_type &value) {
+            std::size_t bytes;
+            {
+                std::unique_lock<std::mutex> lk{mutex_};
+                waiting_consumers_.wait(lk, [&]() { return !items_.empty() || closed_; });
+                if (items_.empty()) {
+                    return channel_op_status::closed;
+                }
+                bytes = dequeue_(value);
+            }
+            release_shared_(bytes);
+            return channel_op_status::success;
+        }
+
+        template<typename Rep, typename Period>
+        channel_op_status pop_wait_for(value_type &value,
+                                       std::chrono::duration<Rep, Period> const &timeout_duration) {
+            return pop_wait_until(value, std::chrono::system_clock::now() + timeout_duration);
+        }
+
+        template<typename Clock, typename Duration>
+        channel_op_status pop_wait_until(value_type &value,
+                                         std::chrono::time_point<Clock, Duration> const &timeout_time_) {
+            std::chrono::system_clock::time_point timeout_time = detail::convert(timeout_time_);
+            std::size_t bytes;
+            {
+                std::unique_lock<std::mutex> lk{mutex_};
+                if (!waiting_consumers_.wait_until(lk, timeout_time, [&]() { return !items_.empty() || closed_; })) {
+                    return channel_op_status::timeout;
+                }
+                if (items_.empty()) {
+                    return channel_op_status::closed;
+                }
+                bytes = dequeue_(value);
+            }
+            release_shared_(bytes);
+            return channel_op_status::success;
+        }
+    };
+}
@@ -28,6 +28,14 @@ namespace tcn {
             return std::chrono::system_clock::now() + ( timeout_time - Clock::now() );
         }
 
+        // told (under the channel lock) that a channel got an item or was closed, see channel_select
+        struct channel_observer {
+            virtual void on_ready(std::size_t index) noexcept = 0;
+
+        protected:
+            ~channel_observer() = default;
+        };
+
     }
 
     enum class channel_op_status {
@@ -54,6 +62,15 @@ namespace tcn {
         std::size_t cidx_{0};
         std::size_t capacity_;
         bool closed_{false};
+        detail::channel_observer *observer_{nullptr};
+        std::size_t observer_index_{0};
+
+        void notify_consumers_() noexcept {
+            waiting_consumers_.notify_one();
+            if (observer_) {
+                observer_->on_ready(observer_index_);
+            }
+        }
 
         bool is_full_() const noexcept {
             return cidx_ == ((pidx_ + 1) % capacity_);
@@ -90,15 +107,42 @@ namespace tcn {
             return is_closed_();
         }
 
+        // number of queued items, only a snapshot while producers / consumers are active
+        std::size_t size() const noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            return (pidx_ + capacity_ - cidx_) % capacity_;
+        }
+
+        // one slot always stays free to tell full from empty
+        std::size_t capacity() const noexcept {
+            return capacity_ - 1;
+        }
+
         void close() noexcept {
             std::scoped_lock<std::mutex> lk{mutex_};
             if (!closed_) {
                 closed_ = true;
                 waiting_producers_.notify_all();
                 waiting_consumers_.notify_all();
+                if (observer_) {
+                    observer_->on_ready(observer_index_);
+                }
             }
         }
 
+        // an item can be popped without blocking, or the channel is closed
+        bool ready() const noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            return !is_empty_() || is_closed_();
+        }
+
+        // at most one observer, nullptr detaches it
+        void observe(detail::channel_observer *observer, std::size_t index) noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            observer_ = observer;
+            observer_index_ = index;
+        }
+
         channel_op_status try_push(value_type const &value) {
             std::scoped_lock<std::mutex> lk{mutex_};
             if (is_closed_()) {
@@ -109,7 +153,7 @@ namespace tcn {
             }
             slots_[pidx_] = value;
             pidx_ = (pidx_ + 1) % capacity_;
-            waiting_consumers_.notify_one();
+            notify_consumers_();
             return channel_op_status::success;
         }
 
@@ -123,7 +167,7 @@ namespace tcn {
             }
             slots_[pidx_] = std::move(value);
             pidx_ = (pidx_ + 1) % capacity_;
-            waiting_consumers_.notify_one();
+            notify_consumers_();
             return channel_op_status::success;
         }
 
@@ -145,7 +189,7 @@ namespace tcn {
 
             slots_[pidx_] = value;
             pidx_ = (pidx_ + 1) % capacity_;
-            waiting_consumers_.notify_one();
+            notify_consumers_();
             return channel_op_status::success;
         }
 
@@ -169,7 +213,7 @@ namespace tcn {
             slots_[pidx_] = std::move(value);
             pidx_ = (pidx_ + 1) % capacity_;
 
-            waiting_consumers_.notify_one();
+            notify_consumers_();
             return channel_op_status::success;
         }
 
@@ -213,7 +257,7 @@ namespace tcn {
 
             slots_[pidx_] = value;
             pidx_ = (pidx_ + 1) % capacity_;
-            waiting_consumers_.notify_one();
+            notify_consumers_();
             return channel_op_status::success;
         }
 
@@ -244,7 +288,7 @@ namespace tcn {
             slots_[pidx_] = std::move(value);
             pidx_ = (pidx_ + 1) % capacity_;
             // notify one waiting consumer
-            waiting_consumers_.notify_one();
+            notify_consumers_();
             return channel_op_status::success;
         }
 
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+
+#include "buffered_channel.h"
+
+namespace tcn {
+
+    /**
+     * Blocks one consumer until any of several channels (buffered_channel, budgeted_channel) can be popped
+     * without blocking, or is closed, or until stop() is called. Channels report readiness themselves, so
+     * waiting costs nothing per channel and there is no polling interval. Ready channels are returned round
+     * robin, a channel stays ready until a check finds it empty: pop what is wanted, then wait() again.
+     *
+     * add(), remove() and wait() belong to the consuming thread, stop() may be called from any thread.
+     * Channels must outlive their registration (remove() or the selector's destruction).
+     */
+    class channel_select : private detail::channel_observer {
+    public:
+        static constexpr std::size_t stopped = std::numeric_limits<std::size_t>::max();
+        static constexpr std::size_t timeout = stopped - 1;
+
+    private:
+        struct entry {
+            std::function<bool()> ready;
+            std::function<void()> detach;
+            // bumped by every notification, a stale "not ready" check must not unqueue a fresh one
+            uint64_t seq{0};
+            bool queued{false};
+        };
+
+        std::mutex mutex_{};
+        std::condition_variable wakeup_{};
+        // never shrinks, so indices stay valid and references survive add()
+        std::deque<entry> entries_{};
+        // channels that may be ready, each at most once
+        std::deque<std::size_t> candidates_{};
+        bool stopped_{false};
+
+        void on_ready(std::size_t index) noexcept override {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            auto &e = entries_[index];
+            ++e.seq;
+            if (!e.queued) {
+                e.queued = true;
+                candidates_.push_back(index);
+                wakeup_.notify_one();
+            }
+        }
+
+        template<typename Deadline>
+        std::size_t wait_(Deadline const *timeout_time) {
+            std::unique_lock<std::mutex> lk{mutex_};
+            for (;;) {
+                if (stopped_) {
+                    return stopped;
+                }
+                if (candidates_.empty()) {
+                    auto wake = [&]() { return stopped_ || !candidates_.empty(); };
+                    if (timeout_time) {
+                        if (!wakeup_.wait_until(lk, *timeout_time, wake)) {
+                            return timeout;
+                        }
+                    } else {
+                        wakeup_.wait(lk, wake);
+                    }
+                    continue;
+                }
+                std::size_t index = candidates_.front();
+                candidates_.pop_front();
+                auto &e = entries_[index];
+                if (!e.ready) {
+                    e.queued = false;
+                    continue;
+                }
+                // channels notify under their own lock, so ours is never held while taking theirs
+                uint64_t seq = e.seq;
+                lk.unlock();
+                bool ready = e.ready();
+                lk.lock();
+                if (ready || e.seq != seq) {
+                    // stays a candidate until a check finds it empty
+                    candidates_.push_back(index);
+                    if (ready) {
+                        return index;
+                    }
+                } else {
+                    e.queued = false;
+                }
+            }
+        }
+
+    public:
+        channel_select() = default;
+
+        ~channel_select() {
+            for (auto &e : entries_) {
+                if (e.detach) {
+                    e.detach();
+                }
+            }
+        }
+
+        channel_select(channel_select const &) = delete;
+
+        channel_select &operator=(channel_select const &) = delete;
+
+        // returns the index wait() reports for this channel
+        template<typename Channel>
+        std::size_t add(Channel &channel) {
+            std::size_t index;
+            {
+                std::scoped_lock<std::mutex> lk{mutex_};
+                index = entries_.size();
+                entries_.push_back(entry{[&channel]() { return channel.ready(); },
+                                         [&channel]() { channel.observe(nullptr, 0); }});
+                // checked on the first wait(), in case the channel already holds items
+                entries_.back().queued = true;
+                candidates_.push_back(index);
+            }
+            channel.observe(this, index);
+            return index;
+        }
+
+        void remove(std::size_t index) {
+            std::function<void()> detach;
+            {
+                std::scoped_lock<std::mutex> lk{mutex_};
+                if (index >= entries_.size()) {
+                    return;
+                }
+                detach = std::move(entries_[index].detach);
+                entries_[index].ready = nullptr;
+                entries_[index].detach = nullptr;
+            }
+            if (detach) {
+                detach();
+            }
+        }
+
+        // wakes wait(), which returns stopped from now on
+        void stop() noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            stopped_ = true;
+            wakeup_.notify_all();
+        }
+
+        bool is_stopped() noexcept {
+            std::scoped_lock<std::mutex> lk{mutex_};
+            return stopped_;
+        }
+
+        // index of a channel that has an item or is closed, or stopped
+        std::size_t wait() {
+            return wait_<std::chrono::system_clock::time_point>(nullptr);
+        }
+
+        template<typename Rep, typename Period>
+        std::size_t wait_for(std::chrono::duration<Rep, Period> const &timeout_duration) {
+            return wait_until(std::chrono::system_clock::now() + timeout_duration);
+        }
+
+        // index of a ready channel, stopped, or timeout
+        template<typename Clock, typename Duration>
+        std::size_t wait_until(std::chrono::time_point<Clock, Duration> const &timeout_time_) {
+            std::chrono::system_clock::time_point timeout_time = detail::convert(timeout_time_);
+            return wait_(&timeout_time);
+        }
+    };
+}
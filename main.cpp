@@ -4,65 +4,32 @@
 #include <atomic>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <optional>
 #include <future>
 #include <numeric>
+#include <algorithm>
+#include <vector>
 
 #include <spdlog/spdlog.h>
 
 #include <opencv2/opencv.hpp>
 
-#include "buffered_channel.h"
+#include "AllocationCounter.h"
+#include "BackendProbe.h"
+#include "CapturePipeline.h"
+#include "DecoderService.h"
+#include "DisplaySink.h"
+#include "FrameSource.h"
 #include "H26xDecoder.h"
-
-std::unique_ptr<tcn::vpf::H26xDecoder> decoder;
-size_t image_size_bytes{0};
-std::shared_ptr<ob::FrameSet> currentFrameSet;
-std::mutex                    frameSetMutex;
-std::mutex                    displayMutex;
-uint64_t frameCounter{0};
-
-struct FrameInfo{
-    uint64_t frame_idx{0};
-    uint64_t dec_frame_idx{};
-    cv::Mat image;
-};
-tcn::buffered_channel<FrameInfo> frame_queue{2};
-tcn::buffered_channel<std::shared_ptr<ob::FrameSet>> frame_set_queue{8};
-tcn::buffered_channel<cv::Mat> image_queue{8};
-
-std::atomic<bool> should_stop{false};
-
-std::vector<double> frame_durations;
-std::vector<double> encode_durations;
-std::chrono::time_point<std::chrono::system_clock> last_frame_ts;
-bool is_first_frame{true};
-
-void report_stats(const std::string& name, const std::vector<double> v) {
-    if (v.empty()) {
-        spdlog::info("{0} has no measurements", name);
-        return;
-    }
-    double sum = std::accumulate(std::begin(v), std::end(v), 0.0);
-    double m =  sum / v.size();
-
-    double accum = 0.0;
-    std::for_each (std::begin(v), std::end(v), [&](const double d) {
-        accum += (d - m) * (d - m);
-    });
-
-    double stdev = sqrt(accum / (v.size()-1));
-    auto max_duration = std::max_element(std::begin(v), std::end(v));
-    auto min_duration = std::min_element(std::begin(v), std::end(v));
-
-    spdlog::info("{0} stats - count: {1} mean: {2}, std-dev: {3}, min: {4}, max: {5}",
-                 name, v.size(), m, stdev, *min_duration, *max_duration);
-
-}
-
+#include "OfflineDecoder.h"
+#include "RunConfig.h"
+#include "RunReport.h"
+#include "Statistics.h"
+#include "ThreadConfig.h"
 
 static void avlog_cb(void *, int level, const char * szFmt, va_list varg) {
     char buffer [1024];
@@ -89,6 +56,89 @@ static void avlog_cb(void *, int level, const char * szFmt, va_list varg) {
     }
 }
 
+// the profile "auto" selects from, empty for an explicit backend
+static std::string backend_cache_path(const tcn::RunConfig &run) {
+    if (run.backend != "auto") {
+        return {};
+    }
+    return run.backendCache.empty() ? tcn::vpf::default_backend_cache_path() : run.backendCache;
+}
+
+// stream format the backend is probed for
+static OBFormat backend_format(const tcn::RunConfig &run) {
+    return run.replayFiles.empty() ? run.codec : tcn::codec_from_path(run.replayFiles.front(), run.codec);
+}
+
+// the configured backend, or for "auto" the fastest one that works on this host (probed once, then cached)
+static AVHWDeviceType select_backend(const tcn::RunConfig &run) {
+    if (run.backend == "software") {
+        return AV_HWDEVICE_TYPE_NONE;
+    }
+    if (run.backend != "auto") {
+        return av_hwdevice_find_type_by_name(run.backend.c_str());
+    }
+    tcn::vpf::BackendProbeConfig probe;
+    probe.candidates = tcn::vpf::default_backend_candidates();
+    probe.format = backend_format(run);
+    probe.samplePath = !run.probeSample.empty() ? run.probeSample
+                       : run.replayFiles.empty() ? std::string{} : run.replayFiles.front();
+    probe.sampleWidth = run.width;
+    probe.sampleHeight = run.height;
+    probe.softwareThreads = std::max<int>(1, static_cast<int>(std::thread::hardware_concurrency()));
+    probe.cachePath = backend_cache_path(run);
+    probe.refresh = run.reprobe;
+    return tcn::vpf::probe_backends(probe).selected;
+}
+
+// decodes run.offlinePath GOP-parallel, optionally once per worker count to measure the scaling
+static int run_offline(const tcn::RunConfig &run, AVHWDeviceType device_type) {
+    const int cpu_count = std::max<int>(1, static_cast<int>(std::thread::hardware_concurrency()));
+    const int max_workers = run.offlineWorkers > 0 ? run.offlineWorkers : cpu_count;
+    std::vector<int> worker_counts;
+    if (run.offlineScaling) {
+        for (int w = 1; w < max_workers; w *= 2) {
+            worker_counts.push_back(w);
+        }
+    }
+    worker_counts.push_back(max_workers);
+
+    std::vector<tcn::vpf::OfflineDecodeResult> runs;
+    for (int workers : worker_counts) {
+        tcn::vpf::OfflineDecodeConfig cfg;
+        cfg.path = run.offlinePath;
+        cfg.deviceType = device_type;
+        cfg.workers = workers;
+        cfg.ordered = run.offlineOrdered;
+        tcn::vpf::OfflineDecoder decoder(cfg);
+
+        std::atomic<uint64_t> consumed{0};
+        std::atomic<uint64_t> out_of_order{0};
+        uint64_t next_index{0};
+        auto sink = [&](uint64_t frame_index, cv::Mat) {
+            // ordered sinks run one at a time, so next_index needs no lock there
+            if (run.offlineOrdered) {
+                if (frame_index < next_index) {
+                    ++out_of_order;
+                }
+                next_index = frame_index + 1;
+            }
+            ++consumed;
+        };
+        tcn::vpf::OfflineDecodeResult result;
+        if (!decoder.Run(sink, result)) {
+            return EXIT_FAILURE;
+        }
+        if (out_of_order > 0) {
+            spdlog::error("offline: {0} frames reached the sink out of order", out_of_order.load());
+            return EXIT_FAILURE;
+        }
+        spdlog::info("offline: {0} frames consumed, {1} keyframes indexed", consumed.load(), decoder.Keyframes().size());
+        runs.push_back(std::move(result));
+    }
+    tcn::vpf::OfflineDecoder::ReportScaling(run.offlinePath, runs);
+    return 0;
+}
+
 int main(int argc, char **argv) try {
     spdlog::set_level(spdlog::level::level_enum::info);
     ob::Context::setLoggerSeverity(OB_LOG_SEVERITY_INFO);
@@ -102,179 +152,307 @@ int main(int argc, char **argv) try {
         spdlog::info("HW Device: {0}", av_hwdevice_get_type_name(type));
     }
 
-    AVHWDeviceType device_type = AV_HWDEVICE_TYPE_NONE;
-#if defined(__linux__) // Or #if __linux__
-    device_type = AV_HWDEVICE_TYPE_CUDA;
-#elif __APPLE__
-    device_type = AV_HWDEVICE_TYPE_VIDEOTOOLBOX;
-#elif _WIN32
-    device_type = AV_HWDEVICE_TYPE_CUDA;
-#else
-  spdlog::warning("Running on supported operating system.");
-#endif
-
-
-    // Create a Context
-    ob::Context ctx;
-
-    // Enter the device ip address (currently only FemtoMega devices support network connection, and its default ip address is 192.168.1.10)
-    std::string ip;
-    std::cout << "Input your device ip(default: 10.0.130.42):";
-    std::getline(std::cin, ip);
-    if(ip.empty()) {
-        ip = "10.0.130.42";
+    tcn::RunConfig run;
+    if (!tcn::parse_run_args(argc, argv, run)) {
+        tcn::print_usage(argv[0]);
+        return EXIT_FAILURE;
     }
-    std::string use_depth_in;
-    std::cout << "should depth stream be activated(default: y):";
-    std::getline(std::cin, use_depth_in);
-    if(use_depth_in.empty()) {
-        use_depth_in = "y";
+    if (run.showHelp) {
+        tcn::print_usage(argv[0]);
+        return 0;
+    }
+    const AVHWDeviceType device_type = select_backend(run);
+    spdlog::info("decoding with {0}", tcn::vpf::backend_name(device_type));
+    if (!run.offlinePath.empty()) {
+        return run_offline(run, device_type);
     }
-    bool use_depth = use_depth_in == "y" || use_depth_in == "Y";
-
-
-    auto display_cb = [&](cv::Mat image) {
-        auto ret = image_queue.push(image);
-    };
 
-    auto decoder_task = std::async([&]() {
-        spdlog::info("start decoder thread");
-        while (!should_stop) {
-            std::shared_ptr<ob::FrameSet> fs;
-            auto ret = frame_set_queue.pop_wait_for(fs, std::chrono::milliseconds(5));
-            if (ret == tcn::channel_op_status::timeout) {
-                continue;
-            } else if (ret == tcn::channel_op_status::success) {
-                auto cf = fs->colorFrame();
-                if (!cf) {
-                    spdlog::error("invalid fs received in decoder thread");
-                    continue;
-                }
-                if (cf->format() == OB_FORMAT_H264) {
-                    if (!decoder) {
-
-                        decoder = std::make_unique<tcn::vpf::H26xDecoder>(display_cb);
-                        if (!decoder->DecoderInit(device_type, cf->format(), OB_FORMAT_BGRA)) {
-                            spdlog::error("error initializing decoder");
-                        }
-                        spdlog::info("created decoder: {0}x{1}", cf->width(), cf->height());
-                    }
-
-                    auto t_start = std::chrono::system_clock::now();
-
-                    if (decoder->DecodeOnePacket(static_cast<int>(cf->dataSize()),
-                                                  (uint8_t*)cf->data())) {
-                        ++frameCounter;
-                    } else {
-                        spdlog::info("something went wrong with decoding..");
-                    }
-
-                    auto t_diff = std::chrono::system_clock::now() - t_start;
-                    auto t_diff_us = std::chrono::duration_cast<std::chrono::microseconds>(t_diff).count();
-                    encode_durations.push_back(double(t_diff_us) / 1000.);
-
-                } else {
-                    spdlog::error("invalid frame: no color image {0}", frameCounter);
-                }
-            } else {
-                spdlog::warn("unexpect buffer_channel return status.");
-            }
+    if (run.interactive) {
+        // Enter the device ip address (currently only FemtoMega devices support network connection, and its default ip address is 192.168.1.10)
+        std::string ip;
+        std::cout << "Input your device ip(default: 10.0.130.42):";
+        std::getline(std::cin, ip);
+        if(ip.empty()) {
+            ip = "10.0.130.42";
         }
-        spdlog::info("finish decoder thread");
-    });
-
-
-    // Create a network device through ip (the default port number is: 8090, devices that currently support network mode do not support modifying the port
-    // number)
-    auto device = ctx.createNetDevice(ip.c_str(), 8090);
-
-    // pass in device to create pipeline
-    auto pipe = std::make_shared<ob::Pipeline>(device);
-
-    // Create Config for configuring Pipeline work
-    std::shared_ptr<ob::Config> config = std::make_shared<ob::Config>();
-
-    // Get the color camera configuration list
-    auto colorProfileList = pipe->getStreamProfileList(OB_SENSOR_COLOR);
-    // use default configuration
-    auto colorProfile = colorProfileList->getVideoStreamProfile(2560, 1440, OB_FORMAT_H264, 25);
-    // enable depth stream
-    config->enableStream(colorProfile);
-
-    if (use_depth) {
-        // Get the depth camera configuration list
-        auto depthProfileList = pipe->getStreamProfileList(OB_SENSOR_DEPTH);
-        // use default configuration
-        auto depthProfile = depthProfileList->getVideoStreamProfile(640, 576, OB_FORMAT_Y16, 25);
-        // enable depth stream
-        config->enableStream(depthProfile);
+        std::string use_depth_in;
+        std::cout << "should depth stream be activated(default: y):";
+        std::getline(std::cin, use_depth_in);
+        if(use_depth_in.empty()) {
+            use_depth_in = "y";
+        }
+        run.depth = use_depth_in == "y" || use_depth_in == "Y";
+        run.deviceIps.push_back(ip);
+    } else if (run.deviceIps.empty() && run.replayFiles.empty()) {
+        spdlog::error("no source given, pass a device ip or --replay FILE");
+        return EXIT_FAILURE;
+    }
+    if (run.tensorOutput && run.display) {
+        spdlog::info("tensor output cannot be displayed, running headless");
+        run.display = false;
     }
+    const bool headless = !run.display;
 
+    // Create a Context (shared by all device sources)
+    auto ctx = std::make_shared<ob::Context>();
 
-    auto cb = [&](std::shared_ptr<ob::FrameSet> fs) {
-        if (!fs) {
-            spdlog::error("received invalid frameset");
-            return;
-        }
-        // never forward incomplete frames
-        if ((use_depth && fs->depthFrame() == nullptr) || fs->colorFrame() == nullptr) {
-            spdlog::warn("received incomplete frame - skipping");
+    // decoders only ever overwrite the latest image, the display picks it up at its own rate
+    tcn::DisplaySink display_sink{run.displayScale};
+    auto display_cb = [&](const std::string &name, cv::Mat image) {
+        if (headless) {
             return;
         }
+        display_sink.Submit(name, std::move(image));
+    };
 
-        auto t_now = std::chrono::system_clock::now();
-        auto t_diff = t_now - last_frame_ts;
-        last_frame_ts = t_now;
-        auto t_diff_us = std::chrono::duration_cast<std::chrono::microseconds>(t_diff).count();
-        if (!is_first_frame) {
-            // skip first frame as it includes the startup time..
-            frame_durations.push_back(double(t_diff_us) / 1000.);
-        } else {
-            is_first_frame = false;
+    // spread the cores over the streams instead of letting every decoder claim all of them
+    const size_t stream_count = run.deviceIps.size() + run.replayFiles.size();
+    const int cpu_count = std::max<int>(1, static_cast<int>(std::thread::hardware_concurrency()));
+    const int threads_per_stream = std::max<int>(1, cpu_count / static_cast<int>(stream_count));
+
+    // capture and decode of one pipeline share a cpu block, so encoded frames stay in that block's caches
+    auto placement = [&](size_t pipeline_idx, tcn::PipelineConfig &cfg) {
+        cfg.captureThread.name = "cap" + std::to_string(pipeline_idx);
+        cfg.decoderThread.name = "dec" + std::to_string(pipeline_idx);
+        cfg.depthThread.name = "dep" + std::to_string(pipeline_idx);
+        cfg.captureThread.fifoPriority = cfg.decoderThread.fifoPriority = run.rtPriority;
+        cfg.captureThread.niceValue = cfg.decoderThread.niceValue = cfg.depthThread.niceValue = run.niceValue;
+        if (run.pinThreads) {
+            std::vector<int> cpus;
+            int first = static_cast<int>(pipeline_idx) * threads_per_stream % cpu_count;
+            for (int c = 0; c < threads_per_stream; ++c) {
+                cpus.push_back((first + c) % cpu_count);
+            }
+            cfg.captureThread.cpus = cpus;
+            cfg.decoderThread.cpus = cpus;
+            cfg.depthThread.cpus = cpus;
         }
+    };
 
-        auto idx = fs->colorFrame()->index();
-        if (frame_set_queue.push_wait_for(std::move(fs), std::chrono::milliseconds((1000 / colorProfile->fps()) - 5)) != tcn::channel_op_status::success) {
-            spdlog::error("error while pushing frame {0} into queue", idx);
+    std::shared_ptr<tcn::vpf::DecoderService> decoder_service;
+    if (run.poolWorkers >= 0) {
+        tcn::vpf::DecoderServiceConfig pool_cfg;
+        pool_cfg.deviceType = device_type;
+        pool_cfg.backendCache = backend_cache_path(run);
+        pool_cfg.backendFormat = backend_format(run);
+        pool_cfg.workerCount = run.poolWorkers;
+        pool_cfg.capacityMpxPerSec = run.poolCapacityMpxPerSec;
+        pool_cfg.overloadPolicy = run.poolOverload;
+        decoder_service = std::make_shared<tcn::vpf::DecoderService>(pool_cfg);
+        if (!decoder_service->Start()) {
+            return EXIT_FAILURE;
         }
+    }
 
+    // one ceiling for the frames queued by all pipelines
+    std::shared_ptr<tcn::byte_budget> memory_budget;
+    if (run.memoryBudgetMegabytes > 0.) {
+        memory_budget = std::make_shared<tcn::byte_budget>(static_cast<std::size_t>(run.memoryBudgetMegabytes * 1e6));
+    }
+    const auto queue_bytes = static_cast<std::size_t>(run.queueMegabytes * 1e6);
+
+    // pipelines signal whenever they may have finished, the supervisor sleeps until then or the run deadline
+    std::mutex progress_mutex;
+    std::condition_variable progress_signal;
+    uint64_t progress_events{0};
+    auto progress_cb = [&]() {
+        {
+            std::scoped_lock<std::mutex> lk{progress_mutex};
+            ++progress_events;
+        }
+        progress_signal.notify_all();
     };
+    std::vector<std::unique_ptr<tcn::CapturePipeline>> pipelines;
+    for (const auto &ip : run.deviceIps) {
+        tcn::OrbbecSourceConfig source_cfg;
+        source_cfg.ip = ip;
+        source_cfg.width = run.width;
+        source_cfg.height = run.height;
+        source_cfg.fps = run.fps;
+        source_cfg.format = run.codec;
+        source_cfg.useDepth = run.depth;
+        source_cfg.paddedFrames = run.paddedFrames;
+        source_cfg.hostSync = run.hostSync;
+        source_cfg.sync.toleranceUs = run.syncToleranceUs;
+        tcn::PipelineConfig cfg;
+        cfg.deviceType = device_type;
+        cfg.backendCache = backend_cache_path(run);
+        cfg.decoderThreads = threads_per_stream;
+        cfg.decoderService = decoder_service;
+        cfg.eagerInit = run.eagerInit;
+        cfg.dropMode = run.dropMode;
+        cfg.adaptiveQuality = run.adaptiveQuality;
+        cfg.parserBypass = run.parserBypass;
+        cfg.queueBytes = queue_bytes;
+        cfg.memoryBudget = memory_budget;
+        cfg.drainTimeoutMs = run.drainTimeoutMs;
+        cfg.tensorOutput = run.tensorOutput;
+        cfg.tensor = run.tensor;
+        cfg.depthFilter = run.depth && run.depthFilter;
+        cfg.depthFilterConfig = run.depthFilterConfig;
+        if (cfg.depthFilterConfig.workers == 0) {
+            // the depth filter shares the stream's cores with its decoder
+            cfg.depthFilterConfig.workers = std::max(1, threads_per_stream / 2);
+        }
+        if (!run.recordPrefix.empty()) {
+            cfg.recordPath = run.recordPrefix + (run.deviceIps.size() > 1 ? "-" + std::to_string(pipelines.size()) : "") +
+                             "." + tcn::codec_name(run.codec);
+        }
+        cfg.frameLimit = run.frameLimit;
+        cfg.progressCallback = progress_cb;
+        placement(pipelines.size(), cfg);
+        pipelines.push_back(std::make_unique<tcn::CapturePipeline>(
+                cfg, std::make_unique<tcn::OrbbecFrameSource>(ctx, source_cfg), display_cb));
+    }
+    for (const auto &path : run.replayFiles) {
+        tcn::ReplaySourceConfig source_cfg;
+        source_cfg.path = path;
+        source_cfg.format = tcn::codec_from_path(path, run.codec);
+        source_cfg.width = run.width;
+        source_cfg.height = run.height;
+        source_cfg.fps = run.fps;
+        source_cfg.paced = !run.unpaced;
+        source_cfg.recordedTiming = run.replayTiming;
+        source_cfg.impairment = run.impairment;
+        source_cfg.startFrame = run.replayStart;
+        tcn::PipelineConfig cfg;
+        cfg.name = "replay" + std::to_string(pipelines.size()) + ":" + path;
+        cfg.deviceType = device_type;
+        cfg.backendCache = backend_cache_path(run);
+        cfg.decoderThreads = threads_per_stream;
+        cfg.dropOnFull = !run.unpaced;
+        cfg.decoderService = decoder_service;
+        cfg.eagerInit = run.eagerInit;
+        cfg.dropMode = run.dropMode;
+        cfg.adaptiveQuality = run.adaptiveQuality;
+        cfg.parserBypass = run.parserBypass;
+        cfg.queueBytes = queue_bytes;
+        cfg.memoryBudget = memory_budget;
+        cfg.drainTimeoutMs = run.drainTimeoutMs;
+        cfg.tensorOutput = run.tensorOutput;
+        cfg.tensor = run.tensor;
+        cfg.frameLimit = run.frameLimit;
+        cfg.progressCallback = progress_cb;
+        placement(pipelines.size(), cfg);
+        pipelines.push_back(std::make_unique<tcn::CapturePipeline>(
+                cfg, std::make_unique<tcn::ReplayFrameSource>(source_cfg), display_cb));
+    }
+    spdlog::info("running {0} pipelines with {1} decoder threads each", pipelines.size(), threads_per_stream);
+    for (const auto &p : pipelines) {
+        display_sink.AddWindow(p->Name());
+        if (p->FiltersDepth()) {
+            display_sink.AddWindow(p->DepthName());
+        }
+    }
 
-    // Pass in the configuration and start the pipeline
-    if (use_depth) {
-        pipe->enableFrameSync();
+    tcn::ThreadSettings display_thread;
+    display_thread.name = "display";
+    display_thread.niceValue = run.niceValue;
+    tcn::apply_thread_settings(display_thread);
+    std::vector<double> display_intervals;
+    display_intervals.reserve(tcn::kReservedSamples);
+    auto last_display_ts = std::chrono::steady_clock::now();
+    const auto display_period = std::chrono::duration<double>(1. / run.displayFps);
+
+    auto t_start = std::chrono::steady_clock::now();
+    for (auto &p : pipelines) {
+        if (!p->Start()) {
+            return EXIT_FAILURE;
+        }
     }
-    last_frame_ts = std::chrono::system_clock::now();
-    pipe->start(config, cb);
 
+    const bool timed = run.durationSeconds > 0.;
+    const auto t_deadline = t_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(run.durationSeconds));
+    auto all_done = [&]() {
+        if (timed && std::chrono::steady_clock::now() >= t_deadline) {
+            return true;
+        }
+        return std::all_of(pipelines.begin(), pipelines.end(), [](const auto &p) { return p->Finished(); });
+    };
 
-    while (frame_durations.size() < 500) {
-        cv::Mat image;
-        auto ret = image_queue.pop_wait_for(image, std::chrono::milliseconds(5));
-        if (ret == tcn::channel_op_status::timeout) {
+    for (;;) {
+        uint64_t seen;
+        {
+            std::scoped_lock<std::mutex> lk{progress_mutex};
+            seen = progress_events;
+        }
+        if (all_done()) {
+            break;
+        }
+        if (headless) {
+            // events after the snapshot above are not lost, they make the wait return at once
+            std::unique_lock<std::mutex> lk{progress_mutex};
+            auto progressed = [&]() { return progress_events != seen; };
+            if (timed) {
+                progress_signal.wait_until(lk, t_deadline, progressed);
+            } else {
+                progress_signal.wait(lk, progressed);
+            }
             continue;
-        } else if (ret == tcn::channel_op_status::success) {
-            cv::imshow("color", image);
-            cv::waitKey(2);
-        } else {
-            spdlog::warn("unexpect buffer_channel return status.");
         }
+        auto t_next = std::chrono::steady_clock::now() + display_period;
+        if (display_sink.RenderOnce() > 0) {
+            auto t_now = std::chrono::steady_clock::now();
+            display_intervals.push_back(std::chrono::duration<double, std::milli>(t_now - last_display_ts).count());
+            last_display_ts = t_now;
+        }
+        // waitKey pumps the window events for the remainder of the refresh period
+        auto remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t_next - std::chrono::steady_clock::now()).count();
+        cv::waitKey(static_cast<int>(std::max<int64_t>(1, remaining_ms)));
+    }
+
+    // all pipelines drain side by side against the same deadline, then each is released
+    for (auto &p : pipelines) {
+        p->RequestStop();
+    }
+    for (auto &p : pipelines) {
+        p->Stop();
+    }
+    auto wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    if (decoder_service) {
+        decoder_service->ReportCapacity();
+        decoder_service->Stop();
     }
 
-    // stop the pipeline
-    pipe->stop();
+    uint64_t total_decoded{0};
+    for (const auto &p : pipelines) {
+        p->ReportStats();
+        total_decoded += p->DecodedFrames();
+    }
+    if (memory_budget) {
+        spdlog::info("memory budget: peak {0:.2f}MB of {1:.2f}MB", memory_budget->peak() / 1e6, memory_budget->limit() / 1e6);
+    }
+    if (!display_intervals.empty()) {
+        display_intervals.erase(display_intervals.begin());
+    }
+    tcn::report_jitter("display", display_intervals);
+    if (!headless) {
+        display_sink.ReportStats();
+    }
+    spdlog::info("aggregate: {0} pipelines decoded {1} frames in {2:.3f}s ({3:.1f} fps)",
+                 pipelines.size(), total_decoded, wall_s, wall_s > 0. ? total_decoded / wall_s : 0.);
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
-    should_stop = true;
-    decoder_task.wait();
-    decoder->DecoderTeardown();
+    std::vector<tcn::PipelineReport> reports;
+    for (const auto &p : pipelines) {
+        reports.push_back(p->GetReport());
+    }
+    tcn::report_latency_comparison(reports);
+    if (!run.reportPath.empty()) {
+        if (!tcn::write_run_report(run.reportPath, run, reports, wall_s)) {
+            return EXIT_FAILURE;
+        }
+    }
 
-    report_stats("frame_durations", frame_durations);
-    report_stats("decode_durations", encode_durations);
+    // the report is written either way, a failing run needs it most
+    if (tcn::allocation_accounting_enabled() && tcn::allocation_violations() > 0) {
+        spdlog::error("{0} steady state frames allocated memory in the decode path", tcn::allocation_violations());
+        return EXIT_FAILURE;
+    }
 
     return 0;
 }
 catch(ob::Error &e) {
     spdlog::error("Error: function: {0} args: {1}, msg: {2}, type: {3}", e.getName(), e.getArgs(), e.getMessage(), e.getExceptionType());
     exit(EXIT_FAILURE);
-}
\ No newline at end of file
+}
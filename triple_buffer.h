@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace tcn {
+
+    /**
+     * Single producer / single consumer "latest value" exchange. The producer never blocks and
+     * never waits for the consumer, the consumer always picks up the most recently published value.
+     * Three slots: one owned by each side, one in the middle that is swapped atomically.
+     */
+    template<typename T>
+    class triple_buffer {
+    public:
+        using value_type = T;
+
+    private:
+        static constexpr uint8_t dirty_bit_{0x4};
+        static constexpr uint8_t index_mask_{0x3};
+
+        value_type slots_[3]{};
+        std::atomic<uint8_t> middle_{1};
+        uint8_t back_{0};
+        uint8_t front_{2};
+
+    public:
+        triple_buffer() = default;
+
+        triple_buffer(triple_buffer const &) = delete;
+
+        triple_buffer &operator=(triple_buffer const &) = delete;
+
+        // producer: slot to fill before publish()
+        value_type &back() noexcept {
+            return slots_[back_];
+        }
+
+        // producer: hands the back slot to the consumer, returns true if the value it replaces was never consumed
+        bool publish() noexcept {
+            uint8_t prev = middle_.exchange(static_cast<uint8_t>(back_ | dirty_bit_), std::memory_order_acq_rel);
+            back_ = prev & index_mask_;
+            return (prev & dirty_bit_) != 0;
+        }
+
+        // consumer: takes the latest published value if there is a new one
+        bool update() noexcept {
+            if ((middle_.load(std::memory_order_relaxed) & dirty_bit_) == 0) {
+                return false;
+            }
+            uint8_t prev = middle_.exchange(front_, std::memory_order_acq_rel);
+            front_ = prev & index_mask_;
+            return true;
+        }
+
+        // consumer: value taken by the last successful update()
+        value_type &front() noexcept {
+            return slots_[front_];
+        }
+    };
+}